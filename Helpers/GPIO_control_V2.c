@@ -2,46 +2,251 @@
 // This file contains the implementation of the GPIO PWM discharge functionality on 2 GPIO pins for the DC-DC converter.
 
 #include "GPIO_control_V2.h"
+#include "discharge_internal.h"
+#include "discharge_upload.h"
+#include "adc_monitor.h"
+#include "pwm_control.h"   // PWM_PHASE_COUNT: which PIO blocks the phase chain takes
 #include "hardware/pwm.h"
 #include "hardware/gpio.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/pio.h"
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
+#include "pico/flash.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include "discharge_latency.pio.h"
 
 // --- Pin Definitions ---
 #define PWM_PIN_CH1 16
 #define PWM_PIN_CH2 17
 #define TRIGGER_PIN 18
-#define MAX_STEPS 100
+#define MAX_STEPS DISCHARGE_MAX_STEPS
+#define DISCHARGE_DEFAULT_FREQ_HZ 50000
+#define DISCHARGE_MIN_WRAP 99     // at least 100 duty levels
+// The IRQ engine's wrap handler may take at most 1/DISCHARGE_STEP_BUDGET_SHARE of
+// a period. Until a step update has been timed (step_update_max_clocks), the
+// handler is assumed to need DISCHARGE_STEP_BUDGET_CLOCKS.
+#define DISCHARGE_STEP_BUDGET_CLOCKS 400
+#define DISCHARGE_STEP_BUDGET_SHARE 2
 
 // --- Global Variables ---
-typedef struct {
-    float duty_cycles[MAX_STEPS];
-    int num_steps;
-} ChannelSequence;
-
 static struct {
-    ChannelSequence ch1;
-    ChannelSequence ch2;
-    uint32_t step_duration_ms;
     bool enabled;
     bool verbose;
     bool debug_mode;
     bool manual_trigger;
     bool invert_output;  // Add this line
+    bool dma_mode;       // steps played by DMA instead of the wrap IRQ
 } discharge_config = {
     .invert_output = true  // Default to inverting
 };
 
+// Sequence hand-off between the cores. Core 0 fills a slot that Core 1 is neither
+// playing nor about to adopt, then publishes it with a single store of its index.
+// Core 1 picks up the published slot on start or at its next step boundary, so a
+// running sequence is never seen half-written. With three slots Core 0 always has
+// a free one and never waits for Core 1.
+#define SEQUENCE_SLOTS 3
+static DischargeSequence sequence_slots[SEQUENCE_SLOTS];
+static volatile uint8_t published_slot = 0;   // written by Core 0 only
+static volatile uint8_t playing_slot = 0;     // written by Core 1 only
+static uint8_t edit_slot = 0;
+
+// Streaming (DC_STREAM): steps are played straight out of a ring that USB input
+// keeps topped up, so a sequence can be any length in fixed memory. Core 0 is the
+// only writer of stream_head and Core 1 the only writer of stream_tail. Each entry
+// packs the CH1 level in the low half and the CH2 level in the high half.
+#define STREAM_BUFFER_STEPS 1024    // power of two
+#define STREAM_HIGH_WATER   (STREAM_BUFFER_STEPS * 3 / 4)
+#define STREAM_LOW_WATER    (STREAM_BUFFER_STEPS / 4)
+static uint32_t stream_buffer[STREAM_BUFFER_STEPS];
+static volatile uint32_t stream_head;
+static volatile uint32_t stream_tail;
+static volatile bool stream_ended;           // DC_STREAM_END received
+static volatile bool stream_done;            // ended and played out
+static volatile uint32_t stream_played;
+static volatile uint32_t stream_underruns;   // steps held because the ring was empty
+static uint16_t stream_level_ch1, stream_level_ch2;   // Core 1: current stream step
+
+// Core 0 side of the stream
+static bool stream_input_mode = false;
+static bool stream_paused = false;           // host has been told to wait
+static uint32_t stream_start;
+static uint32_t stream_dropped;
+static uint32_t stream_underruns_reported;
+static bool stream_done_reported = true;
+
+// Binary upload (DC_UPLOAD): the frame format and its checks are in discharge_upload.c.
+// Nothing is committed unless length and CRC check out.
+#define UPLOAD_TIMEOUT_US   2000000
+static bool upload_active = false;
+static bool upload_overflow = false;
+static uint8_t upload_rx[UPLOAD_MAX_ENCODED];
+static uint8_t upload_frame[UPLOAD_MAX_FRAME];
+static uint32_t upload_rx_len;
+static uint32_t upload_last_byte_us;
+static uint32_t upload_step_value;
+static StepUnit upload_step_unit;
+
 static bool csv_input_mode = false;
 static uint slice_ch1, slice_ch2;
 static uint chan_ch1, chan_ch2;
 static volatile bool sequence_running = false;
+static uint16_t discharge_wrap;
+static uint32_t discharge_period_cycles;  // system clocks per PWM period (clkdiv 1)
+static uint32_t discharge_freq_hz = DISCHARGE_DEFAULT_FREQ_HZ;
+static uint16_t discharge_phase_deg;      // CH2 lag behind CH1
+static bool ch2_mirrored;                 // CH2 runs inverted on a centre-aligned slice
+static uint16_t ch2_lag_counts;           // CH2 counter offset on a separate slice
+static volatile bool pwm_reconfig_busy;   // Core 0 is reprogramming the slices
+
+// Step engine state, owned by the wrap IRQ on Core 1
+static uint32_t current_step;
+static uint32_t ch1_index, ch2_index;   // current_step % num_steps, kept incrementally
+static uint64_t step_elapsed_cycles;
+static bool sequence_finished;          // ONCE / HOLD reached the end
+static uint32_t interp_pos;             // position inside the current step, Q16 (65536 = next keyframe)
+static uint32_t interp_rate;            // interp_pos gained per PWM period
+
+// Closed-loop current mode (DC_ISTEP): each step holds a current setpoint in ADC
+// counts above the sensor's zero. Every cl_every PWM periods the wrap IRQ takes the
+// latest DC channel samples and runs one PI update per channel, all in integer
+// math. Gains are Q16 compare levels per ADC count; Core 0 derives them from
+// cl_kp (duty per A) and cl_ki (duty per A per second).
+#define CL_DEFAULT_EVERY 5
+typedef struct {
+    volatile int32_t kp_q16;
+    volatile int32_t ki_q16;      // already scaled by the update interval
+    uint16_t zero;                // sensor reading at 0 A
+    int64_t integ;                // integrator, Q16 levels
+    uint16_t setpoint;
+    volatile uint16_t measured;   // telemetry
+    volatile uint16_t level;      // effective duty level, before inversion
+} CurrentLoop;
+static CurrentLoop current_loop[2];
+static volatile uint32_t cl_every = CL_DEFAULT_EVERY;
+static uint32_t cl_divider;
+static volatile uint32_t cl_updates, cl_saturated, cl_sensor_faults;
+static float cl_kp = 0.002f, cl_ki = 20.0f;
+static uint32_t cl_telemetry_ms;        // Core 1 prints [DATA] CL lines at this interval, 0 = off
+static volatile uint16_t step_update_max_clocks;   // worst wrap-to-levels-written time
+static volatile uint32_t edge_starts, wrap_starts;  // how each run was started
+
+// Start latency probe: a PIO SM timestamps each trigger edge and the first CH1
+// change after it (discharge_latency.pio). pio2 only carries the phase chain
+// above eight phases, so the probe takes one of its SMs otherwise.
+#define LATENCY_PIO          pio2
+#define LATENCY_TIMEOUT_US   2000
+#define LATENCY_BIN_CLOCKS   64       // ~0.43 us per bin at 150 MHz
+#define LATENCY_BINS         64
+static int latency_sm = -1;
+static uint32_t latency_timeout_passes;
+static uint32_t latency_hist[LATENCY_BINS + 1];     // last bin: longer than the table
+static uint32_t latency_samples, latency_timeouts;
+static uint32_t latency_min_clocks, latency_max_clocks;
+static uint64_t latency_sum_clocks;
+
+// Events raised by the wrap IRQ for the Core 1 loop to log
+#define DC_EVENT_STARTED  (1u << 0)
+#define DC_EVENT_STOPPED  (1u << 1)
+#define DC_EVENT_STEP     (1u << 2)
+#define DC_EVENT_CYCLE    (1u << 3)
+#define DC_EVENT_ADOPTED  (1u << 4)
+#define DC_EVENT_FINISHED (1u << 5)
+#define DC_EVENT_ENTRY    (1u << 6)
+static volatile uint32_t discharge_events;
+static volatile uint32_t discharge_event_step;
+
+// DMA sequencer: the data channel writes one packed CH1/CH2 compare word into the
+// slice CC register per wrap DREQ, for as many periods as the step lasts, then
+// chains to the control channel. That channel copies the next 4-word block into
+// the data channel's READ_ADDR, WRITE_ADDR, TRANS_COUNT and CTRL_TRIG. The last
+// block turns the data channel into a one-word copy that points the control
+// channel back at block 0, so the sequence loops with no CPU involvement.
+static uint32_t dma_levels[MAX_STEPS];
+static uint32_t dma_off_level;
+static uint32_t dma_blocks[MAX_STEPS + 1][4];
+static uint32_t dma_blocks_start;   // &dma_blocks[0], source of the rewind block
+static int dma_data_chan = -1;
+static int dma_ctrl_chan = -1;
+static volatile bool dma_table_dirty = false;
+static volatile bool dma_table_busy = false;   // Core 0 is rewriting the table
+
+// CH2's compare value for a level. Centre-aligned interleaving runs CH2 with
+// inverted polarity, so its level is mirrored to keep the same duty; level 0 is
+// still off.
+static inline uint16_t ch2_compare(uint16_t level) {
+    return ch2_mirrored ? (uint16_t)(discharge_wrap + 1 - level) : level;
+}
+
+static inline void discharge_write_levels(uint16_t level_ch1, uint16_t level_ch2) {
+    pwm_set_chan_level(slice_ch1, chan_ch1, level_ch1);
+    pwm_set_chan_level(slice_ch2, chan_ch2, ch2_compare(level_ch2));
+}
 
 // --- PWM Initialization ---
+// Wrap for a switching frequency, or 0 if it is out of range. A centre-aligned
+// slice counts up and back down, so it needs half the wrap of an edge-aligned one.
+static uint32_t discharge_wrap_for(uint32_t freq_hz, bool centred) {
+    if (freq_hz == 0) return 0;
+    uint32_t counts = centred ? 2 : 1;
+    uint64_t per_period = (uint64_t)freq_hz * counts;
+    uint64_t wrap = ((uint64_t)clock_get_hz(clk_sys) + per_period / 2) / per_period;
+    if (wrap < DISCHARGE_MIN_WRAP + 1 || wrap > 65535) return 0;   // level wrap+1 must fit in 16 bits
+    return (uint32_t)(wrap - 1);
+}
+
+// Highest switching frequency the IRQ engine keeps up with: the wrap IRQ runs
+// every period, so the period has to cover the worst step update with margin
+static uint32_t discharge_irq_max_freq_hz(void) {
+    uint32_t budget = step_update_max_clocks > DISCHARGE_STEP_BUDGET_CLOCKS ?
+                      step_update_max_clocks : DISCHARGE_STEP_BUDGET_CLOCKS;
+    return clock_get_hz(clk_sys) / (budget * DISCHARGE_STEP_BUDGET_SHARE);
+}
+
+// Program the slices for a switching frequency and a CH2 phase lag. The outputs
+// are left at level 0. CH1 and CH2 on one slice (GPIO16/17 are slice 0 A/B) can
+// only be interleaved by 180 degrees. The slice then runs centre-aligned. CH1
+// pulses are centred on the bottom of the count and CH2, with inverted polarity
+// and a mirrored level, on the top. On separate slices CH2's counter is
+// preloaded with the lag and both slices are enabled on the same clock.
+static void discharge_pwm_configure(uint32_t freq_hz, uint16_t phase_deg) {
+    bool shared = (slice_ch1 == slice_ch2);
+    bool centred = shared && phase_deg == 180;
+    uint32_t wrap = discharge_wrap_for(freq_hz, centred);
+
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_clkdiv(&config, 1.0f);
+    pwm_config_set_wrap(&config, (uint16_t)wrap);
+    pwm_config_set_phase_correct(&config, centred);
+    pwm_config_set_output_polarity(&config, centred && chan_ch2 == PWM_CHAN_A, centred && chan_ch2 == PWM_CHAN_B);
+
+    pwm_set_enabled(slice_ch1, false);
+    pwm_set_enabled(slice_ch2, false);
+    pwm_init(slice_ch1, &config, false);
+    if (!shared) {
+        pwm_init(slice_ch2, &config, false);
+        uint32_t lag = (uint32_t)(((uint64_t)(wrap + 1) * phase_deg + 180) / 360);
+        pwm_set_counter(slice_ch2, (uint16_t)((wrap + 1 - lag) % (wrap + 1)));
+        ch2_lag_counts = (uint16_t)lag;
+    }
+
+    discharge_wrap = (uint16_t)wrap;
+    discharge_period_cycles = (wrap + 1) * (centred ? 2 : 1);
+    discharge_freq_hz = freq_hz;
+    discharge_phase_deg = phase_deg;
+    ch2_mirrored = centred;
+
+    discharge_write_levels(0, 0);
+    pwm_set_mask_enabled(pwm_hw->en | (1u << slice_ch1) | (1u << slice_ch2));
+}
+
 void discharge_pwm_init(void) {
     // Set GPIO pins to PWM function
     gpio_set_function(PWM_PIN_CH1, GPIO_FUNC_PWM);
@@ -57,27 +262,18 @@ void discharge_pwm_init(void) {
     uint32_t sys_clk_hz = clock_get_hz(clk_sys);
     float clk_freq = (float)sys_clk_hz;
     
-    // Calculate wrap value for 50kHz PWM based on actual clock frequency
-    const uint32_t target_freq = 50000; // 50kHz
-    const uint16_t wrap_value = (uint16_t)((clk_freq / target_freq) - 1);
+    // The wrap comes from the actual clock frequency; DC_FREQ changes it later
+    discharge_pwm_configure(DISCHARGE_DEFAULT_FREQ_HZ, 0);
     
     printf("[DEBUG] GPIO PWM Clock Configuration:\n");
     printf("[DEBUG]   System clock: %.0f Hz\n", clk_freq);
-    printf("[DEBUG]   Target PWM frequency: %lu Hz\n", target_freq);
-    printf("[DEBUG]   Calculated wrap value: %d\n", wrap_value);
-    printf("[DEBUG]   Actual PWM frequency: %.2f Hz\n", clk_freq / (wrap_value + 1));
-    
-    pwm_config config = pwm_get_default_config();
-    pwm_config_set_clkdiv(&config, 1.0f);
-    pwm_config_set_wrap(&config, wrap_value);
-    
-    pwm_init(slice_ch1, &config, true);
-    pwm_init(slice_ch2, &config, true);
+    printf("[DEBUG]   Target PWM frequency: %lu Hz\n", discharge_freq_hz);
+    printf("[DEBUG]   Calculated wrap value: %d\n", discharge_wrap);
+    printf("[DEBUG]   Actual PWM frequency: %.2f Hz\n", clk_freq / discharge_period_cycles);
     
     // Set initial duty based on inversion setting
-    uint16_t initial_level = discharge_config.invert_output ? wrap_value : 0;
-    pwm_set_chan_level(slice_ch1, chan_ch1, initial_level);
-    pwm_set_chan_level(slice_ch2, chan_ch2, initial_level);
+    uint16_t initial_level = discharge_config.invert_output ? discharge_wrap : 0;
+    discharge_write_levels(initial_level, initial_level);
 
     // Setup trigger pin
     gpio_init(TRIGGER_PIN);
@@ -85,129 +281,831 @@ void discharge_pwm_init(void) {
     gpio_pull_down(TRIGGER_PIN);
     
     printf("[INFO] Discharge PWM initialized at %.2f Hz on pins %d and %d\n", 
-           clk_freq / (wrap_value + 1), PWM_PIN_CH1, PWM_PIN_CH2);
+           clk_freq / discharge_period_cycles, PWM_PIN_CH1, PWM_PIN_CH2);
+}
+
+// --- Compare Levels ---
+// The arithmetic lives in discharge_steps.c; these bind it to the current wrap
+// and inversion
+static uint16_t duty_to_level(float duty) {
+    return discharge_duty_to_level(duty, discharge_wrap, discharge_config.invert_output);
+}
+
+static float level_to_duty(uint16_t level) {
+    return discharge_level_to_duty(level, discharge_wrap, discharge_config.invert_output);
+}
+
+static uint16_t discharge_level(const ChannelSequence* seq, uint32_t step) {
+    return discharge_channel_level(seq, step);
+}
+
+static void invert_levels(ChannelSequence* seq) {
+    discharge_invert_levels(seq, discharge_wrap);
+}
+
+static void rescale_levels(ChannelSequence* seq, uint16_t old_wrap) {
+    discharge_rescale_levels(seq, old_wrap, discharge_wrap);
+}
+
+// --- Sequence Slots ---
+// Start a new sequence in a free slot. Core 1 only ever moves to the published
+// slot, so a slot that is neither published nor playing stays free while we fill it.
+DischargeSequence* sequence_begin_edit(void) {
+    uint8_t published = published_slot;
+    uint8_t playing = playing_slot;
+    for (uint8_t i = 0; i < SEQUENCE_SLOTS; ++i) {
+        if (i != published && i != playing) {
+            edit_slot = i;
+            break;
+        }
+    }
+    DischargeSequence* seq = &sequence_slots[edit_slot];
+    seq->ch1.num_steps = 0;
+    seq->ch2.num_steps = 0;
+    seq->streaming = false;
+    seq->per_step = false;
+    seq->end_mode = END_LOOP;
+    seq->interp = INTERP_STEP;
+    seq->closed_loop = false;
+    seq->playlist = 0;
+    return seq;
+}
+
+const DischargeSequence* published_sequence(void) {
+    return &sequence_slots[published_slot];
+}
+
+// Core 1: the sequence whose steps are being played, a playlist entry or the slot itself
+static const DischargeSequence* playing_sequence(void) {
+    const DischargeSequence* seq = &sequence_slots[playing_slot];
+    return seq->playlist ? &playlists[seq->playlist - 1].entries[playlist_index] : seq;
+}
+
+static void discharge_sequence_changed(void);
+
+void sequence_publish(void) {
+    const DischargeSequence* seq = &sequence_slots[edit_slot];
+    __mem_fence_release();
+    published_slot = edit_slot;
+    discharge_config.enabled = (seq->streaming || seq->playlist || seq->ch1.num_steps > 0 || seq->ch2.num_steps > 0);
+    discharge_sequence_changed();
+}
+
+// Bring a copy made at another frequency or inversion to the current ones
+void sequence_conform(DischargeSequence* seq, uint16_t from_wrap, bool from_inverted) {
+    if (!seq->closed_loop) {
+        if (from_wrap != discharge_wrap) {
+            rescale_levels(&seq->ch1, from_wrap);
+            rescale_levels(&seq->ch2, from_wrap);
+        }
+        if (from_inverted != discharge_config.invert_output) {
+            invert_levels(&seq->ch1);
+            invert_levels(&seq->ch2);
+        }
+    }
+    if (!seq->per_step && seq->step_unit == STEP_UNIT_PERIODS) {
+        seq->step_cycles = (uint64_t)seq->step_duration * discharge_period_cycles;
+    }
+}
+
+// Core 0: whether the published or the playing slot plays this playlist table
+bool sequence_uses_playlist(uint8_t table) {
+    return sequence_slots[published_slot].playlist == table + 1 ||
+           sequence_slots[playing_slot].playlist == table + 1;
+}
+
+// Core 1: switch to the latest published sequence. Returns true if it changed.
+static bool sequence_adopt(void) {
+    uint8_t slot = published_slot;
+    if (slot == playing_slot) return false;
+    __mem_fence_acquire();
+    playing_slot = slot;
+
+    const DischargeSequence* seq = &sequence_slots[slot];
+    if (seq->streaming) {
+        // Skip whatever an older stream left unplayed
+        if ((int32_t)(stream_tail - seq->stream_start) < 0) {
+            stream_tail = seq->stream_start;
+        }
+        stream_played = 0;
+        stream_underruns = 0;
+        stream_done = false;
+    }
+    return true;
+}
+
+// --- Stream Ring ---
+// Core 0: steps queued and not yet played. Until Core 1 adopts the current
+// stream its tail may still point into an older one.
+static uint32_t stream_used(void) {
+    uint32_t tail = stream_tail;
+    if ((int32_t)(tail - stream_start) < 0) {
+        tail = stream_start;
+    }
+    return stream_head - tail;
+}
+
+// Core 1: load the next stream step. An empty ring holds the current levels
+// (an underrun) until the stream has ended, after which the outputs go off.
+static void stream_next_step(void) {
+    uint32_t tail = stream_tail;
+    if (tail == stream_head) {
+        if (stream_ended) {
+            stream_done = true;
+            stream_level_ch1 = 0;
+            stream_level_ch2 = 0;
+        } else {
+            stream_underruns++;
+        }
+        return;
+    }
+    __mem_fence_acquire();
+    uint32_t entry = stream_buffer[tail & (STREAM_BUFFER_STEPS - 1)];
+    stream_level_ch1 = (uint16_t)entry;
+    stream_level_ch2 = (uint16_t)(entry >> 16);
+    __mem_fence_release();
+    stream_tail = tail + 1;
+    stream_played++;
+}
+
+// --- DMA Sequencer ---
+
+static void discharge_dma_init(void) {
+    if (slice_ch1 != slice_ch2) {
+        return;     // Both compare levels must live in one CC register
+    }
+    dma_data_chan = dma_claim_unused_channel(true);
+    dma_ctrl_chan = dma_claim_unused_channel(true);
+    dma_blocks_start = (uint32_t)(uintptr_t)&dma_blocks[0][0];
+}
+
+uint32_t discharge_max_steps(const DischargeSequence* seq) {
+    uint32_t max_steps = 0;
+    if (seq->ch1.num_steps > max_steps) max_steps = seq->ch1.num_steps;
+    if (seq->ch2.num_steps > max_steps) max_steps = seq->ch2.num_steps;
+    return max_steps;
+}
+
+static uint64_t discharge_step_cycles(const DischargeSequence* seq, uint32_t step) {
+    return seq->per_step ? seq->seg_cycles[step] : seq->step_cycles;
+}
+
+// Convert a sequence into compare words and DMA blocks. Only call while the DMA is stopped.
+static void discharge_dma_build(const DischargeSequence* seq) {
+    dma_channel_config c = dma_channel_get_default_config(dma_data_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pwm_get_dreq(slice_ch1));
+    channel_config_set_chain_to(&c, dma_ctrl_chan);
+    channel_config_set_irq_quiet(&c, true);
+    const uint32_t step_ctrl = channel_config_get_ctrl_value(&c);
+    channel_config_set_chain_to(&c, dma_data_chan);
+    const uint32_t last_ctrl = channel_config_get_ctrl_value(&c);   // paced, ends the chain
+
+    c = dma_channel_get_default_config(dma_data_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_irq_quiet(&c, true);
+    const uint32_t rewind_ctrl = channel_config_get_ctrl_value(&c);
+
+    const uint32_t cc_addr = (uint32_t)(uintptr_t)&pwm_hw->slice[slice_ch1].cc;
+    dma_off_level = (uint32_t)ch2_compare(0) << (16 * chan_ch2);
+    uint32_t max_steps = discharge_max_steps(seq);
+    uint32_t blocks = 0;
+    uint64_t carry = 0;
+    for (uint32_t step = 0; step < max_steps; ++step) {
+        dma_levels[step] = ((uint32_t)discharge_level(&seq->ch1, step) << (16 * chan_ch1)) |
+                           ((uint32_t)ch2_compare(discharge_level(&seq->ch2, step)) << (16 * chan_ch2));
+
+        // Same rounding as the IRQ engine: whole periods per step, remainder carried on
+        carry += discharge_step_cycles(seq, step);
+        uint32_t periods = (uint32_t)(carry / discharge_period_cycles);
+        carry -= (uint64_t)periods * discharge_period_cycles;
+        if (periods == 0) continue;
+
+        dma_blocks[blocks][0] = (uint32_t)(uintptr_t)&dma_levels[step];
+        dma_blocks[blocks][1] = cc_addr;
+        dma_blocks[blocks][2] = periods;
+        dma_blocks[blocks][3] = step_ctrl;
+        blocks++;
+    }
+    if (blocks == 0 && max_steps > 0) {
+        // Every step is shorter than a period; hold the last one for a period
+        dma_blocks[0][0] = (uint32_t)(uintptr_t)&dma_levels[max_steps - 1];
+        dma_blocks[0][1] = cc_addr;
+        dma_blocks[0][2] = 1;
+        dma_blocks[0][3] = step_ctrl;
+        blocks = 1;
+    }
+
+    if (seq->end_mode == END_LOOP) {
+        dma_blocks[blocks][0] = (uint32_t)(uintptr_t)&dma_blocks_start;
+        dma_blocks[blocks][1] = (uint32_t)(uintptr_t)&dma_hw->ch[dma_ctrl_chan].al3_read_addr_trig;
+        dma_blocks[blocks][2] = 1;
+        dma_blocks[blocks][3] = rewind_ctrl;
+    } else if (seq->end_mode == END_ONCE) {
+        // One more period to write the off level, then stop
+        dma_blocks[blocks][0] = (uint32_t)(uintptr_t)&dma_off_level;
+        dma_blocks[blocks][1] = cc_addr;
+        dma_blocks[blocks][2] = 1;
+        dma_blocks[blocks][3] = last_ctrl;
+    } else if (blocks > 0) {
+        // Stop after the last step; its level stays in the CC register
+        dma_blocks[blocks - 1][3] = last_ctrl;
+    }
+
+    c = dma_channel_get_default_config(dma_ctrl_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 4);   // READ_ADDR, WRITE_ADDR, TRANS_COUNT, CTRL_TRIG
+    dma_channel_configure(dma_ctrl_chan, &c, &dma_hw->ch[dma_data_chan].read_addr,
+                          dma_blocks, 4, false);
+    dma_table_dirty = false;
+}
+
+static void discharge_dma_start(void) {
+    if (dma_table_dirty) {
+        discharge_dma_build(&sequence_slots[playing_slot]);
+    }
+    dma_channel_set_read_addr(dma_ctrl_chan, dma_blocks, true);
+}
+
+static void discharge_dma_stop(void) {
+    dma_channel_abort(dma_ctrl_chan);
+    dma_channel_abort(dma_data_chan);
+    dma_channel_abort(dma_ctrl_chan);
+}
+
+// Re-derive the DMA table after a new sequence was published. A playing table
+// is in use, so in that case the rebuild waits for the next start. Core 0 flags
+// the table busy before checking for a run, and the wrap IRQ marks the run
+// before checking the flag, so at most one side touches the table. The wrap IRQ
+// is turned back on so that it sees the new sequence (DMA mode turns it off).
+static void discharge_sequence_changed(void) {
+    pwm_set_irq_enabled(slice_ch1, true);
+    if (!discharge_config.dma_mode) return;
+    dma_table_busy = true;
+    __dmb();
+    if (sequence_running) {
+        dma_table_dirty = true;
+        dma_table_busy = false;
+        return;
+    }
+    discharge_dma_build(published_sequence());
+    dma_table_busy = false;
 }
 
 // --- Core1 Real-time Loop ---
-void core1_discharge_loop(void) {
-    // Calculate wrap value dynamically based on actual clock frequency
-    uint32_t sys_clk_hz = clock_get_hz(clk_sys);
-    const uint32_t target_freq = 50000; // 50kHz
-    const uint16_t WRAP_VALUE = (uint16_t)((sys_clk_hz / target_freq) - 1);
-    
-    uint32_t cycle_start_time = 0;
-    uint32_t current_step = 0;
-    uint32_t step_start_time = 0;
-    uint32_t last_step_logged = 0xFFFFFFFF;
-    bool was_running = false;
-    
-    while (true) {
-        bool trigger_active = discharge_config.debug_mode ? 
-                             discharge_config.manual_trigger : 
-                             gpio_get(TRIGGER_PIN);
-        
-        if (trigger_active && discharge_config.enabled && !sequence_running) {
-            sequence_running = true;
-            cycle_start_time = to_ms_since_boot(get_absolute_time());
-            step_start_time = cycle_start_time;
-            current_step = 0;
-            last_step_logged = 0xFFFFFFFF;
-            if (discharge_config.verbose) {
-                printf("[INFO] Discharge sequence started\n");
-            }
-        } else if (!trigger_active && sequence_running) {
-            sequence_running = false;
-            pwm_set_chan_level(slice_ch1, chan_ch1, 0);
-            pwm_set_chan_level(slice_ch2, chan_ch2, 0);
-            current_step = 0;
-            if (discharge_config.verbose) {
-                printf("[INFO] Discharge sequence stopped\n");
-            }
+static void current_loop_reset(void) {
+    current_loop[0].integ = 0;
+    current_loop[1].integ = 0;
+    cl_divider = 0;
+}
+
+// One PI update with clamping anti-windup: the integrator stays within the PWM
+// range and does not grow further while the output is saturated in its direction.
+// Returns the effective duty level.
+static uint16_t current_loop_update(CurrentLoop* cl, int adc_input) {
+    uint16_t raw = adc_latest_raw(adc_input);
+    if (raw < ADC_DISCONNECT_THRESHOLD) {
+        // Sensor unplugged: regulating on it would drive the output to full duty
+        cl->integ = 0;
+        cl->level = 0;
+        cl_sensor_faults++;
+        return 0;
+    }
+    int32_t measured = (int32_t)raw - cl->zero;
+    if (measured < 0) measured = -measured;
+    int32_t error = (int32_t)cl->setpoint - measured;
+
+    int64_t limit = (int64_t)(discharge_wrap + 1) << 16;
+    int64_t integ = cl->integ + (int64_t)cl->ki_q16 * error;
+    if (integ < 0) integ = 0;
+    if (integ > limit) integ = limit;
+    int64_t out = (int64_t)cl->kp_q16 * error + integ;
+    if (out > limit) {
+        out = limit;
+        if (error > 0) integ = cl->integ;
+        cl_saturated++;
+    } else if (out < 0) {
+        out = 0;
+        if (error < 0) integ = cl->integ;
+        cl_saturated++;
+    }
+    cl->integ = integ;
+    cl->measured = (uint16_t)measured;
+    cl->level = (uint16_t)(out >> 16);
+    return cl->level;
+}
+
+static void current_loop_run(const DischargeSequence* seq) {
+    uint16_t level1 = seq->ch1.num_steps > 0 ? current_loop_update(&current_loop[0], 0) : 0;
+    uint16_t level2 = seq->ch2.num_steps > 0 ? current_loop_update(&current_loop[1], 1) : 0;
+    if (discharge_config.invert_output) {
+        level1 = level1 > discharge_wrap ? 0 : discharge_wrap - level1;
+        level2 = level2 > discharge_wrap ? 0 : discharge_wrap - level2;
+    }
+    discharge_write_levels(level1, level2);
+    cl_updates++;
+}
+
+// Keyframe i of a channel and its neighbours, for the step being played. Past
+// the ends of a LOOP sequence the curve wraps round, otherwise it flattens out.
+static void interp_keyframes(const DischargeSequence* seq, const ChannelSequence* ch, uint32_t index,
+                             int32_t k[4]) {
+    uint32_t n = (uint32_t)ch->num_steps;
+    uint32_t max_steps = discharge_max_steps(seq);
+    bool loop = seq->end_mode == END_LOOP;
+    bool first = current_step == 0;
+    bool last = current_step + 1 >= max_steps;
+
+    k[1] = ch->levels[index];
+    k[0] = first ? (loop ? ch->levels[(max_steps - 1) % n] : k[1]) : ch->levels[index ? index - 1 : n - 1];
+    if (last) {
+        k[2] = loop ? ch->levels[0] : k[1];
+        k[3] = loop ? ch->levels[1 % n] : k[2];
+    } else {
+        uint32_t next = index + 1 < n ? index + 1 : 0;
+        k[2] = ch->levels[next];
+        if (current_step + 2 >= max_steps) {
+            k[3] = loop ? ch->levels[0] : k[2];
+        } else {
+            k[3] = ch->levels[next + 1 < n ? next + 1 : 0];
         }
-        
-        if (sequence_running && discharge_config.step_duration_ms > 0) {
-            uint32_t now = to_ms_since_boot(get_absolute_time());
-            
-            // Check if we need to advance to the next step
-            if ((now - step_start_time) >= discharge_config.step_duration_ms) {
-                current_step++;
-                step_start_time = now;
-                
-                // Find the maximum number of steps across all channels
-                uint32_t max_steps = 0;
-                if (discharge_config.ch1.num_steps > max_steps) max_steps = discharge_config.ch1.num_steps;
-                if (discharge_config.ch2.num_steps > max_steps) max_steps = discharge_config.ch2.num_steps;
-                
-                // Reset cycle if we've completed all steps
-                if (max_steps > 0 && current_step >= max_steps) {
-                    current_step = 0;
-                    if (discharge_config.verbose && last_step_logged != current_step) {
-                        printf("[DEBUG] Sequence cycle completed, restarting\n");
-                        last_step_logged = current_step;
-                    }
-                }
-                
-                // Log step changes only when they actually change
-                if (discharge_config.verbose && last_step_logged != current_step) {
-                    printf("[DEBUG] Step %lu: CH1=%.2f, CH2=%.2f\n", 
-                           current_step,
-                           discharge_config.ch1.num_steps > 0 ? 
-                           discharge_config.ch1.duty_cycles[current_step % discharge_config.ch1.num_steps] : 0.0f,
-                           discharge_config.ch2.num_steps > 0 ? 
-                           discharge_config.ch2.duty_cycles[current_step % discharge_config.ch2.num_steps] : 0.0f);
-                    last_step_logged = current_step;
-                }
+    }
+}
+
+static void interp_apply(const DischargeSequence* seq) {
+    int32_t k[4];
+    uint32_t t = interp_pos < 65536u ? interp_pos : 65536u;
+    uint16_t level1 = 0, level2 = 0;
+    if (seq->ch1.num_steps > 0) {
+        interp_keyframes(seq, &seq->ch1, ch1_index, k);
+        level1 = discharge_interp_level(seq->interp, k, t, discharge_wrap);
+    }
+    if (seq->ch2.num_steps > 0) {
+        interp_keyframes(seq, &seq->ch2, ch2_index, k);
+        level2 = discharge_interp_level(seq->interp, k, t, discharge_wrap);
+    }
+    discharge_write_levels(level1, level2);
+}
+
+// Step boundary: the two divisions happen once per step, each period just adds interp_rate
+static void interp_begin_step(const DischargeSequence* seq) {
+    uint64_t step_cycles = discharge_step_cycles(seq, current_step);
+    if (step_cycles == 0) {
+        interp_pos = 0;
+        interp_rate = 0;
+        return;
+    }
+    interp_pos = (uint32_t)((step_elapsed_cycles << 16) / step_cycles);
+    interp_rate = (uint32_t)(((uint64_t)discharge_period_cycles << 16) / step_cycles);
+}
+
+static void discharge_apply_step(void) {
+    const DischargeSequence* seq = playing_sequence();
+    if (seq->closed_loop) {
+        // The controller drives the outputs; a step only moves the setpoints
+        current_loop[0].setpoint = seq->ch1.num_steps > 0 ? seq->ch1.levels[ch1_index] : 0;
+        current_loop[1].setpoint = seq->ch2.num_steps > 0 ? seq->ch2.levels[ch2_index] : 0;
+        return;
+    }
+    if (seq->streaming) {
+        discharge_write_levels(stream_level_ch1, stream_level_ch2);
+        return;
+    }
+    if (seq->interp != INTERP_STEP) {
+        interp_begin_step(seq);
+        interp_apply(seq);
+        return;
+    }
+    const ChannelSequence* ch1 = &seq->ch1;
+    const ChannelSequence* ch2 = &seq->ch2;
+    discharge_write_levels(ch1->num_steps > 0 ? ch1->levels[ch1_index] : 0,
+                           ch2->num_steps > 0 ? ch2->levels[ch2_index] : 0);
+}
+
+// End of a pass through a playlist entry: play it again, move to the next entry,
+// or go round to the first. Returns false once a ONCE / HOLD playlist is done.
+static bool playlist_next(void) {
+    const DischargeSequence* list = &sequence_slots[playing_slot];
+    const Playlist* pl = &playlists[list->playlist - 1];
+    uint16_t passes = pl->passes[playlist_index];
+    if (passes == 0 || ++playlist_pass < passes) return true;
+    if (playlist_index + 1u < pl->count) {
+        playlist_index++;
+    } else if (list->end_mode == END_LOOP) {
+        playlist_index = 0;
+    } else {
+        return false;
+    }
+    playlist_pass = 0;
+    discharge_events |= DC_EVENT_ENTRY;
+    return true;
+}
+
+// Move on one step; returns true at the end of the sequence. ONCE and HOLD
+// then stay on the last step with sequence_finished set. In a playlist the
+// next pass may belong to another entry; re-read playing_sequence() after.
+static bool discharge_advance(const DischargeSequence* seq, uint32_t max_steps) {
+    if (current_step + 1 >= max_steps) {
+        bool more = sequence_slots[playing_slot].playlist ? playlist_next() : seq->end_mode == END_LOOP;
+        if (!more) {
+            sequence_finished = true;
+            return true;
+        }
+        current_step = 0;
+        ch1_index = 0;
+        ch2_index = 0;
+        return true;
+    }
+    current_step++;
+    ch1_index = discharge_next_index(ch1_index, seq->ch1.num_steps);
+    ch2_index = discharge_next_index(ch2_index, seq->ch2.num_steps);
+    return false;
+}
+
+static void discharge_restart(void) {
+    current_step = 0;
+    ch1_index = 0;
+    ch2_index = 0;
+    step_elapsed_cycles = 0;
+    sequence_finished = false;
+    playlist_index = 0;
+    playlist_pass = 0;
+}
+
+// Start playing from the first step. Returns false while Core 0 is rebuilding the
+// DMA table, the slices or flash; the wrap IRQ then retries every period.
+static bool discharge_start(void) {
+    sequence_running = true;
+    __dmb();
+    if (dma_table_busy || pwm_reconfig_busy || flash_write_busy) {
+        sequence_running = false;
+        return false;
+    }
+    sequence_adopt();
+    discharge_restart();
+    current_loop_reset();
+    if (playing_sequence()->streaming) {
+        stream_next_step();
+    }
+    if (discharge_config.dma_mode) {
+        discharge_dma_start();
+    } else {
+        discharge_apply_step();
+    }
+    discharge_events |= DC_EVENT_STARTED;
+    return true;
+}
+
+// Begin a PWM period now instead of at the next wrap. Each counter is put on its
+// wrap value, so the levels just written latch on the next clock. Both slices are
+// held through the EN alias while their counters move, which keeps a separate
+// CH2 slice at its lag. A centre-aligned slice latches at the bottom of its count,
+// so there the first period starts half a period later.
+static void discharge_begin_period(void) {
+    uint32_t mask = (1u << slice_ch1) | (1u << slice_ch2);
+    hw_clear_bits(&pwm_hw->en, mask);
+    pwm_set_counter(slice_ch1, discharge_wrap);
+    if (slice_ch2 != slice_ch1) {
+        pwm_set_counter(slice_ch2, (uint16_t)((2u * discharge_wrap + 1 - ch2_lag_counts) % (discharge_wrap + 1u)));
+    }
+    hw_set_bits(&pwm_hw->en, mask);
+}
+
+static void discharge_stop(void) {
+    sequence_running = false;
+    if (discharge_config.dma_mode) {
+        discharge_dma_stop();
+    }
+    discharge_write_levels(0, 0);
+    current_step = 0;
+    discharge_events |= DC_EVENT_STOPPED;
+}
+
+// Core 1, DMA mode: the DMA channels step the run, so the wrap IRQ is only kept
+// on while it has something to do (a start that is due but was held off, or the
+// manual trigger, which has no edge). A running sequence is stopped by the
+// trigger's level-low IRQ instead. Core 0 only ever turns the wrap IRQ on, after
+// it changed what the wrap IRQ looks at, so the state is re-read after turning
+// it off.
+static void discharge_dma_settle(void) {
+    if (discharge_config.debug_mode) return;
+    if (sequence_running) {
+        gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_LEVEL_LOW, true);
+        pwm_set_irq_enabled(slice_ch1, false);
+        return;
+    }
+    pwm_set_irq_enabled(slice_ch1, false);
+    __dmb();
+    if (discharge_config.debug_mode || (discharge_config.enabled && gpio_get(TRIGGER_PIN))) {
+        pwm_set_irq_enabled(slice_ch1, true);
+    }
+}
+
+// Trigger IRQs on Core 1, same priority as the wrap IRQ so the two never
+// interleave. A rising edge starts a run; starting here rather than at the next
+// wrap takes the up to one period of sampling delay out of the start latency.
+// In DMA mode the trigger going low stops the run. That is a level IRQ, which
+// needs no acknowledge and so leaves the edge flags Core 0 shares alone.
+static void __isr discharge_trigger_isr(void) {
+    uint32_t events = gpio_get_irq_event_mask(TRIGGER_PIN);
+    if (events & GPIO_IRQ_LEVEL_LOW) {
+        gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_LEVEL_LOW, false);
+        if (sequence_running && discharge_config.dma_mode && !discharge_config.debug_mode) {
+            discharge_stop();
+        }
+    }
+    if (!(events & GPIO_IRQ_EDGE_RISE)) return;
+    gpio_acknowledge_irq(TRIGGER_PIN, GPIO_IRQ_EDGE_RISE);
+    if (discharge_config.debug_mode || sequence_running || !discharge_config.enabled) return;
+    if (discharge_start()) {
+        discharge_begin_period();
+        edge_starts++;
+        if (discharge_config.dma_mode) {
+            discharge_dma_settle();
+        }
+    } else if (discharge_config.dma_mode) {
+        pwm_set_irq_enabled(slice_ch1, true);   // The wrap IRQ retries the start
+    }
+}
+
+// Runs once per PWM period on Core 1. Compare levels written here are latched by the
+// slice at the next wrap, so every step starts exactly on a PWM period boundary.
+static void __isr discharge_wrap_isr(void) {
+    pwm_clear_irq(slice_ch1);
+
+    bool trigger_active = discharge_config.debug_mode ?
+                         discharge_config.manual_trigger :
+                         gpio_get(TRIGGER_PIN);
+
+    if (!sequence_running) {
+        // The edge IRQ normally starts the run; this covers the manual trigger, a
+        // start Core 0 held off, and a trigger already high when a sequence loads
+        if (trigger_active && discharge_config.enabled && discharge_start()) {
+            wrap_starts++;
+        }
+        if (discharge_config.dma_mode) {
+            discharge_dma_settle();
+        }
+        return;
+    }
+
+    if (!trigger_active) {
+        discharge_stop();
+        if (discharge_config.dma_mode) {
+            discharge_dma_settle();
+        }
+        return;
+    }
+
+    // The DMA channels step the sequence on their own
+    if (discharge_config.dma_mode) {
+        discharge_dma_settle();
+        return;
+    }
+
+    const DischargeSequence* seq = playing_sequence();
+    if (seq->closed_loop && ++cl_divider >= cl_every) {
+        cl_divider = 0;
+        if (!(sequence_finished && sequence_slots[playing_slot].end_mode == END_ONCE)) {
+            current_loop_run(seq);
+        }
+    }
+
+    if (sequence_finished) return;
+
+    uint64_t step_cycles = discharge_step_cycles(seq, current_step);
+    if (step_cycles == 0) return;
+
+    step_elapsed_cycles += discharge_period_cycles;
+    if (step_elapsed_cycles < step_cycles) {
+        if (seq->interp != INTERP_STEP) {
+            interp_pos += interp_rate;
+            interp_apply(seq);
+        }
+        return;
+    }
+
+    if (sequence_adopt()) {
+        // A newly published sequence takes over at this step boundary, from its first step
+        discharge_restart();
+        if (playing_sequence()->streaming) {
+            stream_next_step();
+        }
+        discharge_events |= DC_EVENT_ADOPTED;
+    } else if (seq->streaming) {
+        do {
+            step_elapsed_cycles -= step_cycles;
+            stream_next_step();
+        } while (step_elapsed_cycles >= step_cycles);
+        discharge_apply_step();
+        return;
+    } else {
+        // Keep the remainder so a step that is not a whole number of periods still
+        // averages to its programmed length instead of drifting
+        uint32_t max_steps = discharge_max_steps(seq);
+        do {
+            step_elapsed_cycles -= step_cycles;
+            if (discharge_advance(seq, max_steps)) {
+                discharge_events |= DC_EVENT_CYCLE;
+                seq = playing_sequence();
+                max_steps = discharge_max_steps(seq);
             }
-            
-            // Update CH1 PWM based on current step
-            if (discharge_config.ch1.num_steps > 0) {
-                uint32_t ch1_step = current_step % discharge_config.ch1.num_steps;
-                float duty = discharge_config.ch1.duty_cycles[ch1_step];
-                
-                // Apply inversion if enabled
-                float final_duty = discharge_config.invert_output ? (1.0f - duty) : duty;
-                uint16_t level = (uint16_t)(final_duty * WRAP_VALUE);
-                
-                pwm_set_chan_level(slice_ch1, chan_ch1, level);
-            } else {
-                pwm_set_chan_level(slice_ch1, chan_ch1, 0);
+            step_cycles = discharge_step_cycles(seq, current_step);
+        } while (!sequence_finished && step_elapsed_cycles >= step_cycles);
+
+        if (sequence_finished) {
+            if (sequence_slots[playing_slot].end_mode == END_ONCE) {
+                discharge_write_levels(0, 0);
             }
-            
-            // Update CH2 PWM based on current step
-            if (discharge_config.ch2.num_steps > 0) {
-                uint32_t ch2_step = current_step % discharge_config.ch2.num_steps;
-                float duty = discharge_config.ch2.duty_cycles[ch2_step];
-                
-                // Apply inversion if enabled
-                float final_duty = discharge_config.invert_output ? (1.0f - duty) : duty;
-                uint16_t level = (uint16_t)(final_duty * WRAP_VALUE);
-                
-                pwm_set_chan_level(slice_ch2, chan_ch2, level);
-            } else {
-                pwm_set_chan_level(slice_ch2, chan_ch2, 0);
+            discharge_events |= DC_EVENT_FINISHED;
+            return;
+        }
+    }
+
+    discharge_apply_step();
+
+    // The counter runs at the system clock, so it reads how long after the wrap the new levels landed
+    uint16_t clocks = pwm_get_counter(slice_ch1);
+    if (clocks > step_update_max_clocks) step_update_max_clocks = clocks;
+
+    discharge_event_step = current_step;
+    discharge_events |= DC_EVENT_STEP;
+}
+
+void core1_discharge_loop(void) {
+    // Lets Core 0 park this core in RAM while it writes sequence slots to flash
+    flash_safe_execute_core_init();
+
+    // The wrap IRQ is enabled from here so that it is routed to Core 1
+    pwm_clear_irq(slice_ch1);
+    pwm_set_irq_enabled(slice_ch1, true);
+    irq_set_exclusive_handler(PWM_IRQ_WRAP, discharge_wrap_isr);
+    irq_set_priority(PWM_IRQ_WRAP, PICO_HIGHEST_IRQ_PRIORITY);
+    irq_set_enabled(PWM_IRQ_WRAP, true);
+
+    // Trigger edges start runs from this core too; the handler shares the bank IRQ
+    // with the PIO trigger's on Core 0 and only looks at its own pin
+    gpio_add_raw_irq_handler(TRIGGER_PIN, discharge_trigger_isr);
+    gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_EDGE_RISE, true);
+    irq_set_priority(IO_IRQ_BANK0, PICO_HIGHEST_IRQ_PRIORITY);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+
+    uint32_t last_telemetry_ms = 0;
+    while (true) {
+        // Sleep until the next wrap IRQ; all step timing is done in the handler
+        __wfe();
+
+        uint32_t irq_state = save_and_disable_interrupts();
+        uint32_t events = discharge_events;
+        uint32_t step = discharge_event_step;
+        discharge_events = 0;
+        restore_interrupts(irq_state);
+
+        uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+        if (cl_telemetry_ms && sequence_running && playing_sequence()->closed_loop &&
+            now_ms - last_telemetry_ms >= cl_telemetry_ms) {
+            last_telemetry_ms = now_ms;
+            float amps_per_count = 1.0f / adc_counts_per_amp(0);
+            printf("[DATA] CL %lu ms: CH1 set %.2f A, meas %.2f A, duty %.3f | CH2 set %.2f A, meas %.2f A, duty %.3f\n",
+                   now_ms,
+                   current_loop[0].setpoint * amps_per_count, current_loop[0].measured * amps_per_count,
+                   (float)current_loop[0].level / (discharge_wrap + 1),
+                   current_loop[1].setpoint * amps_per_count, current_loop[1].measured * amps_per_count,
+                   (float)current_loop[1].level / (discharge_wrap + 1));
+        }
+
+        if (!events || !discharge_config.verbose) continue;
+
+        if (events & DC_EVENT_STARTED) {
+            printf("[INFO] Discharge sequence started\n");
+        }
+        if (events & DC_EVENT_ADOPTED) {
+            printf("[INFO] New sequence taken over at step boundary\n");
+        }
+        if (events & DC_EVENT_FINISHED) {
+            printf("[INFO] Sequence finished, %s until the trigger is released\n",
+                   sequence_slots[playing_slot].end_mode == END_ONCE ? "outputs off" : "holding the last step");
+        } else if (events & DC_EVENT_ENTRY) {
+            const DischargeSequence* list = &sequence_slots[playing_slot];
+            if (list->playlist) {
+                const Playlist* pl = &playlists[list->playlist - 1];
+                printf("[INFO] Playlist entry %u/%u: %s\n", playlist_index + 1, pl->count, pl->names[playlist_index]);
             }
+        } else if (events & DC_EVENT_CYCLE) {
+            printf("[DEBUG] Sequence cycle completed, restarting\n");
+        }
+        if ((events & DC_EVENT_STEP) && playing_sequence()->closed_loop) {
+            const DischargeSequence* seq = playing_sequence();
+            printf("[DEBUG] Step %lu: CH1=%.2f A, CH2=%.2f A\n",
+                   step,
+                   discharge_level(&seq->ch1, step) / adc_counts_per_amp(0),
+                   discharge_level(&seq->ch2, step) / adc_counts_per_amp(1));
+        } else if (events & DC_EVENT_STEP) {
+            const DischargeSequence* seq = playing_sequence();
+            printf("[DEBUG] Step %lu: CH1=%.2f, CH2=%.2f\n",
+                   step,
+                   seq->ch1.num_steps > 0 ? level_to_duty(discharge_level(&seq->ch1, step)) : 0.0f,
+                   seq->ch2.num_steps > 0 ? level_to_duty(discharge_level(&seq->ch2, step)) : 0.0f);
+        }
+        if (events & DC_EVENT_STOPPED) {
+            printf("[INFO] Discharge sequence stopped\n");
         }
-        
-        sleep_us(20); // Update timing - may need adjustment based on actual clock
     }
 }
 
 // --- Command Processing Functions ---
-void process_discharge_step_command(const char* command) {
-    char cmd_copy[256];
-    strncpy(cmd_copy, command, sizeof(cmd_copy) - 1);
-    cmd_copy[sizeof(cmd_copy) - 1] = '\0';
-    
+const char* step_unit_name(StepUnit unit) {
+    switch (unit) {
+        case STEP_UNIT_US:      return "us";
+        case STEP_UNIT_PERIODS: return "PWM periods";
+        default:                return "ms";
+    }
+}
+
+// Parses "<n>", "<n>ms", "<n>us" or "<n>p" (PWM periods); a bare number is ms
+static bool parse_step_duration(const char* text, uint32_t* value, StepUnit* unit) {
+    while (*text == ' ') text++;
+    char* end;
+    unsigned long n = strtoul(text, &end, 10);
+    if (end == text || n == 0) return false;
+
+    if ((end[0] == 'u' || end[0] == 'U') && (end[1] == 's' || end[1] == 'S')) {
+        *unit = STEP_UNIT_US;
+        end += 2;
+    } else if ((end[0] == 'm' || end[0] == 'M') && (end[1] == 's' || end[1] == 'S')) {
+        *unit = STEP_UNIT_MS;
+        end += 2;
+    } else if (end[0] == 'p' || end[0] == 'P') {
+        *unit = STEP_UNIT_PERIODS;
+        end += 1;
+    } else {
+        *unit = STEP_UNIT_MS;
+    }
+    if (*end != '\0' && *end != ' ') return false;
+
+    *value = (uint32_t)n;
+    return true;
+}
+
+static uint64_t duration_to_cycles(uint32_t value, StepUnit unit) {
+    uint64_t sys_hz = clock_get_hz(clk_sys);
+    switch (unit) {
+        case STEP_UNIT_US:      return (uint64_t)value * sys_hz / 1000000u;
+        case STEP_UNIT_PERIODS: return (uint64_t)value * discharge_period_cycles;
+        default:                return (uint64_t)value * sys_hz / 1000u;
+    }
+}
+
+static void set_step_duration(DischargeSequence* seq, uint32_t value, StepUnit unit) {
+    uint64_t sys_hz = clock_get_hz(clk_sys);
+    uint64_t cycles = duration_to_cycles(value, unit);
+
+    seq->step_duration = value;
+    seq->step_unit = unit;
+    seq->step_cycles = cycles;
+
+    if (cycles < discharge_period_cycles) {
+        printf("[INFO] Step is shorter than one PWM period (%.2f us); steps will be skipped\n",
+               discharge_period_cycles * 1e6f / sys_hz);
+    }
+}
+
+// A DC_STEP duty or DC_ISTEP current (A on DC sensor ch) as a stored level
+static bool step_value_to_level(float value, bool current, int ch, uint16_t* level) {
+    if (current) {
+        if (value < 0.0f || value > MAX_DC_CURRENT) return false;
+        float counts = value * adc_counts_per_amp(ch) + 0.5f;
+        *level = (uint16_t)(counts > 4095.0f ? 4095.0f : counts);
+        return true;
+    }
+    if (value < 0.0f || value > 1.0f) return false;
+    *level = duty_to_level(value);
+    return true;
+}
+
+// DC_STEP <time> CH1 <duties> [CH2 <duties>], or with current set DC_ISTEP and amps
+void process_discharge_step_command(const char* command, bool current) {
     // Parse step duration
-    uint32_t step_ms;
-    if (sscanf(cmd_copy, "DC_STEP %lu", &step_ms) != 1 || step_ms == 0) {
+    uint32_t step_value;
+    StepUnit step_unit;
+    if (!parse_step_duration(command + (current ? 8 : 7), &step_value, &step_unit)) {
         printf("[ERROR] Invalid step duration\n");
         return;
     }
+    if (current && discharge_config.dma_mode) {
+        printf("[ERROR] Current mode needs the IRQ step engine (DC_MODE IRQ)\n");
+        return;
+    }
     
-    discharge_config.step_duration_ms = step_ms;
-    discharge_config.ch1.num_steps = 0;
-    discharge_config.ch2.num_steps = 0;
+    DischargeSequence* seq = sequence_begin_edit();
+    set_step_duration(seq, step_value, step_unit);
+    seq->closed_loop = current;
     
     // Make a fresh copy for CH1 parsing
     char ch1_copy[256];
@@ -227,10 +1125,10 @@ void process_discharge_step_command(const char* command) {
         }
         
         char* token = strtok(ch1_pos, " ,");
-        while (token && discharge_config.ch1.num_steps < MAX_STEPS) {
-            float duty = atof(token);
-            if (duty >= 0.0f && duty <= 1.0f) {
-                discharge_config.ch1.duty_cycles[discharge_config.ch1.num_steps++] = duty;
+        while (token && seq->ch1.num_steps < MAX_STEPS) {
+            uint16_t level;
+            if (step_value_to_level(atof(token), current, 0, &level)) {
+                seq->ch1.levels[seq->ch1.num_steps++] = level;
             }
             token = strtok(NULL, " ,");
         }
@@ -248,29 +1146,31 @@ void process_discharge_step_command(const char* command) {
         while (*ch2_pos == ' ') ch2_pos++;
         
         char* token = strtok(ch2_pos, " ,");
-        while (token && discharge_config.ch2.num_steps < MAX_STEPS) {
-            float duty = atof(token);
-            if (duty >= 0.0f && duty <= 1.0f) {
-                discharge_config.ch2.duty_cycles[discharge_config.ch2.num_steps++] = duty;
+        while (token && seq->ch2.num_steps < MAX_STEPS) {
+            uint16_t level;
+            if (step_value_to_level(atof(token), current, 1, &level)) {
+                seq->ch2.levels[seq->ch2.num_steps++] = level;
             }
             token = strtok(NULL, " ,");
         }
     }
     
-    discharge_config.enabled = (discharge_config.ch1.num_steps > 0 || discharge_config.ch2.num_steps > 0);
-    printf("[INFO] Sequence configured: %lu ms steps, CH1=%d steps, CH2=%d steps\n", 
-           step_ms, discharge_config.ch1.num_steps, discharge_config.ch2.num_steps);
+    sequence_publish();
+    printf("[INFO] Sequence configured: %lu %s steps, CH1=%d steps, CH2=%d steps%s\n", 
+           step_value, step_unit_name(step_unit), seq->ch1.num_steps, seq->ch2.num_steps,
+           current ? " (current setpoints)" : "");
 }
 
-void start_csv_input(uint32_t step_duration) {
-    if (step_duration == 0) {
+void start_csv_input(const char* duration) {
+    uint32_t step_value;
+    StepUnit step_unit;
+    if (!parse_step_duration(duration, &step_value, &step_unit)) {
         printf("[ERROR] Invalid step duration\n");
         return;
     }
     
-    discharge_config.step_duration_ms = step_duration;
-    discharge_config.ch1.num_steps = 0;
-    discharge_config.ch2.num_steps = 0;
+    DischargeSequence* seq = sequence_begin_edit();
+    set_step_duration(seq, step_value, step_unit);
     csv_input_mode = true;
     
     printf("[COMMAND] CSV mode started. Enter 'CH1_duty,CH2_duty' per line. Send 'DC_CSV_END' to finish.\n");
@@ -278,22 +1178,537 @@ void start_csv_input(uint32_t step_duration) {
 
 void process_csv_line(const char* line) {
     if (!csv_input_mode) return;
+    DischargeSequence* seq = &sequence_slots[edit_slot];
     float duty1, duty2;
-    int parsed = sscanf(line, "%f,%f", &duty1, &duty2);
-    if (parsed >= 1 && duty1 >= 0.0f && duty1 <= 1.0f && discharge_config.ch1.num_steps < MAX_STEPS) {
-        discharge_config.ch1.duty_cycles[discharge_config.ch1.num_steps++] = duty1;
+    int duration_at = 0;
+    int parsed = sscanf(line, "%f,%f,%n", &duty1, &duty2, &duration_at);
+
+    // An optional third column gives this row its own length
+    uint64_t row_cycles = seq->step_cycles;
+    if (duration_at > 0) {
+        uint32_t value;
+        StepUnit unit;
+        if (!parse_step_duration(line + duration_at, &value, &unit) ||
+            (row_cycles = duration_to_cycles(value, unit)) == 0 || row_cycles > UINT32_MAX) {
+            printf("[ERROR] Invalid row duration: %s\n", line);
+            return;
+        }
+    }
+
+    uint32_t row = discharge_max_steps(seq);
+    if (parsed >= 1 && duty1 >= 0.0f && duty1 <= 1.0f && seq->ch1.num_steps < MAX_STEPS) {
+        seq->ch1.levels[seq->ch1.num_steps++] = duty_to_level(duty1);
+    }
+    if (parsed >= 2 && duty2 >= 0.0f && duty2 <= 1.0f && seq->ch2.num_steps < MAX_STEPS) {
+        seq->ch2.levels[seq->ch2.num_steps++] = duty_to_level(duty2);
+    }
+    if (discharge_max_steps(seq) > row) {
+        seq->seg_cycles[row] = (uint32_t)(row_cycles > UINT32_MAX ? UINT32_MAX : row_cycles);
+        if (duration_at > 0) seq->per_step = true;
+    }
+}
+
+const char* end_mode_name(EndMode mode) {
+    switch (mode) {
+        case END_ONCE: return "ONCE";
+        case END_HOLD: return "HOLD";
+        default:       return "LOOP";
+    }
+}
+
+bool parse_end_mode(const char* text, EndMode* mode) {
+    if (strcmp(text, "LOOP") == 0) {
+        *mode = END_LOOP;
+    } else if (strcmp(text, "ONCE") == 0) {
+        *mode = END_ONCE;
+    } else if (strcmp(text, "HOLD") == 0) {
+        *mode = END_HOLD;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const char* interp_mode_name(InterpMode mode) {
+    switch (mode) {
+        case INTERP_LINEAR: return "LINEAR";
+        case INTERP_CUBIC:  return "CUBIC";
+        default:            return "STEP";
+    }
+}
+
+static bool parse_interp_mode(const char* text, InterpMode* mode) {
+    if (strcmp(text, "STEP") == 0) {
+        *mode = INTERP_STEP;
+    } else if (strcmp(text, "LINEAR") == 0) {
+        *mode = INTERP_LINEAR;
+    } else if (strcmp(text, "CUBIC") == 0) {
+        *mode = INTERP_CUBIC;
+    } else {
+        return false;
     }
-    if (parsed >= 2 && duty2 >= 0.0f && duty2 <= 1.0f && discharge_config.ch2.num_steps < MAX_STEPS) {
-        discharge_config.ch2.duty_cycles[discharge_config.ch2.num_steps++] = duty2;
+    return true;
+}
+
+// DC_SEG [LOOP|ONCE|HOLD] [STEP|LINEAR|CUBIC] <d1>,<d2>,<time> ... : one segment per token, each with its own length
+void process_segment_command(const char* command) {
+    char cmd_copy[1024];
+    strncpy(cmd_copy, command + 6, sizeof(cmd_copy) - 1);
+    cmd_copy[sizeof(cmd_copy) - 1] = '\0';
+
+    DischargeSequence* seq = sequence_begin_edit();
+    seq->per_step = true;
+    seq->step_duration = 0;
+    seq->step_cycles = 0;
+
+    uint64_t shortest = UINT64_MAX;
+    char* token = strtok(cmd_copy, " ");
+    while (token && (parse_end_mode(token, &seq->end_mode) || parse_interp_mode(token, &seq->interp))) {
+        token = strtok(NULL, " ");
+    }
+    if (seq->interp != INTERP_STEP && discharge_config.dma_mode) {
+        printf("[ERROR] Interpolation needs the IRQ step engine (DC_MODE IRQ)\n");
+        return;
+    }
+    while (token) {
+        float duty1, duty2;
+        int duration_at = 0;
+        uint32_t value;
+        StepUnit unit;
+        if (seq->ch1.num_steps >= MAX_STEPS) {
+            printf("[ERROR] More than %d segments\n", MAX_STEPS);
+            return;
+        }
+        if (sscanf(token, "%f,%f,%n", &duty1, &duty2, &duration_at) != 2 || duration_at == 0 ||
+            duty1 < 0.0f || duty1 > 1.0f || duty2 < 0.0f || duty2 > 1.0f ||
+            !parse_step_duration(token + duration_at, &value, &unit)) {
+            printf("[ERROR] Invalid segment '%s', expected <d1>,<d2>,<time>\n", token);
+            return;
+        }
+        uint64_t cycles = duration_to_cycles(value, unit);
+        if (cycles == 0) {
+            printf("[ERROR] Segment '%s' has no length\n", token);
+            return;
+        }
+        if (cycles > UINT32_MAX) {
+            printf("[ERROR] Segment '%s' is too long; split it (max %.1f s)\n", token,
+                   (float)UINT32_MAX / clock_get_hz(clk_sys));
+            return;
+        }
+        int i = seq->ch1.num_steps;
+        seq->ch1.levels[i] = duty_to_level(duty1);
+        seq->ch2.levels[i] = duty_to_level(duty2);
+        seq->seg_cycles[i] = (uint32_t)cycles;
+        seq->ch1.num_steps = seq->ch2.num_steps = i + 1;
+        if (cycles < shortest) shortest = cycles;
+        token = strtok(NULL, " ");
+    }
+    if (seq->ch1.num_steps == 0) {
+        printf("[ERROR] No segments given\n");
+        return;
+    }
+    if (shortest < discharge_period_cycles) {
+        printf("[INFO] A segment is shorter than one PWM period; it may be skipped\n");
     }
+
+    sequence_publish();
+    printf("[INFO] Segments configured: %d segments, end %s, %s\n", seq->ch1.num_steps,
+           end_mode_name(seq->end_mode), interp_mode_name(seq->interp));
 }
 
 void end_csv_input(void) {
     csv_input_mode = false;
-    discharge_config.enabled = (discharge_config.ch1.num_steps > 0 || discharge_config.ch2.num_steps > 0);
+    sequence_publish();
     
+    const DischargeSequence* seq = published_sequence();
     printf("[COMMAND] CSV input finished. CH1=%d steps, CH2=%d steps\n", 
-           discharge_config.ch1.num_steps, discharge_config.ch2.num_steps);
+           seq->ch1.num_steps, seq->ch2.num_steps);
+}
+
+void start_stream_input(const char* duration) {
+    if (discharge_config.dma_mode) {
+        printf("[ERROR] Streaming needs the IRQ step engine (DC_MODE IRQ)\n");
+        return;
+    }
+    uint32_t step_value;
+    StepUnit step_unit;
+    if (!parse_step_duration(duration, &step_value, &step_unit)) {
+        printf("[ERROR] Invalid step duration\n");
+        return;
+    }
+
+    DischargeSequence* seq = sequence_begin_edit();
+    set_step_duration(seq, step_value, step_unit);
+    seq->streaming = true;
+    seq->stream_start = stream_head;
+
+    stream_start = stream_head;
+    stream_ended = false;
+    stream_paused = false;
+    stream_dropped = 0;
+    stream_underruns_reported = 0;
+    stream_done_reported = false;
+    stream_input_mode = true;
+    sequence_publish();
+
+    printf("[COMMAND] Stream mode started. Enter 'CH1_duty,CH2_duty' per line. Send 'DC_STREAM_END' after the last one.\n");
+    printf("[DATA] STREAM_READY %d\n", STREAM_BUFFER_STEPS);
+}
+
+void process_stream_line(const char* line) {
+    float duty1, duty2 = 0.0f;
+    int parsed = sscanf(line, "%f,%f", &duty1, &duty2);
+    if (parsed < 1 || duty1 < 0.0f || duty1 > 1.0f || duty2 < 0.0f || duty2 > 1.0f) {
+        printf("[ERROR] Invalid stream line: %s\n", line);
+        return;
+    }
+
+    uint32_t used = stream_used();
+    if (used >= STREAM_BUFFER_STEPS) {
+        stream_dropped++;
+        printf("[ERROR] Stream buffer full, step dropped (%lu so far)\n", stream_dropped);
+        return;
+    }
+
+    uint32_t head = stream_head;
+    stream_buffer[head & (STREAM_BUFFER_STEPS - 1)] =
+        (uint32_t)duty_to_level(duty1) | ((uint32_t)duty_to_level(duty2) << 16);
+    __mem_fence_release();
+    stream_head = head + 1;
+
+    if (!stream_paused && used + 1 >= STREAM_HIGH_WATER) {
+        stream_paused = true;
+        printf("[DATA] STREAM_WAIT %lu\n", (unsigned long)(STREAM_BUFFER_STEPS - used - 1));
+    }
+}
+
+void end_stream_input(void) {
+    stream_input_mode = false;
+    __mem_fence_release();
+    stream_ended = true;
+    printf("[COMMAND] Stream input finished. %lu steps still queued\n", stream_used());
+}
+
+// Called from the Core 0 main loop: stream flow control and Core 1 stream reports
+static void latency_drain(void);
+
+void discharge_poll(void) {
+    latency_drain();
+    if (!published_sequence()->streaming) return;
+
+    if (stream_paused && stream_used() <= STREAM_LOW_WATER) {
+        stream_paused = false;
+        printf("[DATA] STREAM_READY %lu\n", (unsigned long)(STREAM_BUFFER_STEPS - stream_used()));
+    }
+
+    uint32_t underruns = stream_underruns;
+    if (underruns > stream_underruns_reported) {
+        printf("[ALERT] Discharge stream underrun: %lu step(s) held at the previous level\n",
+               underruns - stream_underruns_reported);
+    }
+    stream_underruns_reported = underruns;
+
+    if (stream_done && !stream_done_reported) {
+        stream_done_reported = true;
+        printf("[INFO] Discharge stream finished: %lu steps played, %lu underruns, %lu dropped\n",
+               stream_played, stream_underruns, stream_dropped);
+    }
+}
+
+// --- Binary Upload ---
+// 0..65535 duty to a compare level, rounded, with the inversion folded in
+static uint16_t duty_q16_to_level(uint32_t duty) {
+    uint16_t level = (uint16_t)((duty * discharge_wrap + 32767u) / 65535u);
+    return discharge_config.invert_output ? discharge_wrap - level : level;
+}
+
+void start_upload(const char* duration) {
+    if (!parse_step_duration(duration, &upload_step_value, &upload_step_unit)) {
+        printf("[ERROR] Invalid step duration\n");
+        return;
+    }
+    upload_rx_len = 0;
+    upload_overflow = false;
+    upload_last_byte_us = time_us_32();
+    upload_active = true;
+    printf("[DATA] UPLOAD_READY %d\n", MAX_STEPS);
+}
+
+static void finish_upload(void) {
+    upload_active = false;
+    if (upload_overflow) {
+        printf("[ERROR] Upload rejected: frame longer than %d bytes\n", UPLOAD_MAX_ENCODED);
+        return;
+    }
+
+    uint32_t start_us = time_us_32();
+    UploadFrame frame;
+    switch (upload_parse_frame(upload_rx, upload_rx_len, upload_frame, sizeof(upload_frame), &frame)) {
+        case UPLOAD_BAD_FRAMING:
+            printf("[ERROR] Upload rejected: bad framing\n");
+            return;
+        case UPLOAD_BAD_LENGTH:
+            printf("[ERROR] Upload rejected: length mismatch (%d bytes, %lu steps x %lu channels)\n",
+                   frame.len, frame.steps, frame.channels);
+            return;
+        case UPLOAD_BAD_CRC:
+            printf("[ERROR] Upload rejected: CRC %08lx, expected %08lx\n", frame.crc, frame.expected_crc);
+            return;
+        case UPLOAD_OK:
+            break;
+    }
+    uint32_t steps = frame.steps;
+    uint32_t channels = frame.channels;
+
+    DischargeSequence* seq = sequence_begin_edit();
+    set_step_duration(seq, upload_step_value, upload_step_unit);
+    const uint8_t* duty = frame.duty;
+    for (uint32_t i = 0; i < steps; ++i) {
+        seq->ch1.levels[i] = duty_q16_to_level(upload_get_le16(duty));
+        duty += 2;
+        if (channels == 2) {
+            seq->ch2.levels[i] = duty_q16_to_level(upload_get_le16(duty));
+            duty += 2;
+        }
+    }
+    seq->ch1.num_steps = steps;
+    seq->ch2.num_steps = channels == 2 ? steps : 0;
+    uint32_t elapsed_us = time_us_32() - start_us;
+    sequence_publish();
+
+    printf("[COMMAND] Upload OK: %lu steps x %lu channels, %lu %s steps, CRC %08lx, decoded in %lu us\n",
+           steps, channels, upload_step_value, step_unit_name(upload_step_unit), frame.crc, elapsed_us);
+}
+
+// Called instead of the line reader while an upload is in progress
+void discharge_upload_poll(void) {
+    int c;
+    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+        upload_last_byte_us = time_us_32();
+        if (c == 0) {
+            finish_upload();
+            return;
+        }
+        if (upload_rx_len < sizeof(upload_rx)) {
+            upload_rx[upload_rx_len++] = (uint8_t)c;
+        } else {
+            upload_overflow = true;     // keep reading so the rest of the frame is not taken as commands
+        }
+    }
+    if (time_us_32() - upload_last_byte_us > UPLOAD_TIMEOUT_US) {
+        upload_active = false;
+        printf("[ERROR] Upload timed out after %lu bytes\n", upload_rx_len);
+    }
+}
+
+bool is_discharge_upload_active(void) {
+    return upload_active;
+}
+
+// Core 0: turn cl_kp / cl_ki into integer gains for the current PWM range,
+// sensor scaling and update interval
+static void current_loop_set_gains(void) {
+    float levels_per_duty = (float)discharge_wrap + 1.0f;
+    float dt = (float)discharge_period_cycles * cl_every / clock_get_hz(clk_sys);
+    for (int ch = 0; ch < 2; ++ch) {
+        float levels_per_count = levels_per_duty / adc_counts_per_amp(ch);
+        current_loop[ch].kp_q16 = (int32_t)(cl_kp * levels_per_count * 65536.0f + 0.5f);
+        current_loop[ch].ki_q16 = (int32_t)(cl_ki * dt * levels_per_count * 65536.0f + 0.5f);
+    }
+}
+
+// Core 0: new switching frequency and/or CH2 phase. Only while no sequence runs;
+// the slices are reprogrammed and the loaded sequence is rescaled to the new wrap.
+static void discharge_set_pwm(uint32_t freq_hz, uint16_t phase_deg) {
+    bool shared = (slice_ch1 == slice_ch2);
+    if (shared && phase_deg != 0 && phase_deg != 180) {
+        printf("[ERROR] CH1 and CH2 share PWM slice %u; only 0 or 180 degrees are possible\n", slice_ch1);
+        return;
+    }
+    bool centred = shared && phase_deg == 180;
+    if (discharge_wrap_for(freq_hz, centred) == 0) {
+        uint32_t counts = centred ? 2 : 1;
+        printf("[ERROR] Frequency must be %lu..%lu Hz\n",
+               clock_get_hz(clk_sys) / (65535u * counts) + 1,
+               clock_get_hz(clk_sys) / ((DISCHARGE_MIN_WRAP + 1) * counts));
+        return;
+    }
+    if (!discharge_config.dma_mode && freq_hz > discharge_irq_max_freq_hz()) {
+        printf("[ERROR] The IRQ step engine keeps up to %lu Hz (step update budget %u clocks); use DC_MODE DMA above that\n",
+               discharge_irq_max_freq_hz(),
+               step_update_max_clocks > DISCHARGE_STEP_BUDGET_CLOCKS ? step_update_max_clocks : DISCHARGE_STEP_BUDGET_CLOCKS);
+        return;
+    }
+    if (published_sequence()->streaming) {
+        printf("[ERROR] Queued stream levels are scaled to the current frequency; load a new sequence first\n");
+        return;
+    }
+    if (published_sequence()->playlist) {
+        printf("[ERROR] A playlist is loaded; change the PWM setup before DC_PL_GO\n");
+        return;
+    }
+    pwm_reconfig_busy = true;
+    __dmb();
+    if (sequence_running) {
+        pwm_reconfig_busy = false;
+        printf("[ERROR] Cannot change the PWM setup while a sequence is running\n");
+        return;
+    }
+
+    uint16_t old_wrap = discharge_wrap;
+    discharge_pwm_configure(freq_hz, phase_deg);
+
+    current_loop_set_gains();
+
+    DischargeSequence* seq = sequence_begin_edit();
+    *seq = *published_sequence();
+    if (!seq->closed_loop) {
+        rescale_levels(&seq->ch1, old_wrap);
+        rescale_levels(&seq->ch2, old_wrap);
+    }
+    if (!seq->per_step && seq->step_unit == STEP_UNIT_PERIODS) {
+        seq->step_cycles = (uint64_t)seq->step_duration * discharge_period_cycles;
+    }
+    sequence_publish();
+    pwm_reconfig_busy = false;
+
+    printf("[COMMAND] Discharge PWM: %.2f Hz (wrap %u), CH2 phase %u deg%s\n",
+           (float)clock_get_hz(clk_sys) / discharge_period_cycles, discharge_wrap, discharge_phase_deg,
+           ch2_mirrored ? " (centre-aligned)" : "");
+}
+
+// --- Start Latency Probe ---
+static void latency_reset(void) {
+    memset(latency_hist, 0, sizeof(latency_hist));
+    latency_samples = 0;
+    latency_timeouts = 0;
+    latency_min_clocks = UINT32_MAX;
+    latency_max_clocks = 0;
+    latency_sum_clocks = 0;
+    edge_starts = 0;
+    wrap_starts = 0;
+}
+
+static void latency_probe_init(void) {
+    latency_reset();
+    if (PWM_PHASE_COUNT > 8 || !pio_can_add_program(LATENCY_PIO, &discharge_latency_program)) {
+        printf("[INFO] No free PIO for the discharge latency probe; DC_LATENCY is unavailable\n");
+        return;
+    }
+    latency_sm = pio_claim_unused_sm(LATENCY_PIO, false);
+    if (latency_sm < 0) {
+        printf("[INFO] No free PIO for the discharge latency probe; DC_LATENCY is unavailable\n");
+        return;
+    }
+    uint offset = pio_add_program(LATENCY_PIO, &discharge_latency_program);
+    latency_timeout_passes = (uint32_t)((uint64_t)clock_get_hz(clk_sys) * LATENCY_TIMEOUT_US / 1000000u /
+                                        DISCHARGE_LATENCY_PASS_CYCLES);
+    discharge_latency_program_init(LATENCY_PIO, (uint)latency_sm, offset, TRIGGER_PIN, PWM_PIN_CH1,
+                                   latency_timeout_passes);
+}
+
+// Core 0: fold the probe's samples into the histogram
+static void latency_drain(void) {
+    if (latency_sm < 0) return;
+    while (!pio_sm_is_rx_fifo_empty(LATENCY_PIO, (uint)latency_sm)) {
+        uint32_t left = pio_sm_get(LATENCY_PIO, (uint)latency_sm);
+        if (left > latency_timeout_passes) {
+            latency_timeouts++;
+            continue;
+        }
+        uint32_t clocks = (latency_timeout_passes - left) * DISCHARGE_LATENCY_PASS_CYCLES +
+                          DISCHARGE_LATENCY_FIXED_CYCLES;
+        uint32_t bin = clocks / LATENCY_BIN_CLOCKS;
+        latency_hist[bin < LATENCY_BINS ? bin : LATENCY_BINS]++;
+        latency_samples++;
+        latency_sum_clocks += clocks;
+        if (clocks < latency_min_clocks) latency_min_clocks = clocks;
+        if (clocks > latency_max_clocks) latency_max_clocks = clocks;
+    }
+}
+
+static void latency_report(void) {
+    float us_per_clock = 1e6f / clock_get_hz(clk_sys);
+    printf("[COMMAND] Discharge start latency, trigger edge to first CH1 change:\n");
+    printf("  Starts: %lu from the trigger edge IRQ, %lu from the wrap IRQ\n", edge_starts, wrap_starts);
+    if (latency_samples == 0) {
+        printf("  No samples yet%s\n", latency_timeouts ? "" : "; each trigger edge adds one");
+    } else {
+        printf("  %lu samples: min %.3f us, mean %.3f us, max %.3f us (%lu / %lu clocks)\n", latency_samples,
+               latency_min_clocks * us_per_clock, (float)latency_sum_clocks / latency_samples * us_per_clock,
+               latency_max_clocks * us_per_clock, latency_min_clocks, latency_max_clocks);
+        uint32_t peak = 1;
+        for (int i = 0; i <= LATENCY_BINS; ++i) {
+            if (latency_hist[i] > peak) peak = latency_hist[i];
+        }
+        printf("[DATA] from_us,to_us,count,bar\n");
+        for (int i = 0; i <= LATENCY_BINS; ++i) {
+            if (latency_hist[i] == 0) continue;
+            float from_us = i * LATENCY_BIN_CLOCKS * us_per_clock;
+            char bar[41];
+            int len = (int)((uint64_t)latency_hist[i] * 40 / peak);
+            memset(bar, '#', len ? len : 1);
+            bar[len ? len : 1] = '\0';
+            if (i < LATENCY_BINS) {
+                printf("[DATA] %.2f,%.2f,%lu,%s\n", from_us, from_us + LATENCY_BIN_CLOCKS * us_per_clock,
+                       latency_hist[i], bar);
+            } else {
+                printf("[DATA] %.2f,,%lu,%s\n", from_us, latency_hist[i], bar);
+            }
+        }
+    }
+    if (latency_timeouts) {
+        printf("  %lu edges without a CH1 change within %u ms (no sequence loaded, or its first CH1 step is off)\n",
+               latency_timeouts, LATENCY_TIMEOUT_US / 1000);
+    }
+}
+
+// DC_LATENCY_TEST <edges>: make trigger edges by overriding GPIO18's input, so the
+// edge IRQ, the wrap IRQ and the probe all see them while the pad itself is not
+// driven. Edges fall at pseudo-random points of the PWM period.
+static void latency_self_test(uint32_t edges) {
+    if (latency_sm < 0) {
+        printf("[ERROR] The latency probe has no PIO state machine in this build\n");
+        return;
+    }
+    if (discharge_config.debug_mode) {
+        printf("[ERROR] The self test drives the trigger input itself: DC_DEBUG 0 first\n");
+        return;
+    }
+    if (sequence_running || gpio_get(TRIGGER_PIN)) {
+        printf("[ERROR] Trigger active, refusing to run the self test\n");
+        return;
+    }
+    if (!discharge_config.enabled) {
+        printf("[ERROR] Load a sequence first; its first CH1 step must not be off\n");
+        return;
+    }
+    if (edges == 0 || edges > 10000) {
+        printf("[ERROR] Usage: DC_LATENCY_TEST <1..10000 edges>\n");
+        return;
+    }
+
+    printf("[ALERT] DC_LATENCY_TEST switches GPIO %d-%d: keep the power stage disconnected\n",
+           PWM_PIN_CH1, PWM_PIN_CH2);
+    latency_drain();
+    latency_reset();
+    uint32_t period_us = discharge_period_cycles / (clock_get_hz(clk_sys) / 1000000u) + 1;
+    uint32_t seed = time_us_32();
+    for (uint32_t i = 0; i < edges; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        busy_wait_us_32(period_us + (seed >> 16) % period_us);
+        gpio_set_inover(TRIGGER_PIN, GPIO_OVERRIDE_HIGH);
+        busy_wait_us_32(3 * period_us);
+        gpio_set_inover(TRIGGER_PIN, GPIO_OVERRIDE_LOW);
+        // The wrap IRQ stops the run at the next period boundary
+        uint64_t deadline = time_us_64() + LATENCY_TIMEOUT_US;
+        while (sequence_running && time_us_64() < deadline) {
+            tight_loop_contents();
+        }
+        latency_drain();
+    }
+    gpio_set_inover(TRIGGER_PIN, GPIO_OVERRIDE_NORMAL);
+    latency_report();
 }
 
 // --- Main Command Handler ---
@@ -302,22 +1717,189 @@ bool process_discharge_command(const char* command) {
         process_csv_line(command);
         return true;
     }
+    if (stream_input_mode && strcmp(command, "DC_STREAM_END") != 0 && strcmp(command, "DC_STATUS") != 0) {
+        process_stream_line(command);
+        return true;
+    }
     
     if (strncmp(command, "DC_STEP", 7) == 0) {
-        process_discharge_step_command(command);
+        process_discharge_step_command(command, false);
+        return true;
+    } else if (strncmp(command, "DC_ISTEP", 8) == 0) {
+        process_discharge_step_command(command, true);
+        return true;
+    } else if (strncmp(command, "DC_SAVE ", 8) == 0) {
+        flash_save_sequence(command + 8);
+        return true;
+    } else if (strncmp(command, "DC_LOAD ", 8) == 0) {
+        flash_load_sequence(command + 8);
+        return true;
+    } else if (strcmp(command, "DC_PL_CLEAR") == 0) {
+        if (playlist_clear()) {
+            printf("[COMMAND] Playlist cleared\n");
+        }
+        return true;
+    } else if (strncmp(command, "DC_PL_ADD ", 10) == 0) {
+        playlist_add(command + 10);
+        return true;
+    } else if (strncmp(command, "DC_PL_GO", 8) == 0) {
+        playlist_go(command + 8);
+        return true;
+    } else if (strncmp(command, "DC_DELETE ", 10) == 0) {
+        flash_delete_sequence(command + 10);
+        return true;
+    } else if (strcmp(command, "DC_LIST") == 0) {
+        flash_list_sequences();
+        return true;
+    } else if (strncmp(command, "DC_CL_GAINS", 11) == 0) {
+        float kp, ki;
+        if (sscanf(command + 11, "%f %f", &kp, &ki) == 2) {
+            if (kp < 0.0f || ki < 0.0f) {
+                printf("[ERROR] Gains must not be negative\n");
+                return true;
+            }
+            cl_kp = kp;
+            cl_ki = ki;
+            current_loop_set_gains();
+            printf("[COMMAND] Current loop gains: Kp %.4f duty/A, Ki %.2f duty/(A*s)\n", cl_kp, cl_ki);
+        } else {
+            printf("[INFO] Current loop gains: Kp %.4f duty/A, Ki %.2f duty/(A*s)\n", cl_kp, cl_ki);
+        }
+        return true;
+    } else if (strncmp(command, "DC_CL_RATE", 10) == 0) {
+        int every;
+        if (sscanf(command + 10, "%d", &every) == 1) {
+            if (every < 1 || every > 1000) {
+                printf("[ERROR] Usage: DC_CL_RATE <1..1000 PWM periods>\n");
+                return true;
+            }
+            cl_every = (uint32_t)every;
+            current_loop_set_gains();
+        }
+        printf("[INFO] Current loop update every %lu PWM periods (%.0f Hz)\n", cl_every,
+               (float)clock_get_hz(clk_sys) / ((float)discharge_period_cycles * cl_every));
+        return true;
+    } else if (strncmp(command, "DC_CL_TELEM ", 12) == 0) {
+        cl_telemetry_ms = (uint32_t)atoi(command + 12);
+        if (cl_telemetry_ms) {
+            printf("[COMMAND] Current loop telemetry every %lu ms while running\n", cl_telemetry_ms);
+        } else {
+            printf("[COMMAND] Current loop telemetry off\n");
+        }
         return true;
     } else if (strncmp(command, "DC_CSV ", 7) == 0) {
-        uint32_t step_ms = atoi(command + 7);
-        start_csv_input(step_ms);
+        start_csv_input(command + 7);
         return true;
     } else if (strcmp(command, "DC_CSV_END") == 0) {
         end_csv_input();
         return true;
+    } else if (strncmp(command, "DC_SEG ", 7) == 0) {
+        process_segment_command(command);
+        return true;
+    } else if (strncmp(command, "DC_END ", 7) == 0) {
+        EndMode mode;
+        if (!parse_end_mode(command + 7, &mode)) {
+            printf("[ERROR] Usage: DC_END LOOP|ONCE|HOLD\n");
+            return true;
+        }
+        if (published_sequence()->streaming) {
+            printf("[ERROR] A stream always ends with the outputs off\n");
+            return true;
+        }
+        DischargeSequence* seq = sequence_begin_edit();
+        *seq = *published_sequence();
+        seq->end_mode = mode;
+        sequence_publish();
+        printf("[COMMAND] %s end: %s\n", seq->playlist ? "Playlist" : "Sequence", end_mode_name(mode));
+        return true;
+    } else if (strncmp(command, "DC_FREQ", 7) == 0) {
+        const char* arg = command + 7;
+        while (*arg == ' ') arg++;
+        if (*arg == '\0') {
+            printf("[INFO] Discharge PWM: %.2f Hz (wrap %u)\n",
+                   (float)clock_get_hz(clk_sys) / discharge_period_cycles, discharge_wrap);
+            return true;
+        }
+        char* end;
+        unsigned long freq = strtoul(arg, &end, 10);
+        if (*end == 'k' || *end == 'K') {
+            freq *= 1000;
+            end++;
+        }
+        if (end == arg || *end != '\0') {
+            printf("[ERROR] Usage: DC_FREQ [<Hz>|<kHz>k]\n");
+            return true;
+        }
+        discharge_set_pwm((uint32_t)freq, discharge_phase_deg);
+        return true;
+    } else if (strncmp(command, "DC_PHASE", 8) == 0) {
+        const char* arg = command + 8;
+        while (*arg == ' ') arg++;
+        if (*arg == '\0') {
+            printf("[INFO] CH2 phase: %u deg%s\n", discharge_phase_deg, ch2_mirrored ? " (centre-aligned)" : "");
+            return true;
+        }
+        char* end;
+        unsigned long phase = strtoul(arg, &end, 10);
+        if (end == arg || *end != '\0' || phase >= 360) {
+            printf("[ERROR] Usage: DC_PHASE [0..359]\n");
+            return true;
+        }
+        discharge_set_pwm(discharge_freq_hz, (uint16_t)phase);
+        return true;
+    } else if (strncmp(command, "DC_INTERP", 9) == 0) {
+        const char* arg = command + 9;
+        while (*arg == ' ') arg++;
+        if (*arg == '\0') {
+            printf("[INFO] Interpolation: %s\n", interp_mode_name(published_sequence()->interp));
+            return true;
+        }
+        InterpMode mode;
+        if (!parse_interp_mode(arg, &mode)) {
+            printf("[ERROR] Usage: DC_INTERP [STEP|LINEAR|CUBIC]\n");
+            return true;
+        }
+        if (published_sequence()->streaming) {
+            printf("[ERROR] Streams always play as steps\n");
+            return true;
+        }
+        if (published_sequence()->playlist) {
+            printf("[ERROR] A playlist is loaded; each entry keeps the interpolation it was saved with\n");
+            return true;
+        }
+        if (mode != INTERP_STEP && published_sequence()->closed_loop) {
+            printf("[ERROR] Current setpoints always change in steps\n");
+            return true;
+        }
+        if (mode != INTERP_STEP && discharge_config.dma_mode) {
+            printf("[ERROR] Interpolation needs the IRQ step engine (DC_MODE IRQ)\n");
+            return true;
+        }
+        DischargeSequence* seq = sequence_begin_edit();
+        *seq = *published_sequence();
+        seq->interp = mode;
+        sequence_publish();
+        printf("[COMMAND] Interpolation: %s\n", interp_mode_name(mode));
+        return true;
+    } else if (strncmp(command, "DC_UPLOAD ", 10) == 0) {
+        start_upload(command + 10);
+        return true;
+    } else if (strncmp(command, "DC_STREAM ", 10) == 0) {
+        start_stream_input(command + 10);
+        return true;
+    } else if (strcmp(command, "DC_STREAM_END") == 0) {
+        if (stream_input_mode) {
+            end_stream_input();
+        } else {
+            printf("[ERROR] No stream input in progress\n");
+        }
+        return true;
     } else if (strncmp(command, "DC_DEBUG ", 9) == 0) {
         bool new_debug_mode = (atoi(command + 9) != 0);
         // Only print if the state actually changes
         if (discharge_config.debug_mode != new_debug_mode) {
             discharge_config.debug_mode = new_debug_mode;
+            pwm_set_irq_enabled(slice_ch1, true);   // The wrap IRQ samples the new trigger source
             printf("[DEBUG] Debug mode: %s\n", discharge_config.debug_mode ? "ON" : "OFF");
         }
         return true;
@@ -327,6 +1909,7 @@ bool process_discharge_command(const char* command) {
             // Only print if the state actually changes
             if (discharge_config.manual_trigger != new_trigger) {
                 discharge_config.manual_trigger = new_trigger;
+                pwm_set_irq_enabled(slice_ch1, true);
                 printf("[DEBUG] Manual trigger: %s\n", discharge_config.manual_trigger ? "ON" : "OFF");
             }
         } else {
@@ -351,21 +1934,143 @@ bool process_discharge_command(const char* command) {
         }
         return true;
     } else if (strcmp(command, "DC_STATUS") == 0) {
+        const DischargeSequence* seq = published_sequence();
         printf("[COMMAND] Discharge Status:\n");
-        printf("  Step duration: %lu ms\n", discharge_config.step_duration_ms);
-        printf("  CH1 steps: %d\n", discharge_config.ch1.num_steps);
-        printf("  CH2 steps: %d\n", discharge_config.ch2.num_steps);
+        if (seq->playlist) {
+            playlist_print_status(seq);
+        } else if (seq->per_step) {
+            printf("  Step duration: per step (%s)\n", seq->step_duration ? "CSV rows" : "segments");
+        } else {
+            printf("  Step duration: %lu %s (%.2f PWM periods)\n", seq->step_duration,
+                   step_unit_name(seq->step_unit),
+                   discharge_period_cycles ? (float)seq->step_cycles / discharge_period_cycles : 0.0f);
+        }
+        if (!seq->streaming && !seq->playlist) {
+            printf("  End: %s\n", end_mode_name(seq->end_mode));
+            printf("  Interpolation: %s\n", interp_mode_name(seq->interp));
+        }
+        if (seq->streaming) {
+            printf("  Stream: %lu queued, %lu played, %lu underruns, %lu dropped%s\n",
+                   stream_used(), stream_played, stream_underruns, stream_dropped,
+                   stream_done ? " (finished)" : stream_input_mode ? " (receiving)" : "");
+        } else if (!seq->playlist) {
+            printf("  CH1 steps: %d\n", seq->ch1.num_steps);
+            printf("  CH2 steps: %d\n", seq->ch2.num_steps);
+        }
         printf("  Enabled: %s\n", discharge_config.enabled ? "YES" : "NO");
-        printf("  Running: %s\n", sequence_running ? "YES" : "NO");
+        printf("  Running: %s%s\n", sequence_running ? "YES" : "NO",
+               sequence_running && playing_slot != published_slot ? " (new sequence waiting for step boundary)" : "");
         printf("  Output inversion: %s\n", discharge_config.invert_output ? "ENABLED" : "DISABLED");  // Add this line
+        printf("  PWM: %.2f Hz, wrap %u, CH2 phase %u deg%s\n",
+               (float)clock_get_hz(clk_sys) / discharge_period_cycles, discharge_wrap, discharge_phase_deg,
+               ch2_mirrored ? " (centre-aligned)" : "");
+        printf("  Step engine: %s\n", discharge_config.dma_mode ?
+               "DMA (wrap IRQ off while running, the trigger IRQs start and stop)" : "IRQ");
+        if (!discharge_config.dma_mode) {
+            printf("  Step update: max %u clocks after wrap (%.2f us), up to %lu Hz\n", step_update_max_clocks,
+                   step_update_max_clocks * 1e6f / clock_get_hz(clk_sys), discharge_irq_max_freq_hz());
+        }
+        if (seq->closed_loop) {
+            printf("  Current loop: PI every %lu periods (%.0f Hz), Kp %.4f duty/A, Ki %.2f duty/(A*s)\n",
+                   cl_every, (float)clock_get_hz(clk_sys) / ((float)discharge_period_cycles * cl_every), cl_kp, cl_ki);
+            for (int ch = 0; ch < 2; ++ch) {
+                printf("    CH%d: set %.2f A, measured %.2f A, duty %.3f\n", ch + 1,
+                       current_loop[ch].setpoint / adc_counts_per_amp(ch),
+                       current_loop[ch].measured / adc_counts_per_amp(ch),
+                       (float)current_loop[ch].level / (discharge_wrap + 1));
+            }
+            printf("    %lu updates, %lu saturated, %lu sensor faults\n", cl_updates, cl_saturated, cl_sensor_faults);
+        }
+        return true;
+    } else if (strncmp(command, "DC_MODE", 7) == 0) {
+        const char* arg = command + 7;
+        while (*arg == ' ') arg++;
+        if (*arg == '\0') {
+            printf("[INFO] Step engine: %s\n", discharge_config.dma_mode ? "DMA" : "IRQ");
+            return true;
+        }
+        bool new_dma;
+        if (strcmp(arg, "DMA") == 0) {
+            new_dma = true;
+        } else if (strcmp(arg, "IRQ") == 0) {
+            new_dma = false;
+        } else {
+            printf("[ERROR] Usage: DC_MODE [IRQ|DMA]\n");
+            return true;
+        }
+        if (new_dma && published_sequence()->streaming) {
+            printf("[ERROR] A stream is loaded; streaming only runs on the IRQ engine\n");
+            return true;
+        }
+        if (new_dma && published_sequence()->playlist) {
+            printf("[ERROR] A playlist is loaded; playlists only run on the IRQ engine\n");
+            return true;
+        }
+        if (new_dma && published_sequence()->closed_loop) {
+            printf("[ERROR] The loaded sequence is in current mode, which needs the IRQ engine\n");
+            return true;
+        }
+        if (new_dma && published_sequence()->interp != INTERP_STEP) {
+            printf("[ERROR] The loaded sequence is interpolated; set DC_INTERP STEP first\n");
+            return true;
+        }
+        if (new_dma && dma_data_chan < 0) {
+            printf("[ERROR] DMA mode needs CH1 and CH2 on the same PWM slice\n");
+            return true;
+        }
+        if (!new_dma && discharge_freq_hz > discharge_irq_max_freq_hz()) {
+            printf("[ERROR] %lu Hz is above the IRQ step engine's %lu Hz; lower DC_FREQ first\n",
+                   discharge_freq_hz, discharge_irq_max_freq_hz());
+            return true;
+        }
+        if (sequence_running) {
+            printf("[ERROR] Cannot change the step engine while a sequence is running\n");
+            return true;
+        }
+        discharge_config.dma_mode = new_dma;
+        discharge_sequence_changed();
+        printf("[COMMAND] Step engine: %s\n", new_dma ? "DMA" : "IRQ");
+        return true;
+    } else if (strcmp(command, "DC_LATENCY") == 0) {
+        if (latency_sm < 0) {
+            printf("[ERROR] The latency probe has no PIO state machine in this build\n");
+        } else {
+            latency_drain();
+            latency_report();
+        }
+        return true;
+    } else if (strcmp(command, "DC_LATENCY_RESET") == 0) {
+        latency_drain();
+        latency_reset();
+        printf("[COMMAND] Latency histogram cleared\n");
+        return true;
+    } else if (strncmp(command, "DC_LATENCY_TEST", 15) == 0) {
+        latency_self_test((uint32_t)atoi(command + 15));
         return true;
     } else if (strcmp(command, "DC_HELP") == 0) {
         print_discharge_help();
         return true;
     } else if (strncmp(command, "DC_INVERT ", 10) == 0) {
         bool new_invert = (atoi(command + 10) != 0);
+        if (discharge_config.invert_output != new_invert && published_sequence()->streaming) {
+            printf("[ERROR] Queued stream levels already carry the inversion; load a new sequence first\n");
+            return true;
+        }
+        if (discharge_config.invert_output != new_invert && published_sequence()->playlist) {
+            printf("[ERROR] A playlist is loaded; change the inversion before DC_PL_GO\n");
+            return true;
+        }
         if (discharge_config.invert_output != new_invert) {
+            // Publish a mirrored copy rather than editing levels Core 1 may be playing
+            DischargeSequence* seq = sequence_begin_edit();
+            *seq = *published_sequence();
+            if (!seq->closed_loop) {
+                // Current setpoints are not levels; the controller applies the inversion itself
+                invert_levels(&seq->ch1);
+                invert_levels(&seq->ch2);
+            }
             discharge_config.invert_output = new_invert;
+            sequence_publish();
             printf("[COMMAND] Output inversion: %s\n", discharge_config.invert_output ? "ENABLED" : "DISABLED");
             printf("[INFO] Example: Input 0.8 will now output %s\n", 
                    discharge_config.invert_output ? "0.2 (20%)" : "0.8 (80%)");
@@ -379,6 +2084,12 @@ bool process_discharge_command(const char* command) {
 // --- Initialization Function ---
 void discharge_system_init(void) {
     discharge_pwm_init();
+    discharge_dma_init();
+    current_loop[0].zero = adc_zero_counts(0);
+    current_loop[1].zero = adc_zero_counts(1);
+    current_loop_set_gains();
+    discharge_flash_init();
+    latency_probe_init();
     
     // Launch core1 real-time loop
     multicore_launch_core1(core1_discharge_loop);
@@ -390,13 +2101,47 @@ void discharge_system_init(void) {
 void print_discharge_help(void) {
     printf("[COMMAND]\n");
     printf("--- Discharge Control Help ---\n");
-    printf("  DC_STEP <ms> CH1 <d1,..> [CH2 <d1,..>]\n");
-    printf("    Defines a sequence in a single line.\n\n");
-    printf("  DC_CSV <ms>\n");
+    printf("  DC_STEP <time> CH1 <d1,..> [CH2 <d1,..>]\n");
+    printf("    Defines a sequence in a single line.\n");
+    printf("    <time> is ms, or add a unit: 250us, 40p (PWM periods).\n\n");
+    printf("  DC_CSV <time>\n");
     printf("    Starts multi-line CSV input. Each line is 'CH1_duty,CH2_duty'.\n");
     printf("  DC_CSV_END\n");
     printf("    Finishes CSV input and commits the sequence.\n\n");
+    printf("  DC_ISTEP <time> CH1 <A1,..> [CH2 <A1,..>]\n");
+    printf("    Steps are DC sensor currents; a PI loop on Core 1 sets the duty (IRQ engine).\n");
+    printf("  DC_CL_GAINS [<kp> <ki>]  - Kp in duty/A, Ki in duty/(A*s).\n");
+    printf("  DC_CL_RATE [<periods>]   - Run the current loop every n PWM periods (default 5).\n");
+    printf("  DC_CL_TELEM <ms>         - Print setpoint, measurement and duty every <ms> (0 = off).\n\n");
+    printf("  DC_SAVE <name> / DC_LOAD <name> / DC_DELETE <name> / DC_LIST\n");
+    printf("    Keep up to 12 named sequences in flash across power cycles.\n\n");
+    printf("  DC_PL_CLEAR / DC_PL_ADD <name|.> [passes] / DC_PL_GO [LOOP|ONCE|HOLD]\n");
+    printf("    Play flash slots back to back, each for n passes (0 = until release).\n\n");
+    printf("  DC_LATENCY / DC_LATENCY_RESET / DC_LATENCY_TEST <edges>\n");
+    printf("    Histogram of trigger edge to first CH1 change, timed by a PIO SM.\n\n");
+    printf("  DC_SEG [LOOP|ONCE|HOLD] [STEP|LINEAR|CUBIC] <d1>,<d2>,<time> ...\n");
+    printf("    Segments with their own lengths, e.g. DC_SEG ONCE 0.2,0.2,50ms 0.8,0.6,200us\n");
+    printf("  DC_END LOOP|ONCE|HOLD\n");
+    printf("    What happens after the last step (default LOOP).\n");
+    printf("  DC_FREQ [<Hz>|<kHz>k]\n");
+    printf("    Switching frequency (default 50k). Loaded duties are kept.\n");
+    printf("    The IRQ engine is capped by its step update time (see DC_STATUS).\n");
+    printf("  DC_PHASE [0..359]\n");
+    printf("    CH2 lag behind CH1 in degrees; 180 interleaves the channels.\n");
+    printf("    Only 0 or 180 when CH1 and CH2 share a PWM slice.\n");
+    printf("  DC_INTERP [STEP|LINEAR|CUBIC]\n");
+    printf("    Ramp between steps every PWM period instead of jumping (IRQ engine).\n");
+    printf("    DC_CSV rows may add a third column with their own length.\n\n");
+    printf("  DC_UPLOAD <time>\n");
+    printf("    Receives one binary COBS frame of 16-bit duties with CRC-32 (see README).\n");
+    printf("  DC_STREAM <time>\n");
+    printf("    Plays 'CH1_duty,CH2_duty' lines as they arrive, any length.\n");
+    printf("    Pause sending on STREAM_WAIT, resume on STREAM_READY.\n");
+    printf("  DC_STREAM_END\n");
+    printf("    Marks the end of the stream; outputs go off once it has played.\n\n");
     printf("  DC_INVERT <0|1>          - Toggle output inversion (0=normal, 1=inverted).\n");  // Add this line
+    printf("  DC_MODE [IRQ|DMA]        - Step engine: wrap IRQ (default) or DMA with no CPU per step.\n");
+    printf("                             DMA runs are started and stopped by the trigger IRQs alone.\n");
     printf("  DC_DEBUG <0|1>           - Enable/disable manual trigger override.\n");
     printf("  DC_TRIGGER <0|1>         - Manually trigger sequence (requires debug mode).\n");
     printf("  DC_TRIGGER_STATUS        - Show hardware and effective trigger status.\n");
@@ -406,10 +2151,29 @@ void print_discharge_help(void) {
 
 // --- Utility Functions ---
 bool is_csv_mode_active(void) {
-    return csv_input_mode;
+    return csv_input_mode || stream_input_mode;
 }
 
 bool is_sequence_running(void) {
     return sequence_running;
 }
 
+uint16_t get_discharge_wrap(void) {
+    return discharge_wrap;
+}
+
+bool is_discharge_output_inverted(void) {
+    return discharge_config.invert_output;
+}
+
+bool is_discharge_dma_mode(void) {
+    return discharge_config.dma_mode;
+}
+
+// Step Core 1 is on, if it is playing the published sequence
+bool get_discharge_position(uint32_t* step, bool* finished) {
+    if (!sequence_running || playing_slot != published_slot) return false;
+    *step = current_step;
+    *finished = sequence_finished;
+    return true;
+}
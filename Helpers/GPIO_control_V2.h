@@ -10,6 +10,9 @@ bool process_discharge_command(const char* command);
 void print_discharge_help(void);
 bool is_csv_mode_active(void);
 bool is_sequence_running(void);
+void discharge_poll(void);
+bool is_discharge_upload_active(void);
+void discharge_upload_poll(void);
 
 // Internal functions (shouldn't be called directly)
 void core1_discharge_loop(void);
@@ -3,6 +3,7 @@
 
 #include "adc_monitor.h"
 #include "hardware/adc.h"
+#include "hardware/dma.h"
 #include <math.h>
 #include <stdio.h>
 
@@ -15,11 +16,48 @@ static const float v_per_a[3] = {gain*2.5e-3*scalefactor, gain*2.5e-3*scalefacto
 static const float offset_v[3] = {2.5*scalefactor, 2.5*scalefactor, 2.5*scalefactor};    // Offset voltage for each channel
 static uint8_t overcurrent_counters[3] = {0, 0, 0};  // Track consecutive overcurrent events for each channel
 
+// The ADC free-runs round-robin over ADC0-2 and the temperature sensor, and a DMA
+// channel copies every result into a 4-slot ring. A slot always holds the latest
+// conversion of its input (at most 8 us old at 500 ksps), so Core 0 and the
+// discharge controller on Core 1 can both read currents without owning the ADC.
+#define ADC_ROBIN_MASK ((1u << 0) | (1u << 1) | (1u << 2) | (1u << ADC_TEMP_INPUT))
+static volatile uint16_t adc_ring[4] __attribute__((aligned(8)));
+
 void adc_monitor_init(void) {
     adc_init();
     adc_gpio_init(26); // ADC0
     adc_gpio_init(27); // ADC1
     adc_gpio_init(28); // ADC2
+    adc_set_temp_sensor_enabled(true);
+
+    adc_select_input(0);
+    adc_set_round_robin(ADC_ROBIN_MASK);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(0);
+
+    int chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 3);   // 4 x 16 bit
+    channel_config_set_dreq(&c, DREQ_ADC);
+    dma_channel_configure(chan, &c, adc_ring, &adc_hw->fifo, dma_encode_endless_transfer_count(), true);
+    adc_run(true);
+}
+
+// Latest raw result of ADC0-2 or ADC_TEMP_INPUT. Safe from either core.
+uint16_t adc_latest_raw(int input) {
+    return adc_ring[input == ADC_TEMP_INPUT ? 3 : input];
+}
+
+// Current sense scaling in ADC counts, for integer use on Core 1
+float adc_counts_per_amp(int ch) {
+    return v_per_a[ch] * 4095.0f / 3.3f;
+}
+
+uint16_t adc_zero_counts(int ch) {
+    return (uint16_t)(offset_v[ch] * 4095.0f / 3.3f + 0.5f);
 }
 
 float adc_raw_to_current(uint16_t raw, float v_per_a, float offset_v) {
@@ -31,8 +69,7 @@ float adc_raw_to_current(uint16_t raw, float v_per_a, float offset_v) {
 void read_all_currents(float currents[3]) {
     uint16_t adc_raw[3];
     for (int ch = 0; ch < 3; ++ch) {
-        adc_select_input(ch);
-        adc_raw[ch] = adc_read();
+        adc_raw[ch] = adc_latest_raw(ch);
         currents[ch] = adc_raw_to_current(adc_raw[ch], v_per_a[ch], offset_v[ch]);
     }
 }
@@ -82,8 +119,7 @@ void print_adc_readings(void) {
     float voltages[3];
     
     for (int ch = 0; ch < 3; ++ch) {
-        adc_select_input(ch);
-        adc_raw[ch] = adc_read();
+        adc_raw[ch] = adc_latest_raw(ch);
         voltages[ch] = (adc_raw[ch] * 3.3f) / 4095.0f;
         currents[ch] = adc_raw_to_current(adc_raw[ch], v_per_a[ch], offset_v[ch]);
     }
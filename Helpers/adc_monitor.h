@@ -8,8 +8,12 @@
 #define MAX_DC_CURRENT 200.0f
 #define MAX_RMF_CURRENT 1000.0f // Maximum current in amperes
 #define OCP_CONSECUTIVE_THRESHOLD 5  // Number of consecutive readings needed to trigger OCP
+#define ADC_TEMP_INPUT 4             // On-chip temperature sensor
 
 void adc_monitor_init(void);
+uint16_t adc_latest_raw(int input);
+float adc_counts_per_amp(int ch);
+uint16_t adc_zero_counts(int ch);
 float adc_raw_to_current(uint16_t raw, float v_per_a, float offset_v);
 void read_all_currents(float currents[3]);
 bool check_overcurrent(float currents[3]);
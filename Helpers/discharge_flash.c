@@ -0,0 +1,313 @@
+// discharge_flash.c
+// Named discharge sequences kept in flash (DC_SAVE / DC_LOAD / DC_LIST / DC_DELETE)
+
+#include "discharge_internal.h"
+#include "discharge_upload.h"   // upload_crc32_update
+#include "GPIO_control_V2.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+// Named sequences live in the last 64 KB of flash as a log of 1 KB records. A save
+// appends a new record, then clears the live word of the one it replaces (a 1->0
+// program, no erase); a delete only clears the live word. Free positions are taken
+// in turn from the last write on, and a sector is only erased once nothing in it is
+// live, so erases rotate through all 16 sectors and a power cut never loses a saved
+// slot. Loading copies the record from XIP into a spare sequence slot and publishes
+// it, like any other new sequence.
+#define DC_FLASH_SLOTS        12      // fewer than sectors, so one is always free to erase
+#define DC_FLASH_RECORD_SIZE  1024
+#define DC_FLASH_SECTORS      16
+#define DC_FLASH_REGION_SIZE  (DC_FLASH_SECTORS * FLASH_SECTOR_SIZE)
+#define DC_FLASH_OFFSET       (PICO_FLASH_SIZE_BYTES - DC_FLASH_REGION_SIZE)
+#define DC_FLASH_RECORDS      (DC_FLASH_REGION_SIZE / DC_FLASH_RECORD_SIZE)
+#define DC_FLASH_PER_SECTOR   (FLASH_SECTOR_SIZE / DC_FLASH_RECORD_SIZE)
+#define DC_FLASH_MAGIC        0x51534344u   // "DCSQ"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t live;          // all ones until the slot is replaced or deleted
+    uint32_t generation;    // higher is newer
+    uint32_t crc;           // CRC-32 of everything from layout on
+    uint16_t layout;        // sizeof(DischargeSequence) in the firmware that wrote it
+    uint16_t wrap;          // the levels are scaled to this wrap
+    uint8_t inverted;       // and carry this output inversion
+    uint8_t reserved[3];
+    char name[DC_FLASH_NAME_LEN];
+    DischargeSequence seq;
+} FlashRecord;
+_Static_assert(sizeof(FlashRecord) <= DC_FLASH_RECORD_SIZE, "FlashRecord must fit one record");
+
+volatile bool flash_write_busy;
+static uint32_t flash_next_record;   // where the search for a free position starts
+static uint32_t flash_generation;
+static union {
+    FlashRecord rec;
+    uint8_t bytes[DC_FLASH_RECORD_SIZE];
+} flash_buf;
+
+typedef struct {
+    uint32_t offset;
+    const uint8_t* data;    // NULL: erase the sector at offset
+    size_t len;
+} FlashOp;
+
+static const FlashRecord* flash_record(uint32_t index) {
+    return (const FlashRecord*)(uintptr_t)(XIP_BASE + DC_FLASH_OFFSET + index * DC_FLASH_RECORD_SIZE);
+}
+
+static uint32_t flash_record_crc(const FlashRecord* rec) {
+    const uint8_t* body = (const uint8_t*)rec + offsetof(FlashRecord, layout);
+    return upload_crc32_update(0xFFFFFFFFu, body, sizeof(FlashRecord) - offsetof(FlashRecord, layout)) ^ 0xFFFFFFFFu;
+}
+
+static bool flash_record_valid(const FlashRecord* rec) {
+    return rec->magic == DC_FLASH_MAGIC && rec->live == 0xFFFFFFFFu &&
+           rec->layout == sizeof(DischargeSequence) && flash_record_crc(rec) == rec->crc;
+}
+
+static bool flash_record_erased(uint32_t index) {
+    const uint32_t* word = (const uint32_t*)flash_record(index);
+    for (uint32_t i = 0; i < DC_FLASH_RECORD_SIZE / 4; ++i) {
+        if (word[i] != 0xFFFFFFFFu) return false;
+    }
+    return true;
+}
+
+// Newest live record with this name, or -1. The CRC is only run on name matches,
+// which keeps a load well under a millisecond.
+static int flash_find(const char* name) {
+    int found = -1;
+    for (uint32_t i = 0; i < DC_FLASH_RECORDS; ++i) {
+        const FlashRecord* rec = flash_record(i);
+        if (rec->magic == DC_FLASH_MAGIC && strncmp(rec->name, name, DC_FLASH_NAME_LEN) == 0 &&
+            (found < 0 || (int32_t)(rec->generation - flash_record(found)->generation) > 0) &&
+            flash_record_valid(rec)) {
+            found = (int)i;
+        }
+    }
+    return found;
+}
+
+// Runs with Core 1 parked and interrupts off
+static void flash_op_run(void* param) {
+    const FlashOp* op = (const FlashOp*)param;
+    if (op->data) {
+        flash_range_program(op->offset, op->data, op->len);
+    } else {
+        flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+    }
+}
+
+static bool flash_op(uint32_t offset, const uint8_t* data, size_t len) {
+    FlashOp op = { offset, data, len };
+    return flash_safe_execute(flash_op_run, &op, 100) == PICO_OK;
+}
+
+// Clear a record's live word; the other bits of the page are programmed as ones, which leaves them as they are
+static bool flash_retire(uint32_t index) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memset(&page[offsetof(FlashRecord, live)], 0, sizeof(uint32_t));
+    return flash_op(DC_FLASH_OFFSET + index * DC_FLASH_RECORD_SIZE, page, sizeof(page));
+}
+
+// An erased position, erasing a sector with nothing live in it if none is left
+static int flash_free_record(void) {
+    for (uint32_t k = 0; k < DC_FLASH_RECORDS; ++k) {
+        uint32_t index = (flash_next_record + k) % DC_FLASH_RECORDS;
+        if (flash_record_erased(index)) return (int)index;
+    }
+    for (uint32_t k = 0; k < DC_FLASH_SECTORS; ++k) {
+        uint32_t sector = (flash_next_record / DC_FLASH_PER_SECTOR + k) % DC_FLASH_SECTORS;
+        bool in_use = false;
+        for (uint32_t r = 0; r < DC_FLASH_PER_SECTOR; ++r) {
+            if (flash_record_valid(flash_record(sector * DC_FLASH_PER_SECTOR + r))) in_use = true;
+        }
+        if (in_use) continue;
+        if (!flash_op(DC_FLASH_OFFSET + sector * FLASH_SECTOR_SIZE, NULL, 0)) return -1;
+        return (int)(sector * DC_FLASH_PER_SECTOR);
+    }
+    return -1;
+}
+
+static int flash_slots_used(void) {
+    int used = 0;
+    for (uint32_t i = 0; i < DC_FLASH_RECORDS; ++i) {
+        const FlashRecord* rec = flash_record(i);
+        if (flash_record_valid(rec) && flash_find(rec->name) == (int)i) used++;
+    }
+    return used;
+}
+
+void discharge_flash_init(void) {
+    bool any = false;
+    for (uint32_t i = 0; i < DC_FLASH_RECORDS; ++i) {
+        const FlashRecord* rec = flash_record(i);
+        if (rec->magic != DC_FLASH_MAGIC) continue;
+        if (!any || (int32_t)(rec->generation - flash_generation) > 0) {
+            flash_generation = rec->generation;
+            flash_next_record = (i + 1) % DC_FLASH_RECORDS;
+            any = true;
+        }
+    }
+}
+
+static bool flash_name_ok(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= DC_FLASH_NAME_LEN) return false;
+    for (size_t i = 0; i < len; ++i) {
+        char c = name[i];
+        if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Core 0: flash writes stall Core 1, so they are refused while a sequence runs and
+// a trigger arriving meanwhile waits for them (an erase takes up to ~50 ms)
+static bool flash_write_begin(void) {
+    flash_write_busy = true;
+    __dmb();
+    if (is_sequence_running()) {
+        flash_write_busy = false;
+        printf("[ERROR] Cannot write flash while a sequence is running\n");
+        return false;
+    }
+    return true;
+}
+
+void flash_save_sequence(const char* name) {
+    const DischargeSequence* seq = published_sequence();
+    if (!flash_name_ok(name)) {
+        printf("[ERROR] Slot names are 1-%d characters of A-Z, a-z, 0-9, _ and -\n", DC_FLASH_NAME_LEN - 1);
+        return;
+    }
+    if (seq->streaming || seq->playlist || discharge_max_steps(seq) == 0) {
+        printf("[ERROR] Nothing to save; streams and playlists cannot be saved\n");
+        return;
+    }
+    if (flash_find(name) < 0 && flash_slots_used() >= DC_FLASH_SLOTS) {
+        printf("[ERROR] All %d flash slots are used; delete one first\n", DC_FLASH_SLOTS);
+        return;
+    }
+    if (!flash_write_begin()) return;
+
+    memset(flash_buf.bytes, 0xFF, sizeof(flash_buf.bytes));
+    FlashRecord* rec = &flash_buf.rec;
+    rec->magic = DC_FLASH_MAGIC;
+    rec->generation = flash_generation + 1;
+    rec->layout = sizeof(DischargeSequence);
+    rec->wrap = get_discharge_wrap();
+    rec->inverted = is_discharge_output_inverted();
+    memset(rec->reserved, 0, sizeof(rec->reserved));
+    memset(rec->name, 0, sizeof(rec->name));
+    strcpy(rec->name, name);
+    rec->seq = *seq;
+    rec->crc = flash_record_crc(rec);
+
+    int index = flash_free_record();
+    bool ok = index >= 0 &&
+              flash_op(DC_FLASH_OFFSET + (uint32_t)index * DC_FLASH_RECORD_SIZE, flash_buf.bytes, sizeof(flash_buf.bytes)) &&
+              memcmp(flash_record(index), flash_buf.bytes, sizeof(FlashRecord)) == 0;
+    if (ok) {
+        flash_generation = rec->generation;
+        flash_next_record = ((uint32_t)index + 1) % DC_FLASH_RECORDS;
+        // Retire the previous copy only once the new one reads back intact
+        for (uint32_t i = 0; ok && i < DC_FLASH_RECORDS; ++i) {
+            const FlashRecord* old = flash_record(i);
+            if ((int)i != index && flash_record_valid(old) && strncmp(old->name, name, DC_FLASH_NAME_LEN) == 0) {
+                ok = flash_retire(i);
+            }
+        }
+    }
+    flash_write_busy = false;
+
+    if (ok) {
+        printf("[COMMAND] Saved sequence '%s' to flash (record %d)\n", name, index);
+    } else {
+        printf("[ERROR] Flash write failed; the slot was not saved\n");
+    }
+}
+
+void flash_load_sequence(const char* name) {
+    uint64_t start_us = time_us_64();
+    int index = flash_find(name);
+    if (index < 0) {
+        printf("[ERROR] No flash slot named '%s'\n", name);
+        return;
+    }
+    const FlashRecord* rec = flash_record(index);
+    if (is_discharge_dma_mode() && (rec->seq.closed_loop || rec->seq.interp != INTERP_STEP)) {
+        printf("[ERROR] Slot '%s' needs the IRQ step engine (DC_MODE IRQ)\n", name);
+        return;
+    }
+
+    DischargeSequence* seq = sequence_begin_edit();
+    *seq = rec->seq;
+    sequence_conform(seq, rec->wrap, rec->inverted);
+    sequence_publish();
+
+    printf("[COMMAND] Loaded sequence '%s' from flash in %lu us\n", name, (uint32_t)(time_us_64() - start_us));
+}
+
+void flash_list_sequences(void) {
+    printf("[COMMAND] Flash sequence slots:\n");
+    int used = 0, other_firmware = 0, free_records = 0;
+    for (uint32_t i = 0; i < DC_FLASH_RECORDS; ++i) {
+        const FlashRecord* rec = flash_record(i);
+        if (flash_record_erased(i)) {
+            free_records++;
+        } else if (rec->magic == DC_FLASH_MAGIC && rec->live == 0xFFFFFFFFu && rec->layout != sizeof(DischargeSequence)) {
+            other_firmware++;
+        }
+        if (!flash_record_valid(rec) || flash_find(rec->name) != (int)i) continue;
+        used++;
+        const DischargeSequence* seq = &rec->seq;
+        printf("  %-15s %3lu steps, ", rec->name, discharge_max_steps(seq));
+        if (seq->per_step) {
+            printf("per-step times");
+        } else {
+            printf("%lu %s", seq->step_duration, step_unit_name(seq->step_unit));
+        }
+        printf(", end %s%s%s\n", end_mode_name(seq->end_mode),
+               seq->interp != INTERP_STEP ? ", interpolated" : "", seq->closed_loop ? ", current mode" : "");
+    }
+    printf("  %d of %d slots used, %d free records before the next erase\n", used, DC_FLASH_SLOTS, free_records);
+    if (other_firmware) {
+        printf("  %d slots from another firmware version are ignored\n", other_firmware);
+    }
+}
+
+void flash_delete_sequence(const char* name) {
+    if (flash_find(name) < 0) {
+        printf("[ERROR] No flash slot named '%s'\n", name);
+        return;
+    }
+    if (!flash_write_begin()) return;
+    bool ok = true;
+    int index;
+    while (ok && (index = flash_find(name)) >= 0) {
+        ok = flash_retire((uint32_t)index);
+    }
+    flash_write_busy = false;
+    if (ok) {
+        printf("[COMMAND] Deleted flash slot '%s'\n", name);
+    } else {
+        printf("[ERROR] Flash write failed\n");
+    }
+}
+
+const DischargeSequence* flash_lookup_sequence(const char* name, uint16_t* wrap, bool* inverted) {
+    int index = flash_find(name);
+    if (index < 0) return NULL;
+    const FlashRecord* rec = flash_record(index);
+    *wrap = rec->wrap;
+    *inverted = rec->inverted;
+    return &rec->seq;
+}
@@ -0,0 +1,94 @@
+#ifndef DISCHARGE_INTERNAL_H
+#define DISCHARGE_INTERNAL_H
+
+// Shared by the discharge files: the step engine and commands in
+// GPIO_control_V2.c, flash slots in discharge_flash.c and playlists in
+// discharge_playlist.c. The rest of the firmware uses GPIO_control_V2.h.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "discharge_steps.h"
+
+// Units a step duration can be given in (DC_STEP / DC_CSV)
+typedef enum {
+    STEP_UNIT_MS,
+    STEP_UNIT_US,
+    STEP_UNIT_PERIODS
+} StepUnit;
+
+// What the player does after the last step
+typedef enum {
+    END_LOOP,   // start again from step 0
+    END_ONCE,   // outputs off until the trigger is released
+    END_HOLD    // keep the last step's levels until the trigger is released
+} EndMode;
+
+// A complete program: both channels plus the step time they play at
+typedef struct {
+    ChannelSequence ch1;
+    ChannelSequence ch2;
+    uint32_t step_duration;
+    StepUnit step_unit;
+    uint64_t step_cycles;  // step_duration in system clocks, used by the wrap IRQ
+    bool per_step;         // segments: each step has its own length in seg_cycles
+    uint32_t seg_cycles[DISCHARGE_MAX_STEPS];
+    EndMode end_mode;
+    InterpMode interp;
+    bool closed_loop;      // DC_ISTEP: levels are current setpoints in ADC counts
+    uint8_t playlist;      // 1 + the playlist table played instead of ch1/ch2, 0 for none
+    bool streaming;        // steps come from the stream ring instead of ch1/ch2
+    uint32_t stream_start; // ring position of this stream's first step
+} DischargeSequence;
+
+// Playlist tables (DC_PL_*): sequence copies, each played for a number of
+// passes. discharge_playlist.c describes how the two tables are handed over.
+#define PLAYLIST_MAX      8
+#define PLAYLIST_NAME_LEN 16
+typedef struct {
+    DischargeSequence entries[PLAYLIST_MAX];
+    uint16_t passes[PLAYLIST_MAX];    // 0 = until the trigger drops
+    char names[PLAYLIST_MAX][PLAYLIST_NAME_LEN];
+    uint8_t count;
+    uint16_t wrap;                    // levels are scaled to this wrap
+    bool inverted;                    // and carry this inversion
+} Playlist;
+extern Playlist playlists[2];
+extern volatile uint8_t playlist_index;    // Core 1: entry being played
+extern volatile uint16_t playlist_pass;    // Core 1: completed passes of that entry
+
+// --- Sequence Slots (GPIO_control_V2.c), Core 0 ---
+DischargeSequence* sequence_begin_edit(void);
+const DischargeSequence* published_sequence(void);
+void sequence_publish(void);
+void sequence_conform(DischargeSequence* seq, uint16_t from_wrap, bool from_inverted);
+bool sequence_uses_playlist(uint8_t table);
+uint32_t discharge_max_steps(const DischargeSequence* seq);
+
+const char* step_unit_name(StepUnit unit);
+const char* end_mode_name(EndMode mode);
+bool parse_end_mode(const char* text, EndMode* mode);
+
+uint16_t get_discharge_wrap(void);
+bool is_discharge_output_inverted(void);
+bool is_discharge_dma_mode(void);
+bool get_discharge_position(uint32_t* step, bool* finished);
+
+// --- Flash Slots (discharge_flash.c) ---
+#define DC_FLASH_NAME_LEN 16
+extern volatile bool flash_write_busy;     // Core 0 is writing flash; Core 1 does not start meanwhile
+
+void discharge_flash_init(void);
+void flash_save_sequence(const char* name);
+void flash_load_sequence(const char* name);
+void flash_list_sequences(void);
+void flash_delete_sequence(const char* name);
+// The saved copy and the wrap and inversion its levels carry, or NULL
+const DischargeSequence* flash_lookup_sequence(const char* name, uint16_t* wrap, bool* inverted);
+
+// --- Playlists (discharge_playlist.c), Core 0 ---
+bool playlist_clear(void);
+void playlist_add(const char* args);
+void playlist_go(const char* args);
+void playlist_print_status(const DischargeSequence* list);
+
+#endif // DISCHARGE_INTERNAL_H
@@ -0,0 +1,152 @@
+// discharge_playlist.c
+// Discharge playlists (DC_PL_*): sequences played back to back on Core 1
+
+#include "discharge_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+// Playlists (DC_PL_*): entries are full sequence copies, each played for a number
+// of passes. Publishing a sequence whose playlist field names a table hands the
+// whole table to Core 1, which moves between entries at step boundaries on its
+// own. Core 0 only edits a table that neither the published nor the playing
+// sequence names, so there are two and Core 1 never sees one change under it.
+Playlist playlists[2];
+volatile uint8_t playlist_index;
+volatile uint16_t playlist_pass;
+static uint8_t playlist_edit;              // Core 0: table DC_PL_ADD works on
+
+// A playlist is published as a marker sequence whose playlist field names one of
+// the two tables; Core 1 then plays the table's entries back to back. A table a
+// published or playing marker points at is never written: editing it copies it
+// to the other table first, and the next DC_PL_GO publishes that one.
+static Playlist* playlist_for_edit(bool keep_entries) {
+    if (sequence_uses_playlist(playlist_edit)) {
+        uint8_t other = playlist_edit ^ 1;
+        if (sequence_uses_playlist(other)) {
+            printf("[ERROR] Both playlist tables are in use; wait for the running playlist to be replaced\n");
+            return NULL;
+        }
+        if (keep_entries) {
+            playlists[other] = playlists[playlist_edit];
+        }
+        playlist_edit = other;
+    }
+    Playlist* pl = &playlists[playlist_edit];
+    if (!keep_entries) {
+        pl->count = 0;
+    }
+    return pl;
+}
+
+bool playlist_clear(void) {
+    return playlist_for_edit(false) != NULL;
+}
+
+// Entries share the table's frequency and inversion; bring them all to the current ones
+static void playlist_conform(Playlist* pl) {
+    for (uint8_t i = 0; i < pl->count; ++i) {
+        sequence_conform(&pl->entries[i], pl->wrap, pl->inverted);
+    }
+    pl->wrap = get_discharge_wrap();
+    pl->inverted = is_discharge_output_inverted();
+}
+
+// DC_PL_ADD <flash name | .> [passes]
+void playlist_add(const char* args) {
+    char name[DC_FLASH_NAME_LEN];
+    unsigned passes = 1;
+    int n = sscanf(args, "%15s %u", name, &passes);
+    if (n < 1 || passes > UINT16_MAX) {
+        printf("[ERROR] Usage: DC_PL_ADD <flash slot name | .> [passes, 0 = until trigger release]\n");
+        return;
+    }
+
+    const DischargeSequence* src;
+    uint16_t src_wrap = get_discharge_wrap();
+    bool src_inverted = is_discharge_output_inverted();
+    if (strcmp(name, ".") == 0) {
+        src = published_sequence();
+        strcpy(name, "current");
+    } else {
+        src = flash_lookup_sequence(name, &src_wrap, &src_inverted);
+        if (!src) {
+            printf("[ERROR] No flash slot named '%s'\n", name);
+            return;
+        }
+    }
+    if (src->streaming || src->playlist || discharge_max_steps(src) == 0) {
+        printf("[ERROR] Only stored step sequences can go into a playlist\n");
+        return;
+    }
+
+    Playlist* pl = playlist_for_edit(true);
+    if (!pl) return;
+    if (pl->count >= PLAYLIST_MAX) {
+        printf("[ERROR] A playlist holds at most %d entries\n", PLAYLIST_MAX);
+        return;
+    }
+    playlist_conform(pl);
+    DischargeSequence* entry = &pl->entries[pl->count];
+    *entry = *src;
+    sequence_conform(entry, src_wrap, src_inverted);
+    pl->passes[pl->count] = (uint16_t)passes;
+    strcpy(pl->names[pl->count], name);
+    pl->count++;
+    printf("[COMMAND] Playlist entry %u: '%s', %lu steps, ", pl->count, name, discharge_max_steps(entry));
+    if (passes) {
+        printf("%u pass%s\n", passes, passes == 1 ? "" : "es");
+    } else {
+        printf("until trigger release\n");
+    }
+}
+
+// DC_PL_GO [LOOP|ONCE|HOLD]
+void playlist_go(const char* args) {
+    EndMode mode = END_LOOP;
+    while (*args == ' ') args++;
+    if (*args && !parse_end_mode(args, &mode)) {
+        printf("[ERROR] Usage: DC_PL_GO [LOOP|ONCE|HOLD]\n");
+        return;
+    }
+    if (is_discharge_dma_mode()) {
+        printf("[ERROR] Playlists need the IRQ step engine (DC_MODE IRQ)\n");
+        return;
+    }
+    Playlist* pl = playlist_for_edit(true);
+    if (!pl) return;
+    if (pl->count == 0) {
+        printf("[ERROR] The playlist is empty; add entries with DC_PL_ADD\n");
+        return;
+    }
+    playlist_conform(pl);
+
+    DischargeSequence* seq = sequence_begin_edit();
+    seq->playlist = playlist_edit + 1;
+    seq->end_mode = mode;
+    sequence_publish();
+    printf("[COMMAND] Playlist loaded: %u entries, end %s\n", pl->count, end_mode_name(mode));
+}
+
+void playlist_print_status(const DischargeSequence* list) {
+    const Playlist* pl = &playlists[list->playlist - 1];
+    printf("  Playlist: %u entries, end %s\n", pl->count, end_mode_name(list->end_mode));
+    for (uint8_t i = 0; i < pl->count; ++i) {
+        printf("    %u. %-15s %3lu steps, ", i + 1, pl->names[i], discharge_max_steps(&pl->entries[i]));
+        if (pl->passes[i]) {
+            printf("%u pass%s\n", pl->passes[i], pl->passes[i] == 1 ? "" : "es");
+        } else {
+            printf("until trigger release\n");
+        }
+    }
+    uint32_t step;
+    bool finished;
+    if (get_discharge_position(&step, &finished)) {
+        uint8_t index = playlist_index;
+        uint16_t pass = playlist_pass;
+        printf("  Position: entry %u/%u '%s', pass %u", index + 1, pl->count, pl->names[index], pass + 1);
+        if (pl->passes[index]) {
+            printf("/%u", pl->passes[index]);
+        }
+        printf(", step %lu%s\n", step + 1, finished ? " (finished)" : "");
+    }
+}
@@ -0,0 +1,53 @@
+// discharge_steps.c
+// Compare levels for the discharge sequencer (no hardware access)
+
+#include "discharge_steps.h"
+
+uint16_t discharge_duty_to_level(float duty, uint16_t wrap, bool invert) {
+    float final_duty = invert ? (1.0f - duty) : duty;
+    return (uint16_t)(final_duty * wrap + 0.5f);
+}
+
+float discharge_level_to_duty(uint16_t level, uint16_t wrap, bool invert) {
+    float duty = wrap ? (float)level / wrap : 0.0f;
+    return invert ? (1.0f - duty) : duty;
+}
+
+uint16_t discharge_channel_level(const ChannelSequence* seq, uint32_t step) {
+    return seq->num_steps > 0 ? seq->levels[step % seq->num_steps] : 0;
+}
+
+// Stored levels carry the inversion, so flipping it mirrors them about the wrap
+void discharge_invert_levels(ChannelSequence* seq, uint16_t wrap) {
+    for (int i = 0; i < seq->num_steps; ++i) {
+        seq->levels[i] = wrap - seq->levels[i];
+    }
+}
+
+// Levels are in units of the wrap, so a new frequency scales them to keep their duty
+void discharge_rescale_levels(ChannelSequence* seq, uint16_t old_wrap, uint16_t new_wrap) {
+    if (old_wrap == 0) return;
+    for (int i = 0; i < seq->num_steps; ++i) {
+        seq->levels[i] = (uint16_t)(((uint32_t)seq->levels[i] * new_wrap + old_wrap / 2) / old_wrap);
+    }
+}
+
+// Level at position t (Q16) between keyframes k[1] and k[2]. 64-bit products
+// compile to single multiplies on Cortex-M33, so this stays well inside a period.
+uint16_t discharge_interp_level(InterpMode mode, const int32_t k[4], uint32_t t, uint16_t wrap) {
+    int64_t v;
+    if (mode == INTERP_LINEAR) {
+        v = k[1] + (((int64_t)(k[2] - k[1]) * t) >> 16);
+    } else {
+        int64_t t2 = ((int64_t)t * t) >> 16;
+        int64_t t3 = (t2 * t) >> 16;
+        int64_t b = k[2] - k[0];
+        int64_t c = 2 * k[0] - 5 * k[1] + 4 * k[2] - k[3];
+        int64_t d = -k[0] + 3 * k[1] - 3 * k[2] + k[3];
+        v = (((int64_t)k[1] << 17) + b * t + c * t2 + d * t3) >> 17;
+    }
+    // Cubic overshoot near sharp corners is clipped to the PWM range
+    if (v < 0) v = 0;
+    if (v > (int64_t)wrap + 1) v = (int64_t)wrap + 1;
+    return (uint16_t)v;
+}
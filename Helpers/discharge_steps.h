@@ -0,0 +1,41 @@
+#ifndef DISCHARGE_STEPS_H
+#define DISCHARGE_STEPS_H
+
+// Compare-level arithmetic for the discharge sequencer: duty to level
+// conversion, inversion and wrap changes at load time, and the index and
+// interpolation steps the wrap IRQ runs. Plain C with no SDK calls, so the host
+// tests in tests/ build it unchanged.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DISCHARGE_MAX_STEPS 100
+
+// Steps are stored as ready-to-write compare levels with the output inversion
+// already applied, so the step path does no float math
+typedef struct {
+    uint16_t levels[DISCHARGE_MAX_STEPS];
+    int num_steps;
+} ChannelSequence;
+
+// How the level moves from one step (keyframe) to the next
+typedef enum {
+    INTERP_STEP,     // jump at the step boundary
+    INTERP_LINEAR,   // straight ramp to the next keyframe
+    INTERP_CUBIC     // Catmull-Rom curve through the neighbouring keyframes
+} InterpMode;
+
+uint16_t discharge_duty_to_level(float duty, uint16_t wrap, bool invert);
+float discharge_level_to_duty(uint16_t level, uint16_t wrap, bool invert);
+uint16_t discharge_channel_level(const ChannelSequence* seq, uint32_t step);
+void discharge_invert_levels(ChannelSequence* seq, uint16_t wrap);
+void discharge_rescale_levels(ChannelSequence* seq, uint16_t old_wrap, uint16_t new_wrap);
+uint16_t discharge_interp_level(InterpMode mode, const int32_t k[4], uint32_t t, uint16_t wrap);
+
+// step % num_steps for the next step, kept incrementally so the step path has
+// no division
+static inline uint32_t discharge_next_index(uint32_t index, int num_steps) {
+    return ++index >= (uint32_t)num_steps ? 0 : index;
+}
+
+#endif // DISCHARGE_STEPS_H
@@ -0,0 +1,103 @@
+// discharge_upload.c
+// DC_UPLOAD frames: CRC-32, COBS and frame checks (no hardware access)
+
+#include "discharge_upload.h"
+
+uint32_t upload_crc32_update(uint32_t crc, const uint8_t* data, uint32_t len) {
+    // Nibble table for the reflected IEEE polynomial (0xEDB88320)
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    for (uint32_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return crc;
+}
+
+int upload_cobs_decode(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t out_max) {
+    uint32_t r = 0, w = 0;
+    while (r < len) {
+        uint8_t code = in[r++];
+        if (code == 0) return -1;
+        for (uint8_t i = 1; i < code; ++i) {
+            if (r >= len || w >= out_max) return -1;
+            out[w++] = in[r++];
+        }
+        if (code != 0xFF && r < len) {
+            if (w >= out_max) return -1;
+            out[w++] = 0;
+        }
+    }
+    return (int)w;
+}
+
+uint32_t upload_cobs_encode(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t out_max) {
+    if (out_max == 0) return 0;
+    uint32_t code_pos = 0, w = 1;
+    uint8_t code = 1;
+    for (uint32_t i = 0; i < len; ++i) {
+        if (in[i] != 0) {
+            if (w >= out_max) return 0;
+            out[w++] = in[i];
+            ++code;
+        }
+        if (in[i] == 0 || code == 0xFF) {
+            if (w >= out_max) return 0;
+            out[code_pos] = code;
+            code_pos = w++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    return w;
+}
+
+static void put_le16(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+uint32_t upload_build_frame(const uint16_t* duty, uint32_t steps, uint32_t channels,
+                            uint8_t* out, uint32_t out_max) {
+    if (channels < 1 || channels > 2 || steps == 0 || steps > DISCHARGE_MAX_STEPS) return 0;
+    uint32_t len = UPLOAD_HEADER_BYTES + steps * channels * 2 + UPLOAD_CRC_BYTES;
+    if (len > out_max) return 0;
+    put_le16(&out[0], len);
+    put_le16(&out[2], steps);
+    out[4] = (uint8_t)channels;
+    out[5] = 0;
+    for (uint32_t i = 0; i < steps * channels; ++i) {
+        put_le16(&out[UPLOAD_HEADER_BYTES + i * 2], duty[i]);
+    }
+    uint32_t crc = upload_crc32_update(0xFFFFFFFFu, out, len - UPLOAD_CRC_BYTES) ^ 0xFFFFFFFFu;
+    put_le16(&out[len - 4], crc & 0xFFFF);
+    put_le16(&out[len - 2], crc >> 16);
+    return len;
+}
+
+UploadStatus upload_parse_frame(const uint8_t* encoded, uint32_t len,
+                                uint8_t* frame, uint32_t frame_max, UploadFrame* result) {
+    *result = (UploadFrame){0};
+    result->len = upload_cobs_decode(encoded, len, frame, frame_max);
+    if (result->len < UPLOAD_HEADER_BYTES + UPLOAD_CRC_BYTES) return UPLOAD_BAD_FRAMING;
+
+    uint32_t frame_len = upload_get_le16(&frame[0]);
+    result->steps = upload_get_le16(&frame[2]);
+    result->channels = frame[4];
+    if (result->channels < 1 || result->channels > 2 || result->steps == 0 ||
+        result->steps > DISCHARGE_MAX_STEPS || frame_len != (uint32_t)result->len ||
+        frame_len != UPLOAD_HEADER_BYTES + result->steps * result->channels * 2 + UPLOAD_CRC_BYTES) {
+        return UPLOAD_BAD_LENGTH;
+    }
+
+    result->crc = upload_crc32_update(0xFFFFFFFFu, frame, frame_len - UPLOAD_CRC_BYTES) ^ 0xFFFFFFFFu;
+    result->expected_crc = upload_get_le16(&frame[frame_len - 4]) |
+                           (upload_get_le16(&frame[frame_len - 2]) << 16);
+    if (result->crc != result->expected_crc) return UPLOAD_BAD_CRC;
+
+    result->duty = &frame[UPLOAD_HEADER_BYTES];
+    return UPLOAD_OK;
+}
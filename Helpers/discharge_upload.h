@@ -0,0 +1,60 @@
+#ifndef DISCHARGE_UPLOAD_H
+#define DISCHARGE_UPLOAD_H
+
+// DC_UPLOAD frame handling: CRC-32, COBS and frame checks. Plain C with no SDK
+// calls, so the host tests in tests/ and tools/dc_upload.cpp build it unchanged.
+//
+// One COBS-encoded frame, terminated by a 0x00 byte. Decoded it is:
+// u16 frame length | u16 steps | u8 channels | u8 reserved |
+// u16 duty[steps][channels] (0..65535 = 0..100%) | u32 CRC-32 of everything before it.
+// All fields are little endian.
+
+#include <stdint.h>
+
+#include "discharge_steps.h"
+
+#define UPLOAD_HEADER_BYTES 6
+#define UPLOAD_CRC_BYTES    4
+#define UPLOAD_MAX_FRAME    (UPLOAD_HEADER_BYTES + DISCHARGE_MAX_STEPS * 2 * 2 + UPLOAD_CRC_BYTES)
+#define UPLOAD_MAX_ENCODED  (UPLOAD_MAX_FRAME + UPLOAD_MAX_FRAME / 254 + 2)
+
+typedef enum {
+    UPLOAD_OK,
+    UPLOAD_BAD_FRAMING,     // COBS broken, or too short to hold a header and CRC
+    UPLOAD_BAD_LENGTH,      // length field, step count and channels disagree
+    UPLOAD_BAD_CRC
+} UploadStatus;
+
+// What upload_parse_frame() found; fields are filled as far as the checks got
+typedef struct {
+    int len;                // decoded bytes, -1 if the COBS was broken
+    uint32_t steps;
+    uint32_t channels;
+    const uint8_t* duty;    // steps x channels le16 duties inside the decoded frame
+    uint32_t crc;           // computed
+    uint32_t expected_crc;  // from the frame
+} UploadFrame;
+
+// Reflected IEEE CRC-32 (as zlib); start with 0xFFFFFFFF and invert the result
+uint32_t upload_crc32_update(uint32_t crc, const uint8_t* data, uint32_t len);
+
+// Without the 0x00 delimiter. Decode returns the decoded length, or -1 if the
+// encoding is broken or does not fit; encode returns the encoded length, or 0
+// if it does not fit.
+int upload_cobs_decode(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t out_max);
+uint32_t upload_cobs_encode(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t out_max);
+
+// Builds a decoded frame from steps x channels duties; returns its length, or 0
+// if the counts are out of range or it does not fit
+uint32_t upload_build_frame(const uint16_t* duty, uint32_t steps, uint32_t channels,
+                            uint8_t* out, uint32_t out_max);
+
+// Decodes an encoded frame (without the delimiter) into frame[] and checks it
+UploadStatus upload_parse_frame(const uint8_t* encoded, uint32_t len,
+                                uint8_t* frame, uint32_t frame_max, UploadFrame* result);
+
+static inline uint32_t upload_get_le16(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+#endif // DISCHARGE_UPLOAD_H
@@ -2,178 +2,1545 @@
 // This file contains the PWM control functions
 
 #include "pwm_control.h"
+#include "pwm_timing.h"
 #include "phase_pwm.pio.h"
 #include "hardware/gpio.h"
 #include "hardware/pio.h"
 #include "hardware/clocks.h"  // Add this include for clock_get_hz()
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"  // Add this include for sleep_ms()
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
-const uint PWM_PINS[4] = {2, 3, 4, 5};
+// Phases beyond the first four use GPIOs left free by the thermocouple SPI
+// (9-15), discharge PWM/trigger (16-18), relay (22), ADC (26-28) and the
+// wireless module (23-25, 29). Only eleven are left, so a 12-phase build also
+// takes GPIO 15, the fourth thermocouple chip select, and reads three
+// thermocouples (thermocouple.h). From six phases on GPIO 7 is a phase output
+// rather than the fault input.
+#if PWM_PHASE_COUNT == 4
+const uint PWM_PINS[PWM_PHASE_COUNT] = {2, 3, 4, 5};
+#elif PWM_PHASE_COUNT == 6
+const uint PWM_PINS[PWM_PHASE_COUNT] = {2, 3, 4, 5, 7, 8};
+#elif PWM_PHASE_COUNT == 8
+const uint PWM_PINS[PWM_PHASE_COUNT] = {2, 3, 4, 5, 7, 8, 19, 20};
+#elif PWM_PHASE_COUNT == 10
+const uint PWM_PINS[PWM_PHASE_COUNT] = {2, 3, 4, 5, 7, 8, 19, 20, 21, 0};
+#else
+const uint PWM_PINS[PWM_PHASE_COUNT] = {2, 3, 4, 5, 7, 8, 19, 20, 21, 0, 1, 15};
+#endif
 const uint TRIGGER_PIN = 6;
+// Comparator output for the cycle-by-cycle current limit, HIGH = overcurrent.
+// Only the CHAIN_OCP engine reads it (four-phase builds, where GPIO 7 is free)
+const uint FAULT_PIN = 7;
+
+// SM0-3 on pio0 generate the first four phases (chain engine), continued on
+// pio1/pio2 for larger PWM_PHASE_COUNT. The timeline engine only exists for
+// four phases; it uses pio0 SM0 and leaves SM1-3 free
+#define PWM_SM_MASK 0xFu
+#define TIMELINE_SM 0
+
+// Timeline engine: one period of pin patterns per buffer (TIMELINE_WORDS),
+// streamed to SM0 by a data channel that chains to a control channel reloading
+// its read address
+
+// CHAIN_OCP: one fault counter SM per phase on pio1. More than fault_trip_limit
+// cut pulses on one phase within a window escalates to a full shutdown
+#define FAULT_COUNT_PIO         pio1
+#define FAULT_WINDOW_MS         100u
+#define FAULT_TRIP_LIMIT        100u
 
 static PIO pio = NULL;
 static uint offset = 0;
+static uint follower_offset = 0;
+static uint bridge_offset[PWM_BANKS];           // pio1/pio2 program offsets, index 0 unused
+static uint bridge_follower_offset[PWM_BANKS];
+static pwm_engine_t engine = PWM_ENGINE_CHAIN;
+static uint16_t current_div_int = 1;
+static uint8_t current_div_frac = 0;
 static float current_frequency = 0;
 static float current_duty_cycle = 0;
+static float current_duty_cycle_pair2 = 0;
+static float current_effective_freq = 0;
+static uint32_t dead_time_cycles = 0;    // PIO cycles between a phase falling and its 180° partner rising
+static uint32_t current_counts = 0;
+static uint32_t current_period_cycles = 0;
+static uint32_t current_pulse_cycles[PWM_PHASE_COUNT] = {0};    // Modelled HIGH time per phase, PIO cycles
+
+static uint fault_count_offset = 0;
+static uint32_t fault_trip_limit = FAULT_TRIP_LIMIT;   // 0 = count only, never shut down
+static uint32_t fault_window_base[4];
+static uint64_t fault_window_start_us = 0;              // 0 = re-base on the next check
+
+// Per-phase layout, applied on every retune. Angles are relative to phase 0's
+// rising edge; a negative duty means the phase follows its pair duty (phases
+// alternate pair 1/pair 2 within each half, so complementary phases share one).
+static float phase_angle_deg[PWM_PHASE_COUNT];
+static float phase_duty[PWM_PHASE_COUNT];
+
+static uint32_t timeline_buf[2][TIMELINE_WORDS];
+static uint32_t *volatile timeline_next = timeline_buf[0];  // Read by the control channel
+static int timeline_front = 0;
+static int timeline_data_chan = -1;
+static int timeline_ctrl_chan = -1;
+
+// Duty profiles: per-period words for each SM, streamed by DMA
+#define PROFILE_MAX_PERIODS     2048u
+
+static float profile_duty[2][PROFILE_MAX_PERIODS];     // Pair 1, pair 2
+static uint32_t profile_words[4][PROFILE_MAX_PERIODS];
+static uint32_t *profile_base[4];                       // Reload source for the control channels
+static uint32_t profile_len = 0;
+static int profile_data_chan[4];
+static int profile_ctrl_chan[4];
+static volatile bool profile_armed = false;
+static volatile bool profile_rewind_pending = false;   // Trigger dropped before every SM had parked
+static bool profile_dither = false;     // Profile is a generated dither pattern
+
+// Ramps reuse the profile words and DMA channels; the two never run together
+#define RAMP_MAX_STEPS          512u
+#define CHAIN_FIFO_WORDS        4u      // Chain SMs keep separate 4-word TX and RX FIFOs
+
+static uint32_t ramp_blocks[4][RAMP_MAX_STEPS + 1][2];  // {hold periods, &word}, {0, 0} ends
+static uint32_t ramp_steps = 0;
+static volatile bool ramp_active = false;
+static volatile bool ramp_aborted = false;
+static uint64_t ramp_start_us = 0;
+static float ramp_from_frequency, ramp_to_frequency;
+static float ramp_from_duty[2], ramp_to_duty[2];
+static uint32_t ramp_final_counts, ramp_final_period_cycles;
+static uint32_t ramp_period_us;         // Longest period of the ramp
+static float ramp_final_effective_freq;
+
+static void profile_dma_init(void);
+static void profile_dma_stop(void);
+static void profile_trigger_isr(void);
 static bool pio_debug_mode = false;
 static bool manual_pio_trigger_state = false;
 
-static inline double absolute(double x) { 
-    return x < 0.0 ? -x : x; 
+static inline const chain_timing_t *chain_timing(void) {
+    return engine == PWM_ENGINE_CHAIN_OCP ? &CHAIN_OCP_TIMING : &CHAIN_TIMING;
 }
 
-static inline uint32_t round_to_uint(double x) { 
-    return (uint32_t)(x + 0.5); 
+// Four-phase only: pio0 runs the fault-aware chain, pio1 counts the cut pulses.
+static void chain_ocp_engine_load(void) {
+    offset = pio_add_program(pio, &phase_pwm_ocp_program);
+    follower_offset = pio_add_program(pio, &phase_pwm_ocp_follower_program);
+    fault_count_offset = pio_add_program(FAULT_COUNT_PIO, &phase_fault_count_program);
+
+    phase_pwm_ocp_program_init(pio, 0, offset, PWM_PINS[0], TRIGGER_PIN, FAULT_PIN);
+    for (uint sm = 1; sm < 4; ++sm) {
+        phase_pwm_ocp_follower_program_init(pio, sm, follower_offset, PWM_PINS[sm], TRIGGER_PIN, FAULT_PIN);
+    }
+    for (uint sm = 0; sm < 4; ++sm) {
+        phase_fault_count_program_init(FAULT_COUNT_PIO, sm, fault_count_offset, PWM_PINS[sm], FAULT_PIN);
+    }
+    pio_set_sm_mask_enabled(FAULT_COUNT_PIO, PWM_SM_MASK, true);
+    fault_window_start_us = 0;
 }
 
-// Helper to find best timing parameters for target frequency
-static void compute_best_timing(float target_freq, 
-                              uint32_t *out_total_cycles,
-                              float *out_clkdiv) {
-    const uint32_t sys_hz = clock_get_hz(clk_sys);
-    const uint32_t MAX_CYCLES = 65535;  // Maximum reasonable cycle count
-    const double MIN_DIV = 1.0;         // Minimum clock divider
-    const double MAX_DIV = 256.0;       // Maximum clock divider
-    
-    double best_err = 1e12;
-    uint32_t best_cycles = 0;
-    double best_div = 1.0;
-
-    // Try different cycle counts, preferring larger values for better resolution
-    for (uint32_t cycles = MAX_CYCLES; cycles >= 100; cycles--) {
-        // Calculate required divider for this cycle count
-        double div = (double)sys_hz / ((double)target_freq * (double)cycles);
-        
-        if (div >= MIN_DIV && div <= MAX_DIV) {
-            // Calculate actual frequency with these parameters
-            double actual = (double)sys_hz / (div * (double)cycles);
-            double err = absolute(actual - target_freq);
-            
-            if (err < best_err) {
-                best_err = err;
-                best_cycles = cycles;
-                best_div = div;
-            }
+static void chain_engine_load(void) {
+    if (engine == PWM_ENGINE_CHAIN_OCP) {
+        chain_ocp_engine_load();
+        return;
+    }
+
+    // pio0 SM0 leads, every other phase follows the one before it through IRQs;
+    // SM0 of pio1/pio2 bridges from SM3 of the block before
+    offset = pio_add_program(pio, &phase_pwm_program);
+    follower_offset = pio_add_program(pio, &phase_pwm_follower_program);
+    for (uint b = 1; b < PWM_BANKS; ++b) {
+        bridge_offset[b] = pio_add_program(pio_get_instance(b), &phase_pwm_bridge_program);
+        bridge_follower_offset[b] = pio_add_program(pio_get_instance(b), &phase_pwm_follower_program);
+    }
+
+    // Each SM controls its own output pin but shares the trigger pin (6)
+    phase_pwm_program_init(pio, 0, offset, PWM_PINS[0], TRIGGER_PIN);
+    for (uint i = 1; i < PWM_PHASE_COUNT; ++i) {
+        const uint b = i / PWM_PHASES_PER_BANK;
+        const uint sm = pwm_phase_sm(i);
+        if (b == 0) {
+            phase_pwm_follower_program_init(pio, sm, follower_offset, PWM_PINS[i], TRIGGER_PIN);
+        } else if (sm == 0) {
+            phase_pwm_bridge_program_init(pwm_phase_pio(i), sm, bridge_offset[b], PWM_PINS[i], TRIGGER_PIN);
+        } else {
+            phase_pwm_follower_program_init(pwm_phase_pio(i), sm, bridge_follower_offset[b], PWM_PINS[i],
+                                            TRIGGER_PIN);
         }
     }
+}
 
-    *out_total_cycles = best_cycles;
-    *out_clkdiv = (float)best_div;
+// Chain SMs in use on PIO block `bank`.
+static uint32_t chain_bank_mask(uint bank) {
+    if (bank >= PWM_BANKS) return 0;
+    const uint n = PWM_PHASE_COUNT - bank * PWM_PHASES_PER_BANK;
+    return n >= PWM_PHASES_PER_BANK ? PWM_SM_MASK : (1u << n) - 1;
+}
+
+// Restart every chain SM's clock divider on the same cycle. Across blocks this
+// goes through pio1's NEXTPREV controls, which reach pio0 and pio2 as well.
+static void chain_clkdiv_restart(void) {
+#if PWM_BANKS > 1
+    pio_clkdiv_restart_sm_multi_mask(pio1, chain_bank_mask(0), chain_bank_mask(1), chain_bank_mask(2));
+#else
+    pio_clkdiv_restart_sm_mask(pio, PWM_SM_MASK);
+#endif
+}
+
+static void chain_enable_in_sync(void) {
+#if PWM_BANKS > 1
+    pio_enable_sm_multi_mask_in_sync(pio1, chain_bank_mask(0), chain_bank_mask(1), chain_bank_mask(2));
+#else
+    pio_enable_sm_mask_in_sync(pio, PWM_SM_MASK);
+#endif
+}
+
+// A live retune is only queued once the last one is committed: the leader has
+// taken its word, and the commit flag that let the followers take theirs has
+// been cleared again at the top of the next period (phase_pwm.pio). Followers
+// queued before then would switch a period ahead of the leader. `queued` is how
+// many words the leader may still hold, each taking a period. Once settled,
+// nothing commits until the leader gets a word, so a word still in a follower's
+// FIFO (left by a stopped DMA feed) could only be taken a commit late and is
+// dropped. Returns false if the leader stops taking words (trigger dropped).
+static bool chain_commit_settle(uint32_t period_us, uint32_t queued) {
+    const uint64_t deadline = time_us_64() + (queued + 1u) * period_us + 1000u;
+    while (!pio_sm_is_tx_fifo_empty(pwm_phase_pio(0), pwm_phase_sm(0)) ||
+           pio_interrupt_get(pio1, PHASE_PWM_COMMIT_IRQ)) {
+        if (time_us_64() >= deadline) {
+            return false;
+        }
+        tight_loop_contents();
+    }
+    for (uint i = 1; i < PWM_PHASE_COUNT; ++i) {
+        pio_sm_clear_fifos(pwm_phase_pio(i), pwm_phase_sm(i));
+    }
+    return true;
+}
+
+// Evenly spaced phases on their pair duties.
+static void phase_layout_defaults(float angle_deg[PWM_PHASE_COUNT], float duty[PWM_PHASE_COUNT]) {
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+        angle_deg[i] = 360.0f * i / PWM_PHASE_COUNT;
+        duty[i] = -1.0f;
+    }
+}
+
+static void timeline_engine_load(void) {
+    offset = pio_add_program(pio, &phase_timeline_program);
+    phase_timeline_program_init(pio, TIMELINE_SM, offset, PWM_PINS[0], TRIGGER_PIN);
+
+    if (timeline_data_chan < 0) {
+        timeline_data_chan = dma_claim_unused_channel(true);
+        timeline_ctrl_chan = dma_claim_unused_channel(true);
+    }
+
+    // Data channel: one period of words into the TX FIFO, paced by the SM
+    dma_channel_config c = dma_channel_get_default_config(timeline_data_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, TIMELINE_SM, true));
+    channel_config_set_chain_to(&c, timeline_ctrl_chan);
+    dma_channel_configure(timeline_data_chan, &c, &pio->txf[TIMELINE_SM], NULL, TIMELINE_WORDS, false);
+
+    // Control channel: copy timeline_next into the data channel's read address
+    // and retrigger it, so a buffer swap lands exactly on a period boundary
+    c = dma_channel_get_default_config(timeline_ctrl_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(timeline_ctrl_chan, &c, &dma_hw->ch[timeline_data_chan].al3_read_addr_trig,
+                          &timeline_next, 1, false);
+}
+
+static void timeline_dma_stop(void) {
+    // Control first so a finishing data transfer can't re-arm the pair
+    dma_channel_abort(timeline_ctrl_chan);
+    dma_channel_abort(timeline_data_chan);
+    dma_channel_abort(timeline_ctrl_chan);
 }
 
 void pwm_control_init(float frequency, float duty_cycle_pair1, float duty_cycle_pair2) {
     current_frequency = frequency;
     current_duty_cycle = duty_cycle_pair1;  // Store first duty cycle for compatibility
+    current_duty_cycle_pair2 = duty_cycle_pair2;
     
-    // Enable PIO Program
+    // Enable PIO Programs
     pio = pio0;
-    offset = pio_add_program(pio, &phase_pwm_program);
+    phase_layout_defaults(phase_angle_deg, phase_duty);
 
     // Initialize trigger pin as input with pulldown (shared by all SMs)
     gpio_init(TRIGGER_PIN);
     gpio_set_dir(TRIGGER_PIN, GPIO_IN);
     gpio_pull_down(TRIGGER_PIN);
 
-    // Initialize each state machine for each phase
-    for (int i = 0; i < 4; ++i) {
-        // Each SM controls its own output pin (2,3,4,5) but shares trigger pin (6)
-        phase_pwm_program_init(pio, i, offset, PWM_PINS[i], TRIGGER_PIN);
-        
-        // IMPORTANT: Enable the state machine after initialization
-        pio_sm_set_enabled(pio, i, true);
+    // Fault input idles low (no fault) if the comparator is not fitted. Larger
+    // builds drive a phase on this pin and have no CHAIN_OCP.
+    if (PWM_PHASE_COUNT == 4) {
+        gpio_init(FAULT_PIN);
+        gpio_set_dir(FAULT_PIN, GPIO_IN);
+        gpio_pull_down(FAULT_PIN);
     }
 
+    chain_engine_load();
+
+    // Trigger-fall IRQ keeps armed duty profiles aligned (enabled only while armed)
+    profile_dma_init();
+    gpio_add_raw_irq_handler(TRIGGER_PIN, profile_trigger_isr);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+
+    // Queue the first parameter set, then start every phase with aligned clock dividers
     update_pwm_parameters(frequency, duty_cycle_pair1, duty_cycle_pair2);
+    chain_enable_in_sync();
     
-    printf("[INFO] Loaded PIO program at %d\n", offset);
-    printf("[INFO] 4 State machines configured and ENABLED:\n");
-    printf("[INFO]   SM0 -> Pin %d (trigger: Pin %d) - Pair 1\n", PWM_PINS[0], TRIGGER_PIN);
-    printf("[INFO]   SM1 -> Pin %d (trigger: Pin %d) - Pair 2\n", PWM_PINS[1], TRIGGER_PIN);
-    printf("[INFO]   SM2 -> Pin %d (trigger: Pin %d) - Pair 1\n", PWM_PINS[2], TRIGGER_PIN);
-    printf("[INFO]   SM3 -> Pin %d (trigger: Pin %d) - Pair 2\n", PWM_PINS[3], TRIGGER_PIN);
+    printf("[INFO] Loaded PIO programs at %d (leader) and %d (follower)\n", offset, follower_offset);
+    printf("[INFO] %d State machines on %d PIO block%s configured and ENABLED:\n", PWM_PHASE_COUNT,
+           PWM_BANKS, PWM_BANKS > 1 ? "s" : "");
+    printf("[INFO]   PIO0 SM0 -> Pin %d (trigger: Pin %d) - Pair 1, leader\n", PWM_PINS[0], TRIGGER_PIN);
+    for (uint i = 1; i < PWM_PHASE_COUNT; ++i) {
+        printf("[INFO]   PIO%u SM%u -> Pin %d (follows phase %u) - Pair %d\n", i / PWM_PHASES_PER_BANK,
+               pwm_phase_sm(i), PWM_PINS[i], i - 1, (i % (PWM_PHASE_COUNT / 2)) % 2 + 1);
+    }
+}
+
+// Swap the PIO program set on pio0. Only allowed while the trigger is idle; the
+// outputs are parked LOW throughout and the current frequency/duties carry over.
+bool set_pwm_engine(pwm_engine_t new_engine) {
+    if (new_engine == engine) {
+        printf("[INFO] PWM engine already %s\n", pwm_engine_name(engine));
+        return true;
+    }
+    if (new_engine == PWM_ENGINE_TIMELINE && PWM_PHASE_COUNT != 4) {
+        printf("[ERROR] TIMELINE drives four pins from one SM, this build has %d phases\n", PWM_PHASE_COUNT);
+        return false;
+    }
+    if (new_engine == PWM_ENGINE_CHAIN_OCP && PWM_PHASE_COUNT != 4) {
+        printf("[ERROR] CHAIN_OCP counts faults on pio1, this build has %d phases\n", PWM_PHASE_COUNT);
+        return false;
+    }
+    if (get_effective_pio_trigger_state()) {
+        printf("[ERROR] PIO trigger active, drop it before switching engine\n");
+        return false;
+    }
+    if (ramp_active) {
+        printf("[ERROR] RAMP in progress, wait for it or RAMP_STOP\n");
+        return false;
+    }
+
+    if (profile_armed) {
+        printf("[INFO] Disarming duty profile for the engine switch\n");
+        gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_EDGE_FALL, false);
+        profile_armed = false;
+        profile_dma_stop();
+    }
+
+    pio_set_sm_mask_enabled(pio, PWM_SM_MASK, false);
+    if (engine == PWM_ENGINE_TIMELINE) {
+        timeline_dma_stop();
+        pio_remove_program(pio, &phase_timeline_program, offset);
+    } else if (engine == PWM_ENGINE_CHAIN_OCP) {
+        pio_set_sm_mask_enabled(FAULT_COUNT_PIO, PWM_SM_MASK, false);
+        pio_remove_program(pio, &phase_pwm_ocp_program, offset);
+        pio_remove_program(pio, &phase_pwm_ocp_follower_program, follower_offset);
+        pio_remove_program(FAULT_COUNT_PIO, &phase_fault_count_program, fault_count_offset);
+    } else {
+        pio_remove_program(pio, &phase_pwm_program, offset);
+        pio_remove_program(pio, &phase_pwm_follower_program, follower_offset);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pio_sm_clear_fifos(pio, i);
+        pio_sm_restart(pio, i);
+    }
+
+    engine = new_engine;
+    if (engine == PWM_ENGINE_TIMELINE) {
+        timeline_engine_load();
+    } else {
+        chain_engine_load();
+    }
+
+    if (!update_pwm_parameters(current_frequency, current_duty_cycle, current_duty_cycle_pair2)) {
+        printf("[ERROR] Engine switched but the current parameters did not apply\n");
+    }
+    pio_enable_sm_mask_in_sync(pio, engine == PWM_ENGINE_TIMELINE ? (1u << TIMELINE_SM) : PWM_SM_MASK);
+
+    printf("[INFO] PWM engine: %s (program at %d)\n", pwm_engine_name(engine), offset);
+    if (engine == PWM_ENGINE_TIMELINE) {
+        printf("[INFO]   SM%d -> Pins %d-%d from DMA channels %d/%d, SM1-3 free\n", TIMELINE_SM,
+               PWM_PINS[0], PWM_PINS[3], timeline_data_chan, timeline_ctrl_chan);
+    } else if (engine == PWM_ENGINE_CHAIN_OCP) {
+        printf("[INFO]   Fault input Pin %d cuts the pulse, cut pulses counted on PIO1 SM0-3 "
+               "(limit %lu per %u ms)\n", FAULT_PIN, (unsigned long)fault_trip_limit, FAULT_WINDOW_MS);
+    }
+    return true;
+}
+
+pwm_engine_t get_pwm_engine(void) {
+    return engine;
+}
+
+const char *pwm_engine_name(pwm_engine_t e) {
+    switch (e) {
+        case PWM_ENGINE_TIMELINE:  return "TIMELINE";
+        case PWM_ENGINE_CHAIN_OCP: return "CHAIN_OCP";
+        default:                   return "CHAIN";
+    }
+}
+
+static inline float phase_duty_for(int i, float duty_cycle_pair1, float duty_cycle_pair2) {
+    if (phase_duty[i] >= 0.0f) return phase_duty[i];
+    return pwm_phase_pair(PWM_PHASE_COUNT, i) == 0 ? duty_cycle_pair1 : duty_cycle_pair2;
+}
+
+// Chain words for the current layout and dead time at one operating point.
+static bool chain_words(uint32_t counts, uint32_t period_cycles, float duty_cycle_pair1, float duty_cycle_pair2,
+                        uint32_t words[PWM_PHASE_COUNT], bool verbose) {
+    float duty[PWM_PHASE_COUNT];
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+        duty[i] = phase_duty_for(i, duty_cycle_pair1, duty_cycle_pair2);
+    }
+    return chain_build_words(chain_timing(), PWM_PHASE_COUNT, counts, period_cycles, phase_angle_deg, duty,
+                             dead_time_cycles, words, verbose);
+}
+
+// Queue a new timeline. Running: fill the idle buffer and point the control
+// channel at it, then wait for the data channel to move over so the old buffer
+// is free for the next call. Idle: restart SM0 and the DMA from the new buffer.
+static bool timeline_queue(const uint32_t words[TIMELINE_WORDS], bool live, uint32_t period_us) {
+    const int back = timeline_front ^ 1;
+    for (uint32_t k = 0; k < TIMELINE_WORDS; ++k) {
+        timeline_buf[back][k] = words[k];
+    }
+
+    if (!live) {
+        timeline_dma_stop();
+        pio_sm_set_enabled(pio, TIMELINE_SM, false);
+        pio_sm_clear_fifos(pio, TIMELINE_SM);
+        pio_sm_restart(pio, TIMELINE_SM);
+        pio_sm_exec(pio, TIMELINE_SM, pio_encode_jmp(offset + phase_timeline_offset_park));
+        timeline_next = timeline_buf[back];
+        timeline_front = back;
+        dma_channel_start(timeline_ctrl_chan);
+        pio_sm_set_enabled(pio, TIMELINE_SM, true);
+        return true;
+    }
+
+    timeline_next = timeline_buf[back];
+    const uintptr_t lo = (uintptr_t)timeline_buf[back];
+    const uintptr_t hi = lo + sizeof(timeline_buf[back]);
+    // FIFO (8 words) plus the block in flight: at most about two periods
+    const uint64_t deadline = time_us_64() + 3u * period_us + 1000u;
+    while (time_us_64() < deadline) {
+        uintptr_t read_addr = (uintptr_t)dma_hw->ch[timeline_data_chan].read_addr;
+        if (read_addr >= lo && read_addr <= hi) {
+            timeline_front = back;
+            return true;
+        }
+        tight_loop_contents();
+    }
+    printf("[ERROR] Timeline buffer swap not picked up by the DMA\n");
+    return false;
+}
+
+// Duty profiles (chain engine). With its FIFO fed the leader commits a word
+// every period and each follower takes one with it, so with every TX FIFO fed
+// by DMA on the TX DREQ the FIFO level paces the stream and
+// the four tables advance in step without the CPU. Data channel i copies SM i's
+// table into its FIFO and chains to control channel i, which points it back at
+// the start of the table and retriggers it.
+static void profile_dma_init(void) {
+    if (PWM_PHASE_COUNT != 4) {
+        return;     // Two channels per SM would not fit; profiles and ramps are four-phase only
+    }
+    for (int i = 0; i < 4; ++i) {
+        profile_data_chan[i] = dma_claim_unused_channel(true);
+        profile_ctrl_chan[i] = dma_claim_unused_channel(true);
+        profile_base[i] = profile_words[i];
+    }
+}
+
+static void profile_dma_stop(void) {
+    for (int i = 0; i < 4; ++i) {
+        dma_channel_abort(profile_ctrl_chan[i]);
+        dma_channel_abort(profile_data_chan[i]);
+        dma_channel_abort(profile_ctrl_chan[i]);
+    }
 }
 
-void update_pwm_parameters(float frequency, float duty_cycle_pair1, float duty_cycle_pair2) {
-    uint32_t total_cycles;
-    float clkdiv;
-    compute_best_timing(frequency * 2.0f, &total_cycles, &clkdiv); // 2x for PIO overhead
+// Restart all four tables from period 0. Only valid while the SMs are parked.
+static void profile_dma_rewind(void) {
+    profile_dma_stop();
+    for (int i = 0; i < 4; ++i) {
+        pio_sm_clear_fifos(pio, i);
+
+        dma_channel_config c = dma_channel_get_default_config(profile_data_chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, i, true));
+        channel_config_set_chain_to(&c, profile_ctrl_chan[i]);
+        dma_channel_configure(profile_data_chan[i], &c, &pio->txf[i], profile_words[i], profile_len, false);
+
+        c = dma_channel_get_default_config(profile_ctrl_chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        dma_channel_configure(profile_ctrl_chan[i], &c, &dma_hw->ch[profile_data_chan[i]].al3_read_addr_trig,
+                              &profile_base[i], 1, false);
+    }
+    dma_start_channel_mask((1u << profile_data_chan[0]) | (1u << profile_data_chan[1]) |
+                           (1u << profile_data_chan[2]) | (1u << profile_data_chan[3]));
+}
+
+// Every chain SM is parked with the trigger low: the leader on its trigger
+// wait, each follower on its link wait with no link pending. A follower whose
+// link is still in flight goes on to pull before it sees the drop.
+static bool profile_chain_parked(void) {
+    if (gpio_get(TRIGGER_PIN) || pio_sm_get_pc(pio, 0) != offset + phase_pwm_offset_wait_for_trigger) {
+        return false;
+    }
+    for (uint sm = 1; sm < 4; ++sm) {
+        if (pio_sm_get_pc(pio, sm) != follower_offset + phase_pwm_follower_offset_follower_wait) {
+            return false;
+        }
+    }
+    return (pio->irq & 0xEu) == 0;      // Links into SM1-3
+}
+
+// A follower that parks before taking its word for the current period would
+// otherwise come back one entry behind the leader, so every trigger drop puts
+// all four tables back to period 0 once the SMs are parked. Parking takes up
+// to 11 PIO cycles after the drop (phase_pwm.pio), which at large dividers
+// outlasts this handler; the rewind is then left to pwm_profile_poll(). A ramp
+// is cut short instead and reported by pwm_ramp_poll().
+static void __isr profile_trigger_isr(void) {
+    if (gpio_get_irq_event_mask(TRIGGER_PIN) & GPIO_IRQ_EDGE_FALL) {
+        gpio_acknowledge_irq(TRIGGER_PIN, GPIO_IRQ_EDGE_FALL);
+        if (profile_armed) {
+            profile_rewind_pending = !profile_chain_parked();
+            if (!profile_rewind_pending) {
+                profile_dma_rewind();
+            }
+        } else if (ramp_active) {
+            profile_dma_stop();
+            ramp_aborted = true;
+        }
+    }
+}
+
+// Convert the duty envelope into per-SM words at the current period.
+static bool profile_build_words(void) {
+    for (uint32_t k = 0; k < profile_len; ++k) {
+        uint32_t words[PWM_PHASE_COUNT];
+        if (!chain_words(current_counts, current_period_cycles,
+                               profile_duty[0][k], profile_duty[1][k], words, false)) {
+            return false;
+        }
+        for (int i = 0; i < 4; ++i) {
+            profile_words[i][k] = words[i];
+        }
+    }
+    return true;
+}
 
+bool pwm_profile_arm(void) {
+    if (PWM_PHASE_COUNT != 4) {
+        printf("[ERROR] Duty profiles need a four-phase build\n");
+        return false;
+    }
+    if (engine != PWM_ENGINE_CHAIN) {
+        printf("[ERROR] Duty profiles run on the CHAIN engine, use PWM_ENGINE CHAIN\n");
+        return false;
+    }
+    if (ramp_active) {
+        printf("[ERROR] RAMP in progress, wait for it or RAMP_STOP\n");
+        return false;
+    }
+    if (profile_len == 0) {
+        printf("[ERROR] No profile loaded\n");
+        return false;
+    }
+    if (get_effective_pio_trigger_state()) {
+        printf("[ERROR] PIO trigger active, arm the profile with the trigger idle\n");
+        return false;
+    }
+    if (!profile_build_words()) {
+        return false;
+    }
+
+    profile_armed = true;
+    profile_rewind_pending = false;
+    profile_dma_rewind();
+    gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_EDGE_FALL, true);
+
+    const float period_us = 1e6f / current_effective_freq;
+    printf("[INFO] Profile armed: %lu periods at %.2f Hz (%.1f ms per pass), DMA channels %d-%d\n",
+           (unsigned long)profile_len, current_effective_freq, profile_len * period_us / 1000.0f,
+           profile_data_chan[0], profile_ctrl_chan[3]);
+    return true;
+}
+
+void pwm_profile_stop(void) {
+    if (!profile_armed) {
+        return;
+    }
+    gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_EDGE_FALL, false);
+    profile_armed = false;
+    profile_rewind_pending = false;
+    profile_dma_stop();
+
+    // Running SMs fall back to the word in X until the static duties land
+    printf("[INFO] Profile stopped, restoring %.2f/%.2f duty\n", current_duty_cycle, current_duty_cycle_pair2);
+    update_pwm_parameters(current_frequency, current_duty_cycle, current_duty_cycle_pair2);
+}
+
+// Finish a rewind the trigger IRQ left pending. Called from the main loop, so
+// the SMs have had far longer than they need to park.
+void pwm_profile_poll(void) {
+    if (!profile_rewind_pending) {
+        return;
+    }
+    uint32_t irq_state = save_and_disable_interrupts();
+    const bool parked = profile_chain_parked();
+    if (parked) {
+        profile_dma_rewind();
+    }
+    profile_rewind_pending = false;
+    restore_interrupts(irq_state);
+    if (!parked) {
+        // Already running again: the next trigger drop rewinds
+        printf("[ERROR] Trigger came back before the profile could rewind; phases may be a period out of step "
+               "until the next drop\n");
+    }
+}
+
+bool pwm_profile_is_armed(void) {
+    return profile_armed;
+}
+
+static void print_pwm_profile_status(void) {
+    printf("[INFO] PWM profile:\n");
+    printf("  Periods: %lu / %u\n", (unsigned long)profile_len, PROFILE_MAX_PERIODS);
+    printf("  Armed: %s\n", profile_armed ? "YES" : "NO");
+    printf("  Type: %s\n", profile_dither ? "duty dither" : "duty envelope");
+    if (profile_len > 0) {
+        float lo = 1.0f, hi = 0.0f;
+        for (uint32_t k = 0; k < profile_len; ++k) {
+            for (int p = 0; p < 2; ++p) {
+                if (profile_duty[p][k] < lo) lo = profile_duty[p][k];
+                if (profile_duty[p][k] > hi) hi = profile_duty[p][k];
+            }
+        }
+        printf("  Duty range: %.3f - %.3f\n", lo, hi);
+    }
+    if (profile_armed) {
+        // Next period the DMA will write, which runs a FIFO's depth ahead of the pins
+        uint32_t next = (uint32_t)(dma_hw->ch[profile_data_chan[0]].read_addr -
+                                   (uintptr_t)profile_words[0]) / sizeof(uint32_t);
+        printf("  DMA position: %lu (SM0 FIFO level %d)\n", (unsigned long)next,
+               pio_sm_get_tx_fifo_level(pio, 0));
+    }
+}
+
+// PROFILE_* serial commands. Returns false if the command is not recognised.
+bool process_pwm_profile_command(const char *command) {
+    if (strcmp(command, "PROFILE_CLEAR") == 0) {
+        pwm_profile_stop();
+        profile_len = 0;
+        profile_dither = false;
+        printf("[COMMAND] Profile cleared\n");
+        return true;
+    } else if (strncmp(command, "PROFILE_ADD", 11) == 0) {
+        if (profile_armed) {
+            printf("[ERROR] Stop the profile before editing it\n");
+            return true;
+        }
+        char buf[1024];
+        strncpy(buf, command + 11, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+
+        // Entries are 'duty' (both pairs) or 'duty1:duty2'
+        uint32_t added = 0;
+        char *token = strtok(buf, " ,");
+        while (token && profile_len < PROFILE_MAX_PERIODS) {
+            float d1, d2;
+            int parsed = sscanf(token, "%f:%f", &d1, &d2);
+            if (parsed == 1) d2 = d1;
+            if (parsed >= 1 && d1 >= 0.0f && d1 <= 1.0f && d2 >= 0.0f && d2 <= 1.0f) {
+                profile_dither = false;
+                profile_duty[0][profile_len] = d1;
+                profile_duty[1][profile_len] = d2;
+                ++profile_len;
+                ++added;
+            } else {
+                printf("[ERROR] Skipping invalid profile entry '%s'\n", token);
+            }
+            token = strtok(NULL, " ,");
+        }
+        if (token) {
+            printf("[ERROR] Profile full at %u periods, rest of line dropped\n", PROFILE_MAX_PERIODS);
+        }
+        printf("[COMMAND] Added %lu periods, profile now %lu periods\n",
+               (unsigned long)added, (unsigned long)profile_len);
+        return true;
+    } else if (strncmp(command, "PROFILE_SINE", 12) == 0) {
+        unsigned long periods;
+        float center, amplitude, pair2_deg = 0.0f;
+        int parsed = sscanf(command + 12, "%lu %f %f %f", &periods, &center, &amplitude, &pair2_deg);
+        if (parsed < 3 || periods == 0 || periods > PROFILE_MAX_PERIODS) {
+            printf("[ERROR] Usage: PROFILE_SINE <periods 1-%u> <center> <amplitude> [pair2_phase_deg]\n",
+                   PROFILE_MAX_PERIODS);
+            return true;
+        }
+        if (profile_armed) {
+            printf("[ERROR] Stop the profile before editing it\n");
+            return true;
+        }
+        const float shift = pair2_deg * (float)M_PI / 180.0f;
+        for (uint32_t k = 0; k < periods; ++k) {
+            float angle = 2.0f * (float)M_PI * (float)k / (float)periods;
+            for (int p = 0; p < 2; ++p) {
+                float d = center + amplitude * sinf(angle - (p ? shift : 0.0f));
+                profile_duty[p][k] = d < 0.0f ? 0.0f : (d > 1.0f ? 1.0f : d);
+            }
+        }
+        profile_len = periods;
+        profile_dither = false;
+        printf("[COMMAND] Sine profile: %lu periods, %.3f +/- %.3f, pair 2 lagging %.1f deg\n",
+               periods, center, amplitude, pair2_deg);
+        return true;
+    } else if (strcmp(command, "PROFILE_ARM") == 0) {
+        pwm_profile_arm();
+        return true;
+    } else if (strcmp(command, "PROFILE_STOP") == 0) {
+        if (!profile_armed) {
+            printf("[INFO] No profile armed\n");
+        }
+        pwm_profile_stop();
+        return true;
+    } else if (strcmp(command, "PROFILE_STATUS") == 0) {
+        print_pwm_profile_status();
+        return true;
+    }
+    return false;
+}
+
+// Duty dithering. The chain SMs set pulse width in 2-cycle high counts, so at
+// a few hundred cycles per period one count is a coarse duty step. A first-order
+// sigma-delta over a loop of periods picks floor/floor+1 counts so the loop
+// average lands within half a count / periods of the request, and the result is
+// streamed like any other profile.
+static void profile_fill_dither(uint32_t periods, uint32_t period_cycles,
+                                float duty_cycle_pair1, float duty_cycle_pair2) {
+    const float duty[2] = {duty_cycle_pair1, duty_cycle_pair2};
+    for (int p = 0; p < 2; ++p) {
+        double ideal = ((double)duty[p] * period_cycles - PHASE_PWM_PULSE_FIXED_CYCLES) / 2.0;
+        if (ideal < 0.0) ideal = 0.0;
+        const uint32_t base = (uint32_t)ideal;
+        const double frac = ideal - base;
+        double acc = 0.5;   // Centre the error so the pattern is symmetric
+        for (uint32_t k = 0; k < periods; ++k) {
+            acc += frac;
+            uint32_t high = base;
+            if (acc >= 1.0) {
+                acc -= 1.0;
+                ++high;
+            }
+            // Exact pulse length, so duty_to_high_count() gives back this count
+            profile_duty[p][k] = (float)(2 * high + PHASE_PWM_PULSE_FIXED_CYCLES) / (float)period_cycles;
+        }
+    }
+    profile_len = periods;
+}
+
+bool pwm_dither_start(uint32_t periods) {
+    if (periods < 2 || periods > PROFILE_MAX_PERIODS) {
+        printf("[ERROR] Dither loop must be 2-%u periods\n", PROFILE_MAX_PERIODS);
+        return false;
+    }
+    if (profile_armed) {
+        pwm_profile_stop();
+    }
+    profile_fill_dither(periods, current_period_cycles, current_duty_cycle, current_duty_cycle_pair2);
+    profile_dither = true;
+    if (!pwm_profile_arm()) {
+        profile_dither = false;
+        return false;
+    }
+    printf("[DATA] freq_hz,period_cycles,clkdiv,step_pct,loop,dither_step_pct,worst_err_pct,bits,dither_bits\n");
+    print_dither_resolution(current_frequency, periods);
+    return true;
+}
+
+// Achieved duty resolution at one frequency, plain and dithered over `periods`.
+void print_dither_resolution(float frequency, uint32_t periods) {
+    uint32_t counts;
+    uint16_t div_int;
+    uint8_t div_frac;
+    if (!compute_best_timing(clock_get_hz(clk_sys), frequency, 2, PHASE_PWM_LEADER_FIXED_CYCLES, &counts, &div_int,
+                             &div_frac)) {
+        printf("%.0f,no timing\n", frequency);
+        return;
+    }
+    const uint32_t period_cycles = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+    const double step = 2.0 / period_cycles;                 // One high count
+    const double dithered = step / periods;
+
+    // Worst realised error for the pair 1 duty over the loop
+    double worst = 0.0;
+    for (int n = 1; n < 200; ++n) {
+        const double d = n / 200.0;
+        double ideal = (d * period_cycles - PHASE_PWM_PULSE_FIXED_CYCLES) / 2.0;
+        if (ideal < 0.0) continue;
+        const double frac = ideal - (uint32_t)ideal;
+        double acc = 0.5, sum = 0.0;
+        for (uint32_t k = 0; k < periods; ++k) {
+            acc += frac;
+            if (acc >= 1.0) { acc -= 1.0; sum += 1.0; }
+        }
+        const double err = absolute(sum / periods - frac) * step;
+        if (err > worst) worst = err;
+    }
+
+    printf("[DATA] %.0f,%lu,%u+%u/256,%.4f,%lu,%.5f,%.5f,%.1f,%.1f\n", frequency,
+           (unsigned long)period_cycles, div_int, div_frac, 100.0 * step, (unsigned long)periods,
+           100.0 * dithered, 100.0 * worst, log2(1.0 / step), log2(1.0 / (worst > 0.0 ? worst : dithered)));
+}
+
+void print_dither_report(uint32_t periods) {
+    static const float freqs[] = {10e3f, 50e3f, 100e3f, 200e3f, 500e3f, 750e3f, 1e6f};
+    printf("[INFO] Duty resolution, native vs sigma-delta over %lu periods:\n", (unsigned long)periods);
+    printf("[DATA] freq_hz,period_cycles,clkdiv,step_pct,loop,dither_step_pct,worst_err_pct,bits,dither_bits\n");
+    for (uint32_t i = 0; i < sizeof(freqs) / sizeof(freqs[0]); ++i) {
+        print_dither_resolution(freqs[i], periods);
+    }
+    printf("[INFO] Dither ripple repeats at freq/loop; longer loops trade ripple frequency for resolution\n");
+}
+
+// Frequency/duty ramps (chain engine), on the profile DMA channels. Each step is
+// a control block {hold periods, &word}: control channel i writes it into data
+// channel i's TRANS_COUNT and READ_ADDR_TRIG, and the data channel then feeds
+// the same word into SM i's FIFO once per period. A {0, 0} block is a null
+// trigger that ends the chain, leaving the SMs on the final word in X.
+static bool ramp_dma_done(void) {
+    for (int i = 0; i < 4; ++i) {
+        if (dma_channel_is_busy(profile_ctrl_chan[i]) || dma_channel_is_busy(profile_data_chan[i]) ||
+            dma_hw->ch[profile_ctrl_chan[i]].read_addr != (uintptr_t)&ramp_blocks[i][ramp_steps + 1][0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool pwm_ramp_start(float frequency, float duty_cycle_pair1, float duty_cycle_pair2, uint32_t ramp_ms) {
+    if (PWM_PHASE_COUNT != 4) {
+        printf("[ERROR] RAMP needs a four-phase build\n");
+        return false;
+    }
+    if (engine != PWM_ENGINE_CHAIN) {
+        printf("[ERROR] RAMP runs on the CHAIN engine, use PWM_ENGINE CHAIN\n");
+        return false;
+    }
+    if (profile_armed || ramp_active) {
+        printf("[ERROR] %s in progress, stop it first\n", profile_armed ? "Profile" : "Ramp");
+        return false;
+    }
+    if (frequency <= 0.0f || ramp_ms == 0) {
+        printf("[ERROR] Invalid ramp parameters\n");
+        return false;
+    }
+
+    const bool live = get_effective_pio_trigger_state();
+    const float from_freq = current_frequency;
     const uint32_t sys_clk_hz = clock_get_hz(clk_sys);
-    const float effective_freq = (float)sys_clk_hz / (clkdiv * (float)total_cycles);
-    
+    uint16_t div_int = current_div_int;
+    uint8_t div_frac = current_div_frac;
+    if (!live) {
+        // Idle: pick the divider for the lower end so both ends fit at one divider
+        uint32_t unused;
+        if (!compute_best_timing(sys_clk_hz, from_freq < frequency ? from_freq : frequency, 2,
+                                 PHASE_PWM_LEADER_FIXED_CYCLES, &unused, &div_int, &div_frac)) {
+            printf("[ERROR] No PIO timing reaches the ramp range\n");
+            return false;
+        }
+    }
+    const uint32_t div_q8 = ((uint32_t)div_int << 8) | div_frac;
+    uint32_t counts;
+    uint64_t err;
+    if (!counts_for_divider(timing_target_q16(sys_clk_hz, from_freq), div_q8, 2, PHASE_PWM_LEADER_FIXED_CYCLES,
+                            &counts, &err) ||
+        !counts_for_divider(timing_target_q16(sys_clk_hz, frequency), div_q8, 2, PHASE_PWM_LEADER_FIXED_CYCLES,
+                            &counts, &err)) {
+        printf("[ERROR] %.2f -> %.2f Hz does not fit one clock divider%s\n", from_freq, frequency,
+               live ? ", drop the trigger to re-solve it" : "");
+        return false;
+    }
+
+    // One step per PWM period when the table allows, otherwise hold each step
+    // for as many periods as its share of the ramp time
+    const float ramp_s = ramp_ms / 1000.0f;
+    const float est_periods = ramp_s * 0.5f * (from_freq + frequency);
+    uint32_t steps = est_periods < 1.0f ? 1 : (uint32_t)est_periods;
+    if (steps > RAMP_MAX_STEPS) steps = RAMP_MAX_STEPS;
+    const float step_s = ramp_s / steps;
+    const float clkdiv = (float)div_int + (float)div_frac / 256.0f;
+
+    uint32_t total_periods = 0;
+    uint32_t max_period_cycles = 0;
+    for (uint32_t j = 0; j < steps; ++j) {
+        const float x = (float)(j + 1) / (float)steps;
+        const float f = from_freq + (frequency - from_freq) * x;
+        const float d1 = current_duty_cycle + (duty_cycle_pair1 - current_duty_cycle) * x;
+        const float d2 = current_duty_cycle_pair2 + (duty_cycle_pair2 - current_duty_cycle_pair2) * x;
+        counts_for_divider(timing_target_q16(sys_clk_hz, f), div_q8, 2, PHASE_PWM_LEADER_FIXED_CYCLES, &counts, &err);
+        const uint32_t period_cycles = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+
+        uint32_t words[PWM_PHASE_COUNT];
+        if (!chain_words(counts, period_cycles, d1, d2, words, false)) {
+            return false;
+        }
+        const float f_real = (float)sys_clk_hz / (clkdiv * (float)period_cycles);
+        if (period_cycles > max_period_cycles) max_period_cycles = period_cycles;
+        uint32_t hold = round_to_uint((double)step_s * f_real);
+        if (hold == 0) hold = 1;
+        total_periods += hold;
+
+        for (int i = 0; i < 4; ++i) {
+            profile_words[i][j] = words[i];
+            ramp_blocks[i][j][0] = hold;
+            ramp_blocks[i][j][1] = (uint32_t)(uintptr_t)&profile_words[i][j];
+        }
+        if (j + 1 == steps) {
+            ramp_final_counts = counts;
+            ramp_final_period_cycles = period_cycles;
+            ramp_final_effective_freq = f_real;
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        ramp_blocks[i][steps][0] = 0;
+        ramp_blocks[i][steps][1] = 0;
+    }
+
+    profile_dma_stop();
+    if (live) {
+        // The ramp is fed like a retune: nothing may be left of the last one
+        if (!chain_commit_settle((uint32_t)(1e6f / current_effective_freq) + 1, 1)) {
+            printf("[ERROR] Last retune not committed (trigger dropped?), ramp not started\n");
+            return false;
+        }
+    } else {
+        // Queued static words are the start point anyway, X takes over until step 0 lands
+        for (int i = 0; i < 4; ++i) {
+            pio_sm_clear_fifos(pio, i);
+            pio_sm_set_clkdiv_int_frac8(pio, i, div_int, div_frac);
+        }
+        chain_clkdiv_restart();
+        current_div_int = div_int;
+        current_div_frac = div_frac;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        dma_channel_config c = dma_channel_get_default_config(profile_data_chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, i, true));
+        channel_config_set_chain_to(&c, profile_ctrl_chan[i]);
+        dma_channel_configure(profile_data_chan[i], &c, &pio->txf[i], NULL, 0, false);
+
+        c = dma_channel_get_default_config(profile_ctrl_chan[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, 3);   // TRANS_COUNT, READ_ADDR_TRIG
+        dma_channel_configure(profile_ctrl_chan[i], &c, &dma_hw->ch[profile_data_chan[i]].al3_transfer_count,
+                              ramp_blocks[i], 2, false);
+    }
+
+    ramp_steps = steps;
+    ramp_from_frequency = from_freq;
+    ramp_from_duty[0] = current_duty_cycle;
+    ramp_from_duty[1] = current_duty_cycle_pair2;
+    ramp_to_frequency = frequency;
+    ramp_to_duty[0] = duty_cycle_pair1;
+    ramp_to_duty[1] = duty_cycle_pair2;
+    ramp_period_us = (uint32_t)(clkdiv * (float)max_period_cycles * 1e6f / (float)sys_clk_hz) + 1;
+
+    // Followers first, leader last, as for a retune: the leader commits as soon
+    // as its first word lands, and a follower with nothing queued by then would
+    // keep its old word and run the whole ramp one step behind
+    dma_start_channel_mask((1u << profile_ctrl_chan[1]) | (1u << profile_ctrl_chan[2]) |
+                           (1u << profile_ctrl_chan[3]));
+    const uint64_t deadline = time_us_64() + 1000u;
+    for (int i = 1; i < 4; ++i) {
+        while (pio_sm_is_tx_fifo_empty(pio, i)) {
+            if (time_us_64() >= deadline) {
+                profile_dma_stop();
+                printf("[ERROR] Ramp DMA did not start, parameters unchanged\n");
+                return false;
+            }
+            tight_loop_contents();
+        }
+    }
+    ramp_aborted = false;
+    ramp_active = true;
+    ramp_start_us = time_us_64();
+    gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_EDGE_FALL, true);
+    dma_channel_start(profile_ctrl_chan[0]);
+
+    printf("[INFO] RAMP %.2f -> %.2f Hz, duty %.2f/%.2f -> %.2f/%.2f over %lu ms: %lu steps, %lu periods%s\n",
+           from_freq, frequency, current_duty_cycle, current_duty_cycle_pair2, duty_cycle_pair1,
+           duty_cycle_pair2, (unsigned long)ramp_ms, (unsigned long)steps, (unsigned long)total_periods,
+           live ? "" : " (starts on trigger)");
+    return true;
+}
+
+// Report a finished or aborted ramp. Called from the main loop; the ramp itself
+// runs entirely on DMA.
+void pwm_ramp_poll(void) {
+    if (!ramp_active || (!ramp_aborted && !ramp_dma_done())) {
+        return;
+    }
+    gpio_set_irq_enabled(TRIGGER_PIN, GPIO_IRQ_EDGE_FALL, false);
+    ramp_active = false;
+    const uint32_t elapsed_ms = (uint32_t)((time_us_64() - ramp_start_us) / 1000);
+
+    if (ramp_aborted) {
+        // Go back to the soft-start point so the next run doesn't start at full power.
+        // Still running, the words the DMA left queued play out first (a period each,
+        // every phase in step); parked, the restore drops them.
+        printf("[INFO] RAMP aborted after %lu ms, restoring %.2f Hz\n", (unsigned long)elapsed_ms,
+               ramp_from_frequency);
+        if (get_effective_pio_trigger_state() && !chain_commit_settle(ramp_period_us, CHAIN_FIFO_WORDS) &&
+            get_effective_pio_trigger_state()) {
+            printf("[ERROR] Queued ramp words not taken, output left mid-ramp\n");
+            return;
+        }
+        update_pwm_parameters(ramp_from_frequency, ramp_from_duty[0], ramp_from_duty[1]);
+        return;
+    }
+
+    current_counts = ramp_final_counts;
+    current_period_cycles = ramp_final_period_cycles;
+    current_effective_freq = ramp_final_effective_freq;
+    current_frequency = ramp_to_frequency;
+    current_duty_cycle = ramp_to_duty[0];
+    current_duty_cycle_pair2 = ramp_to_duty[1];
+    printf("[INFO] RAMP complete: %.2f Hz (actual: %.2f Hz), duty %.2f/%.2f, %lu ms after start\n",
+           ramp_to_frequency, ramp_final_effective_freq, ramp_to_duty[0], ramp_to_duty[1],
+           (unsigned long)elapsed_ms);
+}
+
+void pwm_ramp_stop(void) {
+    if (!ramp_active) {
+        printf("[INFO] No ramp in progress\n");
+        return;
+    }
+    // Treated like a trigger drop: back to the start point
+    profile_dma_stop();
+    ramp_aborted = true;
+    pwm_ramp_poll();
+}
+
+bool pwm_ramp_is_active(void) {
+    return ramp_active;
+}
+
+// Recompute the timing words and queue them. While the trigger is active the
+// clock divider is left alone and the new words take effect at the next period
+// boundary, so the output keeps running through the retune. When idle the
+// divider is re-solved for the best resolution at the new frequency.
+bool update_pwm_parameters(float frequency, float duty_cycle_pair1, float duty_cycle_pair2) {
+    const bool live = get_effective_pio_trigger_state();
+    if (live && profile_armed) {
+        printf("[ERROR] Profile armed: PROFILE_STOP or drop the trigger to change the base timing\n");
+        return false;
+    }
+    if (ramp_active) {
+        printf("[ERROR] RAMP in progress, wait for it or RAMP_STOP\n");
+        return false;
+    }
+    if (live && engine == PWM_ENGINE_CHAIN_OCP) {
+        // The OCP programs have no room for the commit flag, so a live retune
+        // could switch the phases in different periods
+        printf("[ERROR] CHAIN_OCP: drop the trigger to change the timing\n");
+        return false;
+    }
+    const uint32_t sys_clk_hz = clock_get_hz(clk_sys);
+    const uint32_t fixed_cycles = engine == PWM_ENGINE_TIMELINE ? 0 : chain_timing()->leader_fixed;
+    uint32_t counts;
+    uint16_t div_int = current_div_int;
+    uint8_t div_frac = current_div_frac;
+
+    if (live) {
+        uint64_t err;
+        if (frequency <= 0.0f ||
+            !counts_for_divider(timing_target_q16(sys_clk_hz, frequency), ((uint32_t)div_int << 8) | div_frac,
+                                2, fixed_cycles, &counts, &err)) {
+            printf("[ERROR] %.2f Hz is out of range at the running clock divider, parameters unchanged\n",
+                   frequency);
+            printf("[ERROR] Drop the trigger to retune across ranges\n");
+            return false;
+        }
+    } else if (!compute_best_timing(sys_clk_hz, frequency, 2, fixed_cycles, &counts, &div_int, &div_frac)) {
+        printf("[ERROR] No PIO timing reaches %.2f Hz, parameters unchanged\n", frequency);
+        return false;
+    }
+
+    const float clkdiv = (float)div_int + (float)div_frac / 256.0f;
+    const uint32_t period_cycles = 2 * counts + fixed_cycles;
+    const float effective_freq = (float)sys_clk_hz / (clkdiv * (float)period_cycles);
+
     printf("[DEBUG] ===== PWM PARAMETER CALCULATION =====\n");
     printf("[DEBUG] Target frequency: %.2f Hz\n", frequency);
     printf("[DEBUG] System clock: %lu Hz\n", sys_clk_hz);
-    printf("[DEBUG] Chosen parameters: cycles=%lu, clkdiv=%.6f\n", 
-           (unsigned long)total_cycles, clkdiv);
+    printf("[DEBUG] Chosen parameters: period=%lu cycles, clkdiv=%u+%u/256 (%.6f)%s\n", 
+           (unsigned long)period_cycles, div_int, div_frac, clkdiv, live ? " [live]" : "");
     printf("[DEBUG] Effective frequency: %.2f Hz\n", effective_freq);
-    
-    // Clear FIFOs and update clock dividers
-    for (int i = 0; i < 4; ++i) {
-        pio_sm_clear_fifos(pio, i);
-        pio_sm_set_clkdiv(pio, i, clkdiv);
-    }
-    
-    // Calculate phase shifts (in cycles)
-    float phase_period = 1.0f / frequency;  // Use original frequency for phase
-    float phase_shift = phase_period / 4.0f;  // 90 degrees
-    
-    // Configure each state machine
-    for (int i = 0; i < 4; ++i) {
-        float duty = (i % 2 == 0) ? duty_cycle_pair1 : duty_cycle_pair2;
-        
-        // Calculate timing in cycles
-        uint32_t high_cycles = round_to_uint(duty * (double)total_cycles);
-        uint32_t low_cycles = total_cycles - high_cycles;
-        uint32_t phase_cycles = round_to_uint((float)i * phase_shift * 
-                                            (float)sys_clk_hz / clkdiv);
-        
-        // Ensure minimum cycles
-        if (high_cycles < 1) high_cycles = 1;
-        if (low_cycles < 1) low_cycles = 1;
-        if (phase_cycles == 0 && i > 0) phase_cycles = 1;
 
-        printf("[DEBUG] SM%d: phase=%lu, high=%lu, low=%lu cycles (duty=%.1f%%)\n",
-               i, (unsigned long)phase_cycles, (unsigned long)high_cycles,
-               (unsigned long)low_cycles, duty * 100.0f);
+    if (engine == PWM_ENGINE_TIMELINE) {
+        float duty[4];
+        for (int i = 0; i < 4; ++i) {
+            duty[i] = phase_duty_for(i, duty_cycle_pair1, duty_cycle_pair2);
+        }
+        uint32_t words[TIMELINE_WORDS], high[4], requested[4];
+        if (!timeline_layout_words(period_cycles, phase_angle_deg, duty, dead_time_cycles, words, high, requested)) {
+            return false;
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            if (high[i] < requested[i]) {
+                printf("[INFO] Phase %d duty limited to %.1f%% by the dead time\n", i,
+                       100.0f * high[i] / period_cycles);
+            }
+        }
+        for (uint32_t k = 0; k < TIMELINE_WORDS; ++k) {
+            printf("[DEBUG] Segment %lu: pins=0x%lx for %lu cycles\n", (unsigned long)k,
+                   (unsigned long)(words[k] & 0xF),
+                   (unsigned long)(2 * (words[k] >> PHASE_TIMELINE_COUNT_SHIFT) + PHASE_TIMELINE_SEGMENT_FIXED_CYCLES));
+        }
+        for (int i = 0; i < 4; ++i) {
+            current_pulse_cycles[i] = high[i];
+        }
+        if (!live) {
+            pio_sm_set_clkdiv_int_frac8(pio, TIMELINE_SM, div_int, div_frac);
+            current_div_int = div_int;
+            current_div_frac = div_frac;
+        }
+        if (!timeline_queue(words, live, (uint32_t)(1e6f / effective_freq) + 1)) {
+            return false;
+        }
+    } else {
+        uint32_t words[PWM_PHASE_COUNT];
+        if (!chain_words(counts, period_cycles, duty_cycle_pair1, duty_cycle_pair2, words, true)) {
+            return false;
+        }
+        const chain_timing_t *t = chain_timing();
+        for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+            uint32_t high = i == 0 ? (words[0] & 0xFFFF) : (words[i] >> 16);
+            current_pulse_cycles[i] = t->high_step * high + t->pulse_fixed;
+        }
+
+        if (!live) {
+            // Idle SMs are parked on a wait, so stale words can be dropped and the
+            // dividers changed without disturbing any output. A commit flag left
+            // up by a drop goes too; the leader commits the new words on the edge.
+            for (uint i = 0; i < PWM_PHASE_COUNT; ++i) {
+                pio_sm_clear_fifos(pwm_phase_pio(i), pwm_phase_sm(i));
+                pio_sm_set_clkdiv_int_frac8(pwm_phase_pio(i), pwm_phase_sm(i), div_int, div_frac);
+            }
+            pio_interrupt_clear(pio1, PHASE_PWM_COMMIT_IRQ);
+            chain_clkdiv_restart();
+            current_div_int = div_int;
+            current_div_frac = div_frac;
+        }
 
-        // Update state machine
-        pio_sm_put_blocking(pio, i, phase_cycles);
-        pio_sm_put_blocking(pio, i, high_cycles);
-        pio_sm_put_blocking(pio, i, low_cycles);
+        if (profile_armed) {
+            // Idle here, so the tables can be rebuilt for the new period in place
+            current_counts = counts;
+            current_period_cycles = period_cycles;
+            if (profile_dither) {
+                profile_fill_dither(profile_len, period_cycles, duty_cycle_pair1, duty_cycle_pair2);
+            }
+            if (!profile_build_words()) {
+                pwm_profile_stop();
+                return false;
+            }
+            profile_dma_rewind();
+            printf("[INFO] Profile rebuilt for the new period\n");
+        } else {
+            // Followers first, leader last: the followers' words wait in their
+            // FIFOs until the leader commits its own at the top of a period, so
+            // every phase switches in the same period
+            if (live && !chain_commit_settle((uint32_t)(1e6f / effective_freq) + 1, 1)) {
+                printf("[ERROR] Last retune not committed (trigger dropped?), parameters unchanged\n");
+                return false;
+            }
+            for (int i = PWM_PHASE_COUNT - 1; i >= 0; --i) {
+                pio_sm_put_blocking(pwm_phase_pio(i), pwm_phase_sm(i), words[i]);
+            }
+        }
     }
     
+    current_counts = counts;
+    current_period_cycles = period_cycles;
+    current_effective_freq = effective_freq;
     current_frequency = frequency;
     current_duty_cycle = duty_cycle_pair1;
+    current_duty_cycle_pair2 = duty_cycle_pair2;
     
     printf("[INFO] PWM updated: %.2f Hz (actual: %.2f Hz)\n", 
            frequency, effective_freq);
+    return true;
 }
 
-void set_manual_pio_trigger(bool state) {
+// On-target timing regression: drive the trigger from the debug output, run a
+// grid of operating points and measure what actually comes out of the pins.
+// GPIO inputs reach every peripheral whatever their function, so two PWM slices
+// in input mode can watch the PIO-driven phase 1 and 3 pins: one integrates the
+// HIGH time of GPIO 3, the other counts rising edges on GPIO 5. Both pins are
+// pair 2, so they share duty and frequency. Each point is compared against the
+// cycle-count model, i.e. what the words were meant to produce.
+#define SELFTEST_HIGH_DIV       64u         // HIGH-time counter prescale, sys clocks
+#define SELFTEST_MAX_WINDOW_US  100000u
+
+static bool pwm_selftest_point(float frequency, float duty, uint32_t *failures) {
+    const uint slice_high = pwm_gpio_to_slice_num(PWM_PINS[1]);
+    const uint slice_edges = pwm_gpio_to_slice_num(PWM_PINS[3]);
+    const uint32_t sys_hz = clock_get_hz(clk_sys);
+
+    set_manual_pio_trigger(false);
+    if (!update_pwm_parameters(frequency, duty, duty)) {
+        printf("[DATA] %.0f,%.3f,,,,,,SKIP\n", frequency, duty);
+        return false;
+    }
+    const float expected_freq = current_effective_freq;
+    const float expected_duty = (float)current_pulse_cycles[1] / (float)current_period_cycles;
+
+    // Stay inside both 16-bit counters: <60000 edges and <60000 prescaled HIGH clocks
+    uint32_t window_us = (uint32_t)(60000.0f / expected_freq * 1e6f);
+    const uint32_t high_limit_us = (uint32_t)(60000.0 * SELFTEST_HIGH_DIV / sys_hz * 1e6 /
+                                              (expected_duty > 0.01f ? expected_duty : 0.01f));
+    if (window_us > high_limit_us) window_us = high_limit_us;
+    if (window_us > SELFTEST_MAX_WINDOW_US) window_us = SELFTEST_MAX_WINDOW_US;
+
+    pwm_config c = pwm_get_default_config();
+    pwm_config_set_clkdiv_mode(&c, PWM_DIV_B_HIGH);
+    pwm_config_set_clkdiv_int(&c, SELFTEST_HIGH_DIV);
+    pwm_init(slice_high, &c, false);
+    c = pwm_get_default_config();
+    pwm_config_set_clkdiv_mode(&c, PWM_DIV_B_RISING);
+    pwm_init(slice_edges, &c, false);
+
+    set_manual_pio_trigger(true);
+    sleep_ms(2);    // Let the chain settle past its first period
+
+    pwm_set_counter(slice_high, 0);
+    pwm_set_counter(slice_edges, 0);
+    const uint64_t t0 = time_us_64();
+    pwm_set_enabled(slice_high, true);
+    pwm_set_enabled(slice_edges, true);
+    busy_wait_us_32(window_us);
+    pwm_set_enabled(slice_high, false);
+    pwm_set_enabled(slice_edges, false);
+    const uint64_t t1 = time_us_64();
+    set_manual_pio_trigger(false);
+
+    const double window_s = (double)(t1 - t0) * 1e-6;
+    const uint32_t edges = pwm_get_counter(slice_edges);
+    const uint32_t high_ticks = pwm_get_counter(slice_high);
+    const double measured_freq = edges / window_s;
+    const double measured_duty = (double)high_ticks * SELFTEST_HIGH_DIV / sys_hz / window_s;
+
+    // Tolerance: one edge and one prescaled tick of quantisation, plus 2 us of
+    // window uncertainty, plus 0.1% for everything else
+    const double freq_tol = expected_freq * (1.0 / (edges ? edges : 1) + 2e-6 / window_s + 1e-3);
+    const double duty_tol = (double)SELFTEST_HIGH_DIV / sys_hz / window_s + 2e-6 / window_s + 1e-3;
+    const bool pass = absolute(measured_freq - expected_freq) <= freq_tol &&
+                      absolute(measured_duty - expected_duty) <= duty_tol;
+    if (!pass) ++*failures;
+
+    printf("[DATA] %.0f,%.3f,%.2f,%.2f,%.5f,%.5f,%lu,%s\n", frequency, duty, expected_freq, measured_freq,
+           expected_duty, measured_duty, (unsigned long)window_us, pass ? "PASS" : "FAIL");
+    return true;
+}
+
+void pio_timing_selftest(void) {
+    static const float freqs[] = {10e3f, 50e3f, 100e3f, 200e3f, 500e3f, 1e6f};
+    static const float duties[] = {0.1f, 0.25f, 0.4f};
+
     if (!pio_debug_mode) {
-        printf("[ERROR] PIO debug mode not enabled. Use PIO_DEBUG 1 first.\n");
+        printf("[ERROR] PIO_SELFTEST drives the trigger itself: enable PIO_DEBUG 1 first\n");
         return;
     }
-    
-    // If turning trigger ON, check if FIFOs have data
-    if (state) {
-        bool any_fifo_empty = false;
-        for (int i = 0; i < 4; ++i) {
-            if (pio_sm_is_tx_fifo_empty(pio, i)) {
-                any_fifo_empty = true;
-                break;
+    if (get_effective_pio_trigger_state() || profile_armed || ramp_active) {
+        printf("[ERROR] Trigger, profile or ramp active, refusing to run self test\n");
+        return;
+    }
+
+    const float saved_freq = current_frequency;
+    const float saved_duty1 = current_duty_cycle;
+    const float saved_duty2 = current_duty_cycle_pair2;
+    uint32_t failures = 0, points = 0;
+
+    printf("[ALERT] PIO_SELFTEST switches GPIO %d-%d: keep the power stage disconnected\n",
+           PWM_PINS[0], PWM_PINS[3]);
+    printf("[DATA] target_hz,duty,expected_hz,measured_hz,expected_duty,measured_duty,window_us,result\n");
+    for (uint32_t f = 0; f < sizeof(freqs) / sizeof(freqs[0]); ++f) {
+        for (uint32_t d = 0; d < sizeof(duties) / sizeof(duties[0]); ++d) {
+            points += pwm_selftest_point(freqs[f], duties[d], &failures);
+        }
+    }
+
+    update_pwm_parameters(saved_freq, saved_duty1, saved_duty2);
+    printf("[INFO] PIO self test (%s engine): %lu/%lu points within tolerance%s\n", pwm_engine_name(engine),
+           (unsigned long)(points - failures), (unsigned long)points, failures ? " - FAILED" : "");
+}
+
+// Dead time between complementary phases (0/180 and 90/270), in PIO cycles.
+// Re-applies the current operating point so the limit takes effect at once.
+bool set_pwm_dead_time(uint32_t cycles) {
+    const uint32_t previous = dead_time_cycles;
+    dead_time_cycles = cycles;
+    if (!update_pwm_parameters(current_frequency, current_duty_cycle, current_duty_cycle_pair2)) {
+        dead_time_cycles = previous;
+        printf("[ERROR] Dead time unchanged (%lu cycles)\n", (unsigned long)previous);
+        return false;
+    }
+    print_pwm_dead_time();
+    return true;
+}
+
+void print_pwm_dead_time(void) {
+    const float pio_clk_ns = 1e9f * ((float)current_div_int + (float)current_div_frac / 256.0f) /
+                             (float)clock_get_hz(clk_sys);
+    printf("[INFO] Dead time: %lu PIO cycles (%.0f ns at clkdiv %u+%u/256)%s\n",
+           (unsigned long)dead_time_cycles, dead_time_cycles * pio_clk_ns,
+           current_div_int, current_div_frac, dead_time_cycles ? "" : " - disabled");
+}
+
+// Per-phase angle and duty. Both engines take the layout from here on every
+// retune, so it costs nothing per period. Re-applies the current operating
+// point and keeps the old layout if it can't be generated.
+bool set_pwm_phase_layout(const float angle_deg[PWM_PHASE_COUNT], const float duty[PWM_PHASE_COUNT]) {
+    float old_angle[PWM_PHASE_COUNT], old_duty[PWM_PHASE_COUNT];
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+        if (duty[i] > 1.0f || angle_deg[i] < 0.0f || angle_deg[i] >= 360.0f) {
+            printf("[ERROR] Phase %d: angle must be 0-360 degrees and duty at most 1.0\n", i);
+            return false;
+        }
+    }
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+        old_angle[i] = phase_angle_deg[i];
+        old_duty[i] = phase_duty[i];
+        phase_angle_deg[i] = angle_deg[i];
+        phase_duty[i] = duty[i] < 0.0f ? -1.0f : duty[i];
+    }
+    if (!update_pwm_parameters(current_frequency, current_duty_cycle, current_duty_cycle_pair2)) {
+        for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+            phase_angle_deg[i] = old_angle[i];
+            phase_duty[i] = old_duty[i];
+        }
+        printf("[ERROR] Phase layout unchanged\n");
+        return false;
+    }
+    print_pwm_phase_layout();
+    return true;
+}
+
+bool set_pwm_phase(int phase, float angle_deg, float duty) {
+    if (phase < 0 || phase >= PWM_PHASE_COUNT) {
+        printf("[ERROR] Phase must be 0-%d\n", PWM_PHASE_COUNT - 1);
+        return false;
+    }
+    float angle[PWM_PHASE_COUNT], d[PWM_PHASE_COUNT];
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+        angle[i] = phase_angle_deg[i];
+        d[i] = phase_duty[i];
+    }
+    angle[phase] = angle_deg;
+    d[phase] = duty;
+    return set_pwm_phase_layout(angle, d);
+}
+
+bool reset_pwm_phase_layout(void) {
+    float angle[PWM_PHASE_COUNT], duty[PWM_PHASE_COUNT];
+    phase_layout_defaults(angle, duty);
+    return set_pwm_phase_layout(angle, duty);
+}
+
+// Own duty of a phase, or -1 if it follows its pair.
+float get_pwm_phase_duty(int phase) {
+    return phase_duty[phase];
+}
+
+void print_pwm_phase_layout(void) {
+    printf("[INFO] Phase layout (%s engine, period %lu PIO cycles):\n", pwm_engine_name(engine),
+           (unsigned long)current_period_cycles);
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+        const float duty = phase_duty_for(i, current_duty_cycle, current_duty_cycle_pair2);
+        printf("[INFO]   Phase %d (PIO%u SM%u, Pin %d): %.2f deg = %lu cycles, duty %.3f%s, HIGH %lu cycles\n",
+               i, i / PWM_PHASES_PER_BANK, pwm_phase_sm(i), PWM_PINS[i], phase_angle_deg[i],
+               (unsigned long)(current_period_cycles ? phase_rise_cycles(phase_angle_deg, i, current_period_cycles) : 0),
+               duty, phase_duty[i] >= 0.0f ? "" : (pwm_phase_pair(PWM_PHASE_COUNT, i) == 0 ? " (pair 1)" : " (pair 2)"),
+               (unsigned long)current_pulse_cycles[i]);
+    }
+}
+
+// Cycle-by-cycle current limit (CHAIN_OCP). The PIO cuts the pulses by itself;
+// firmware only reads the per-phase counts and decides when to give up.
+
+// Pulses cut so far on phase `sm`. The counter SM keeps the count as ~X and
+// never pushes on its own, so one exec'd push gives a fresh value.
+static uint32_t fault_count_read(uint sm) {
+    pio_sm_exec(FAULT_COUNT_PIO, sm, pio_encode_mov_not(pio_isr, pio_x));
+    pio_sm_exec(FAULT_COUNT_PIO, sm, pio_encode_push(false, false));
+    return pio_sm_get_blocking(FAULT_COUNT_PIO, sm);
+}
+
+// Polled from the main loop next to check_overcurrent(). The odd cut pulse is
+// the limit doing its job; more than fault_trip_limit on one phase within
+// FAULT_WINDOW_MS means the fault is not clearing and the stage has to come down.
+bool pwm_fault_check(void) {
+    if (engine != PWM_ENGINE_CHAIN_OCP) {
+        return false;
+    }
+
+    uint32_t counts[4];
+    for (uint sm = 0; sm < 4; ++sm) {
+        counts[sm] = fault_count_read(sm);
+    }
+
+    const uint64_t now = time_us_64();
+    bool tripped = false;
+    if (fault_window_start_us != 0) {
+        for (uint sm = 0; sm < 4; ++sm) {
+            const uint32_t cut = counts[sm] - fault_window_base[sm];
+            if (fault_trip_limit > 0 && cut > fault_trip_limit) {
+                printf("[ALERT] Phase %u: %lu pulses cut by the current limit within %u ms\n", sm,
+                       (unsigned long)cut, FAULT_WINDOW_MS);
+                tripped = true;
             }
         }
-        
-        if (any_fifo_empty) {
-            printf("[ERROR] One or more PIO FIFOs are empty!\n");
-            printf("[ERROR] Use FREQUENCY command to refill FIFOs before triggering.\n");
-            printf("[ERROR] Example: FREQUENCY 100000\n");
-            return;
+    }
+    if (fault_window_start_us == 0 || now - fault_window_start_us >= FAULT_WINDOW_MS * 1000u) {
+        fault_window_start_us = now;
+        memcpy(fault_window_base, counts, sizeof(fault_window_base));
+    }
+    return tripped;
+}
+
+bool set_pwm_fault_limit(uint32_t trips) {
+    fault_trip_limit = trips;
+    if (trips == 0) {
+        printf("[INFO] Current limit escalation off, cut pulses are only counted\n");
+    } else {
+        printf("[INFO] Shutdown after more than %lu cut pulses on one phase within %u ms\n",
+               (unsigned long)trips, FAULT_WINDOW_MS);
+    }
+    return true;
+}
+
+void print_pwm_fault_status(void) {
+    if (engine != PWM_ENGINE_CHAIN_OCP) {
+        printf("[INFO] Cycle-by-cycle current limit off (%s engine, PWM_ENGINE CHAIN_OCP enables it)\n",
+               pwm_engine_name(engine));
+        return;
+    }
+    printf("[INFO] Cycle-by-cycle current limit on fault Pin %d (now %s):\n", FAULT_PIN,
+           gpio_get(FAULT_PIN) ? "HIGH, cutting pulses" : "LOW");
+    for (uint sm = 0; sm < 4; ++sm) {
+        printf("[INFO]   Phase %u (Pin %d): %lu pulses cut since the engine was loaded\n", sm, PWM_PINS[sm],
+               (unsigned long)fault_count_read(sm));
+    }
+    if (fault_trip_limit == 0) {
+        printf("[INFO]   Escalation off\n");
+    } else {
+        printf("[INFO]   Shutdown above %lu cut pulses per phase within %u ms\n",
+               (unsigned long)fault_trip_limit, FAULT_WINDOW_MS);
+    }
+}
+
+// Sweep 1 Hz - 1 MHz comparing the timing solver against the old brute-force
+// search. Both are scored on the frequency the SM really runs at, i.e. after the
+// brute-force float divider is truncated to 16.8 the way pio_sm_set_clkdiv() does.
+// A solve slower than TIMING_SOLVE_BUDGET_US fails the check.
+#define TIMING_SOLVE_BUDGET_US  100u
+
+void pio_timing_solver_check(void) {
+    static const float decade_steps[3] = {1.0f, 2.0f, 5.0f};
+    const uint32_t sys_hz = clock_get_hz(clk_sys);
+
+    if (get_effective_pio_trigger_state()) {
+        printf("[ERROR] PIO trigger active, refusing to run timing check\n");
+        return;
+    }
+
+    printf("[INFO] Timing solver check (reference search takes ~100 ms per point)\n");
+    printf("[DATA] target_hz,cycles,clkdiv,err_ppm,solve_us,ref_cycles,ref_clkdiv,ref_err_ppm,ref_us\n");
+
+    uint32_t worst_us = 0;
+    float worst_at = 0.0f;
+
+    for (float decade = 1.0f; decade <= 1.0e6f; decade *= 10.0f) {
+        for (int s = 0; s < 3; ++s) {
+            const float target = decade * decade_steps[s];
+            if (target > 1.0e6f) break;
+
+            uint32_t cycles = 0;
+            uint16_t div_int = 0;
+            uint8_t div_frac = 0;
+            uint64_t t0 = time_us_64();
+            bool ok = compute_best_timing(sys_hz, target, 1, 0, &cycles, &div_int, &div_frac);
+            uint32_t solve_us = (uint32_t)(time_us_64() - t0);
+            if (solve_us > worst_us) {
+                worst_us = solve_us;
+                worst_at = target;
+            }
+
+            uint32_t ref_cycles = 0;
+            float ref_div = 0.0f;
+            t0 = time_us_64();
+            compute_best_timing_bruteforce(sys_hz, target, &ref_cycles, &ref_div);
+            uint32_t ref_us = (uint32_t)(time_us_64() - t0);
+
+            double div = (double)div_int + (double)div_frac / 256.0;
+            double err_ppm = ok ? 1e6 * absolute((double)sys_hz / (div * cycles) - target) / target : -1.0;
+
+            double ref_err_ppm = -1.0;
+            double ref_div_q8 = 0.0;
+            if (ref_cycles > 0) {
+                uint32_t ref_int = (uint32_t)ref_div;
+                uint8_t ref_frac = (uint8_t)((ref_div - (float)ref_int) * 256.0f);
+                ref_div_q8 = (double)ref_int + (double)ref_frac / 256.0;
+                ref_err_ppm = 1e6 * absolute((double)sys_hz / (ref_div_q8 * ref_cycles) - target) / target;
+            }
+
+            printf("%.0f,%lu,%.4f,%.3f,%lu,%lu,%.4f,%.3f,%lu\n",
+                   target, (unsigned long)cycles, ok ? div : 0.0, err_ppm, (unsigned long)solve_us,
+                   (unsigned long)ref_cycles, ref_div_q8, ref_err_ppm, (unsigned long)ref_us);
         }
     }
+    printf("[INFO] err_ppm of -1 means no valid timing exists for that target\n");
+    if (worst_us > TIMING_SOLVE_BUDGET_US) {
+        printf("[ERROR] Timing solve took %lu us at %.0f Hz, budget %u us\n",
+               (unsigned long)worst_us, worst_at, TIMING_SOLVE_BUDGET_US);
+    } else {
+        printf("[INFO] Slowest timing solve %lu us (at %.0f Hz), budget %u us\n",
+               (unsigned long)worst_us, worst_at, TIMING_SOLVE_BUDGET_US);
+    }
+}
+
+void set_manual_pio_trigger(bool state) {
+    if (!pio_debug_mode) {
+        printf("[ERROR] PIO debug mode not enabled. Use PIO_DEBUG 1 first.\n");
+        return;
+    }
     
     printf("[DEBUG] Setting trigger pin %d to %s\n", TRIGGER_PIN, state ? "HIGH" : "LOW");
     
@@ -252,17 +1619,34 @@ void print_pio_trigger_status(void) {
         printf("  Manual trigger: %s\n", manual_pio_trigger_state ? "ACTIVE" : "INACTIVE");
     }
     printf("  Effective trigger: %s\n", effective_trigger ? "ACTIVE" : "INACTIVE");
+    printf("  PWM engine: %s\n", pwm_engine_name(engine));
+
+    // The SMs keep their first word resident while parked, so a re-trigger costs
+    // a fixed number of PIO cycles (see phase_pwm.pio) plus input synchronisation
+    const int restart_cycles = engine == PWM_ENGINE_TIMELINE ? PHASE_TIMELINE_RESTART_CYCLES
+                                                             : (int)chain_timing()->restart;
+    const float pio_clk_ns = 1e9f * ((float)current_div_int + (float)current_div_frac / 256.0f) /
+                             (float)clock_get_hz(clk_sys);
+    printf("  Restart latency: %d PIO cycles + sync = %.0f-%.0f ns (clkdiv %u+%u/256)\n",
+           restart_cycles,
+           restart_cycles * pio_clk_ns + 2e9f / (float)clock_get_hz(clk_sys),
+           (restart_cycles + 1) * pio_clk_ns + 2e9f / (float)clock_get_hz(clk_sys),
+           current_div_int, current_div_frac);
 }
 
 void debug_pio_state_machines(void) {
-    printf("[DEBUG] PIO State Machine Status:\n");
-    for (int i = 0; i < 4; ++i) {
-        bool rx_empty = pio_sm_is_rx_fifo_empty(pio, i);
-        bool tx_full = pio_sm_is_tx_fifo_full(pio, i);
-        
-        printf("  SM%d: RX_empty=%s, TX_full=%s\n", 
-               i, rx_empty ? "YES" : "NO", 
-               tx_full ? "YES" : "NO");
+    printf("[DEBUG] PIO State Machine Status (%s engine):\n", pwm_engine_name(engine));
+    const int sm_count = engine == PWM_ENGINE_TIMELINE ? 1 : PWM_PHASE_COUNT;
+    for (int i = 0; i < sm_count; ++i) {
+        PIO p = pwm_phase_pio(i);
+        const uint sm = pwm_phase_sm(i);
+        printf("  PIO%u SM%u: PC=%d, TX_level=%d (queued words not yet picked up)\n",
+               i / PWM_PHASES_PER_BANK, sm, pio_sm_get_pc(p, sm), pio_sm_get_tx_fifo_level(p, sm));
+    }
+    if (engine == PWM_ENGINE_TIMELINE) {
+        printf("  DMA ch%d: read_addr=0x%08lx, remaining=%lu\n", timeline_data_chan,
+               (unsigned long)dma_hw->ch[timeline_data_chan].read_addr,
+               (unsigned long)dma_hw->ch[timeline_data_chan].transfer_count);
     }
     printf("  Trigger Pin %d: %s\n", TRIGGER_PIN, gpio_get(TRIGGER_PIN) ? "HIGH" : "LOW");
 }
@@ -5,14 +5,73 @@
 #include "hardware/pio.h"
 #include "hardware/gpio.h"
 
-extern const uint PWM_PINS[4];
+// CHAIN: SM0-3 each drive one phase, chained through relative IRQs.
+// TIMELINE: SM0 drives all four phases from a DMA-fed pin-pattern table.
+// CHAIN_OCP: CHAIN with a cycle-by-cycle current limit on FAULT_PIN, counted
+// per phase on pio1.
+typedef enum {
+    PWM_ENGINE_CHAIN = 0,
+    PWM_ENGINE_TIMELINE,
+    PWM_ENGINE_CHAIN_OCP
+} pwm_engine_t;
+
+// Number of phase outputs, set from CMake. Phases run four to a PIO block in
+// order (pio0 SM0-3, then pio1, then pio2), so 6-12 phases need an RP2350. The
+// default layout spaces them evenly; phase i + N/2 is phase i's complementary
+// partner for dead time and pair duty.
+#ifndef PWM_PHASE_COUNT
+#define PWM_PHASE_COUNT 4
+#endif
+#if PWM_PHASE_COUNT < 4 || PWM_PHASE_COUNT > 12 || PWM_PHASE_COUNT % 2
+#error "PWM_PHASE_COUNT must be an even number from 4 to 12"
+#endif
+#define PWM_PHASES_PER_BANK 4
+#define PWM_BANKS ((PWM_PHASE_COUNT + PWM_PHASES_PER_BANK - 1) / PWM_PHASES_PER_BANK)
+
+extern const uint PWM_PINS[PWM_PHASE_COUNT];
 extern const uint TRIGGER_PIN;
+extern const uint FAULT_PIN;
+
+static inline PIO pwm_phase_pio(uint phase) {
+    return pio_get_instance(phase / PWM_PHASES_PER_BANK);
+}
+
+static inline uint pwm_phase_sm(uint phase) {
+    return phase % PWM_PHASES_PER_BANK;
+}
 
 void pwm_control_init(float frequency, float duty_cycle_pair1, float duty_cycle_pair2);
-void update_pwm_parameters(float frequency, float duty_cycle_pair1, float duty_cycle_pair2);
+bool update_pwm_parameters(float frequency, float duty_cycle_pair1, float duty_cycle_pair2);
 void set_pio_debug_mode(bool enable);
 void set_manual_pio_trigger(bool state);
 bool get_effective_pio_trigger_state(void);
 void print_pio_trigger_status(void);
 void debug_pio_state_machines(void);
+void pio_timing_solver_check(void);
+void pio_timing_selftest(void);
+bool set_pwm_engine(pwm_engine_t engine);
+pwm_engine_t get_pwm_engine(void);
+const char *pwm_engine_name(pwm_engine_t engine);
+bool pwm_profile_arm(void);
+void pwm_profile_stop(void);
+bool pwm_profile_is_armed(void);
+void pwm_profile_poll(void);
+bool process_pwm_profile_command(const char *command);
+bool pwm_ramp_start(float frequency, float duty_cycle_pair1, float duty_cycle_pair2, uint32_t ramp_ms);
+void pwm_ramp_stop(void);
+void pwm_ramp_poll(void);
+bool pwm_ramp_is_active(void);
+bool pwm_dither_start(uint32_t periods);
+void print_dither_resolution(float frequency, uint32_t periods);
+void print_dither_report(uint32_t periods);
+bool set_pwm_dead_time(uint32_t cycles);
+void print_pwm_dead_time(void);
+bool set_pwm_phase_layout(const float angle_deg[PWM_PHASE_COUNT], const float duty[PWM_PHASE_COUNT]);
+bool set_pwm_phase(int phase, float angle_deg, float duty);
+bool reset_pwm_phase_layout(void);
+float get_pwm_phase_duty(int phase);
+void print_pwm_phase_layout(void);
+bool pwm_fault_check(void);
+bool set_pwm_fault_limit(uint32_t trips);
+void print_pwm_fault_status(void);
 #endif
\ No newline at end of file
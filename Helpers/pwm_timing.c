@@ -0,0 +1,404 @@
+// pwm_timing.c
+// Timing solver and word builders for the PIO phase engines (no hardware access)
+
+#include "pwm_timing.h"
+#include "phase_pwm.pio.h"
+#include <stdio.h>
+#include <math.h>
+
+#define TIMELINE_MIN_SEGMENT    PHASE_TIMELINE_SEGMENT_FIXED_CYCLES   // Hold count of 0
+
+const chain_timing_t CHAIN_TIMING = {
+    PHASE_PWM_LEADER_FIXED_CYCLES, PHASE_PWM_PULSE_FIXED_CYCLES, 2,
+    PHASE_PWM_FOLLOWER_LINK_CYCLES, PHASE_PWM_FOLLOWER_SLACK_CYCLES, PHASE_PWM_RESTART_CYCLES,
+};
+
+const chain_timing_t CHAIN_OCP_TIMING = {
+    PHASE_PWM_OCP_LEADER_FIXED_CYCLES, PHASE_PWM_OCP_PULSE_FIXED_CYCLES, PHASE_PWM_OCP_HIGH_STEP_CYCLES,
+    PHASE_PWM_OCP_FOLLOWER_LINK_CYCLES, PHASE_PWM_OCP_FOLLOWER_SLACK_CYCLES, PHASE_PWM_OCP_RESTART_CYCLES,
+};
+
+// Required clkdiv * period product for target_freq, in Q8 divider units with
+// 8 more bits of precision.
+uint64_t timing_target_q16(uint32_t sys_hz, float target_freq) {
+    return (uint64_t)((double)sys_hz * 65536.0 / (double)target_freq + 0.5);
+}
+
+// Best loop count for a fixed divider, where one period lasts
+// cycles_per_count * counts + fixed_cycles PIO clocks. Returns false if the
+// count falls outside [PIO_MIN_COUNTS, PIO_MAX_COUNTS].
+bool counts_for_divider(uint64_t target_q16, uint32_t div_q8,
+                        uint32_t cycles_per_count, uint32_t fixed_cycles,
+                        uint32_t *out_counts, uint64_t *out_err) {
+    const uint64_t cycle_q16 = (uint64_t)div_q8 << 8;   // One PIO cycle in target_q16 units
+    const uint64_t fixed_q16 = fixed_cycles * cycle_q16;
+    if (target_q16 <= fixed_q16) {
+        return false;
+    }
+
+    const uint64_t count_q16 = cycles_per_count * cycle_q16;
+    const uint64_t counts = (target_q16 - fixed_q16 + count_q16 / 2) / count_q16;
+    if (counts < PIO_MIN_COUNTS || counts > PIO_MAX_COUNTS) {
+        return false;
+    }
+
+    const uint64_t product = counts * count_q16 + fixed_q16;
+    *out_counts = (uint32_t)counts;
+    *out_err = product > target_q16 ? product - target_q16 : target_q16 - product;
+    return true;
+}
+
+// Find the loop count and 16.8 clkdiv whose realised frequency lands closest to
+// target_freq, among periods no more than 1/2^TIMING_BAND_SHIFT shorter than
+// the longest one the SM can run at (so the duty and phase steps stay within a
+// few percent of the finest) and the TIMING_DIV_SPAN smallest dividers that
+// reach them. Each divider is tried with the two counts either side of its
+// ideal period, so a call costs at most TIMING_DIV_SPAN 64-bit divides.
+//
+// Above the frequency where the count hits PIO_MAX_COUNTS the band holds fewer
+// than 20 dividers, so the span covers all of it. Below, the count stays near
+// PIO_MAX_COUNTS and any divider is within half a count of its ideal period,
+// i.e. within 1 / (2 * 61440) = 8 ppm, before the best of the span is taken.
+// tests/test_timing_solver.cpp checks the result against a search over every
+// count. Ties go to the longer period.
+bool compute_best_timing(uint32_t sys_hz, float target_freq,
+                         uint32_t cycles_per_count,
+                         uint32_t fixed_cycles,
+                         uint32_t *out_counts,
+                         uint16_t *out_div_int,
+                         uint8_t *out_div_frac) {
+    if (target_freq <= 0.0f) {
+        return false;
+    }
+
+    // Longest period: the first one longer than the cycles at divider 1.0, as
+    // every longer one only runs slower
+    const uint64_t target_q16 = timing_target_q16(sys_hz, target_freq);
+    const uint64_t cycles_at_div1 = target_q16 >> 16;
+    if (cycles_at_div1 <= fixed_cycles) {
+        return false;
+    }
+    uint64_t top = (cycles_at_div1 - fixed_cycles) / cycles_per_count + 1;
+    if (top > PIO_MAX_COUNTS) top = PIO_MAX_COUNTS;
+    if (top < PIO_MIN_COUNTS) {
+        return false;
+    }
+    uint32_t bottom = (uint32_t)(top - (top >> TIMING_BAND_SHIFT));
+    if (bottom < PIO_MIN_COUNTS) bottom = PIO_MIN_COUNTS;
+
+    // Dividers from the one that puts the ideal period at the top of the band
+    // to the one that puts it just below the bottom
+    const uint64_t top_q16 = (uint64_t)(cycles_per_count * (uint32_t)top + fixed_cycles) << 8;
+    const uint64_t bottom_q16 = (uint64_t)(cycles_per_count * bottom + fixed_cycles) << 8;
+    uint64_t div_first = target_q16 / top_q16;
+    if (div_first < PIO_CLKDIV_MIN_Q8) div_first = PIO_CLKDIV_MIN_Q8;
+    uint64_t div_last = target_q16 / bottom_q16 + 1;
+    if (div_last > div_first + TIMING_DIV_SPAN - 1) div_last = div_first + TIMING_DIV_SPAN - 1;
+    if (div_last > PIO_CLKDIV_MAX_Q8) div_last = PIO_CLKDIV_MAX_Q8;
+
+    uint64_t best_err = UINT64_MAX;
+    uint32_t best_counts = 0;
+    uint32_t best_div_q8 = 0;
+
+    for (uint64_t div_q8 = div_first; div_q8 <= div_last && best_err != 0; ++div_q8) {
+        const uint64_t div_q16 = div_q8 << 8;
+        const uint64_t ideal = target_q16 / div_q16;     // Period in PIO cycles, rounded down
+        uint32_t below = ideal > fixed_cycles ? (uint32_t)((ideal - fixed_cycles) / cycles_per_count) : 0;
+        for (uint32_t counts = below; counts <= below + 1; ++counts) {
+            const uint32_t c = counts < bottom ? bottom : counts > top ? (uint32_t)top : counts;
+            const uint64_t product = div_q16 * (cycles_per_count * c + fixed_cycles);
+            const uint64_t err = product > target_q16 ? product - target_q16 : target_q16 - product;
+            if (err < best_err || (err == best_err && c > best_counts)) {
+                best_err = err;
+                best_counts = c;
+                best_div_q8 = (uint32_t)div_q8;
+            }
+        }
+    }
+
+    if (best_counts == 0) {
+        return false;
+    }
+
+    *out_counts = best_counts;
+    *out_div_int = (uint16_t)(best_div_q8 >> 8);
+    *out_div_frac = (uint8_t)(best_div_q8 & 0xFF);
+    return true;
+}
+
+// Original exhaustive search, kept only as the reference for PIO_TIMING_CHECK.
+// Walks every cycle count in double precision (tens of ms per call on target).
+void compute_best_timing_bruteforce(uint32_t sys_hz, float target_freq,
+                                    uint32_t *out_total_cycles,
+                                    float *out_clkdiv) {
+    const uint32_t MAX_CYCLES = 65535;  // Maximum reasonable cycle count
+    const double MIN_DIV = 1.0;         // Minimum clock divider
+    const double MAX_DIV = 256.0;       // Maximum clock divider
+
+    double best_err = 1e12;
+    uint32_t best_cycles = 0;
+    double best_div = 1.0;
+
+    // Try different cycle counts, preferring larger values for better resolution
+    for (uint32_t cycles = MAX_CYCLES; cycles >= 100; cycles--) {
+        // Calculate required divider for this cycle count
+        double div = (double)sys_hz / ((double)target_freq * (double)cycles);
+
+        if (div >= MIN_DIV && div <= MAX_DIV) {
+            // Calculate actual frequency with these parameters
+            double actual = (double)sys_hz / (div * (double)cycles);
+            double err = absolute(actual - target_freq);
+
+            if (err < best_err) {
+                best_err = err;
+                best_cycles = cycles;
+                best_div = div;
+            }
+        }
+    }
+
+    *out_total_cycles = best_cycles;
+    *out_clkdiv = (float)best_div;
+}
+
+// Requested rise of phase i in PIO cycles after phase 0's, in [0, period_cycles).
+uint32_t phase_rise_cycles(const float angle_deg[], int i, uint32_t period_cycles) {
+    double angle = fmod((double)angle_deg[i] - angle_deg[0], 360.0);
+    if (angle < 0.0) angle += 360.0;
+    return round_to_uint(angle * period_cycles / 360.0) % period_cycles;
+}
+
+// Convert a duty cycle into a chain high count for a period of period_cycles,
+// capped at max_count.
+uint32_t duty_to_high_count(const chain_timing_t *t, float duty, uint32_t period_cycles, uint32_t max_count) {
+    double pulse_cycles = (double)duty * (double)period_cycles - t->pulse_fixed;
+    uint32_t high = pulse_cycles > 0.0 ? round_to_uint(pulse_cycles / t->high_step) : 0;
+    return high > max_count ? max_count : high;
+}
+
+// Chain engine: one packed word per SM, see phase_pwm.pio for the layout.
+// duty[] is per phase, already resolved from the pair duties.
+bool chain_build_words(const chain_timing_t *t, int phase_count, uint32_t counts, uint32_t period_cycles,
+                       const float angle_deg[], const float duty[], uint32_t dead_time_cycles,
+                       uint32_t words[], bool verbose) {
+    const uint32_t high_per_count = t->high_step / 2;    // Leader counts one high step as this many
+    // Follower delays count in 2-cycle steps, so each rise is placed against the
+    // actual (not ideal) position of the previous one and the errors don't stack
+    uint32_t rise[PWM_TIMING_MAX_PHASES] = {0};
+    uint32_t delay[PWM_TIMING_MAX_PHASES] = {0};
+    for (int i = 1; i < phase_count; ++i) {
+        uint32_t phase = phase_rise_cycles(angle_deg, i, period_cycles);
+        if (phase < rise[i - 1] + t->follower_link) {
+            printf("[ERROR] Phase %d must rise at least %lu PIO cycles after phase %d (period %lu cycles): "
+                   "the phase chain needs ascending angles\n", i, (unsigned long)t->follower_link, i - 1,
+                   (unsigned long)period_cycles);
+            return false;
+        }
+        delay[i] = (phase - rise[i - 1] - t->follower_link + 1) / 2;
+        rise[i] = rise[i - 1] + 2 * delay[i] + t->follower_link;
+    }
+
+    for (int i = 0; i < phase_count; ++i) {
+        uint32_t high = duty_to_high_count(t, duty[i], period_cycles, counts / high_per_count);
+
+        if (dead_time_cycles > 0) {
+            // Fall at least dead_time_cycles before the complementary phase rises
+            uint32_t gap = (rise[pwm_phase_partner(phase_count, i)] + period_cycles - rise[i]) % period_cycles;
+            if (gap < dead_time_cycles + t->pulse_fixed) {
+                printf("[ERROR] Dead time of %lu cycles leaves no pulse for phase %d\n",
+                       (unsigned long)dead_time_cycles, i);
+                return false;
+            }
+            uint32_t max_high = (gap - dead_time_cycles - t->pulse_fixed) / t->high_step;
+            if (high > max_high) {
+                high = max_high;
+                if (verbose) {
+                    printf("[INFO] Phase %d duty limited to %.1f%% by the dead time\n", i,
+                           100.0f * (t->high_step * high + t->pulse_fixed) / period_cycles);
+                }
+            }
+        }
+
+        if (i == 0) {
+            words[0] = ((counts - high_per_count * high) << 16) | high;
+        } else {
+            // A follower must be back waiting before its predecessor rises again
+            uint32_t max_high = (period_cycles - t->follower_slack - 2 * delay[i]) / t->high_step;
+            if (high > max_high) {
+                high = max_high;
+                if (verbose) {
+                    printf("[INFO] Phase %d duty limited to %.1f%% by the phase chain\n", i,
+                           100.0f * (t->high_step * high + t->pulse_fixed) / period_cycles);
+                }
+            }
+            words[i] = (high << 16) | delay[i];
+        }
+    }
+
+    for (int i = 0; verbose && i < phase_count; ++i) {
+        printf("[DEBUG] Phase %d: word=0x%08lx (%s=%lu, %s=%lu)\n", i, (unsigned long)words[i],
+               i == 0 ? "high" : "delay", (unsigned long)(words[i] & 0xFFFF),
+               i == 0 ? "low" : "high", (unsigned long)(words[i] >> 16));
+    }
+    return true;
+}
+
+// Timeline engine: cut one period into segments at every phase edge and record
+// which pins are high in each. rise[] and high[] are in PIO cycles, all even.
+bool timeline_build_words(uint32_t period_cycles, const uint32_t rise[4],
+                          const uint32_t high[4], uint32_t words[TIMELINE_WORDS]) {
+    uint32_t edges[1 + 2 * 4];
+    uint32_t n_edges = 0;
+    edges[n_edges++] = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (high[i] == 0 || high[i] >= period_cycles) continue;    // Constant pin
+        edges[n_edges++] = rise[i] % period_cycles;
+        edges[n_edges++] = (rise[i] + high[i]) % period_cycles;
+    }
+
+    // Insertion sort, dropping duplicates (coincident edges share a segment)
+    uint32_t n_unique = 0;
+    for (uint32_t i = 0; i < n_edges; ++i) {
+        uint32_t e = edges[i], j = n_unique;
+        bool dup = false;
+        for (uint32_t k = 0; k < n_unique; ++k) dup |= edges[k] == e;
+        if (dup) continue;
+        while (j > 0 && edges[j - 1] > e) { edges[j] = edges[j - 1]; --j; }
+        edges[j] = e;
+        ++n_unique;
+    }
+
+    uint8_t pattern[TIMELINE_WORDS];
+    uint32_t length[TIMELINE_WORDS];
+    uint32_t n_seg = 0;
+    uint32_t carry = 0;
+    for (uint32_t k = 0; k < n_unique; ++k) {
+        uint32_t start = edges[k];
+        uint32_t len = (k + 1 < n_unique ? edges[k + 1] : period_cycles) - start;
+        if (len < TIMELINE_MIN_SEGMENT) {
+            // Too short for one PIO segment: fold it into its neighbour, moving
+            // that single edge by one count
+            if (n_seg > 0) length[n_seg - 1] += len;
+            else carry += len;
+            continue;
+        }
+        uint8_t bits = 0;
+        for (int i = 0; i < 4; ++i) {
+            uint32_t since_rise = (start + period_cycles - rise[i] % period_cycles) % period_cycles;
+            if (high[i] >= period_cycles || since_rise < high[i]) bits |= 1u << i;
+        }
+        pattern[n_seg] = bits;
+        length[n_seg] = len + carry;
+        carry = 0;
+        ++n_seg;
+    }
+    if (n_seg == 0) {
+        printf("[ERROR] Period of %lu PIO cycles too short for the timeline\n",
+               (unsigned long)period_cycles);
+        return false;
+    }
+
+    // The DMA moves a fixed number of words per period, so split the longest
+    // segments (same pattern twice, no visible edge) until there are enough
+    while (n_seg < TIMELINE_WORDS) {
+        uint32_t longest = 0;
+        for (uint32_t k = 1; k < n_seg; ++k) {
+            if (length[k] > length[longest]) longest = k;
+        }
+        if (length[longest] < 2 * TIMELINE_MIN_SEGMENT) {
+            printf("[ERROR] Period of %lu PIO cycles too short for the timeline\n",
+                   (unsigned long)period_cycles);
+            return false;
+        }
+        for (uint32_t k = n_seg; k > longest + 1; --k) {
+            pattern[k] = pattern[k - 1];
+            length[k] = length[k - 1];
+        }
+        uint32_t half = (length[longest] / 4) * 2;
+        pattern[longest + 1] = pattern[longest];
+        length[longest + 1] = length[longest] - half;
+        length[longest] = half;
+        ++n_seg;
+    }
+
+    for (uint32_t k = 0; k < TIMELINE_WORDS; ++k) {
+        uint32_t count = (length[k] - PHASE_TIMELINE_SEGMENT_FIXED_CYCLES) / 2;
+        words[k] = (count << PHASE_TIMELINE_COUNT_SHIFT) | (k == 0 ? 1u << PHASE_TIMELINE_PATTERN_BITS : 0) |
+                   pattern[k];
+    }
+    return true;
+}
+
+// Smallest gap in PIO cycles from pin a going LOW to pin b going HIGH in a built
+// timeline, or 0 if they are ever HIGH together. Checked on the final words so
+// segment folding can't hide a dead-time violation.
+uint32_t timeline_min_gap(const uint32_t words[TIMELINE_WORDS], uint32_t period_cycles, int a, int b) {
+    uint32_t start[TIMELINE_WORDS];
+    uint32_t t = 0;
+    for (uint32_t k = 0; k < TIMELINE_WORDS; ++k) {
+        start[k] = t;
+        t += 2 * (words[k] >> PHASE_TIMELINE_COUNT_SHIFT) + PHASE_TIMELINE_SEGMENT_FIXED_CYCLES;
+        if ((words[k] >> a & 1) && (words[k] >> b & 1)) return 0;
+    }
+
+    uint32_t gap = UINT32_MAX;
+    for (uint32_t k = 0; k < TIMELINE_WORDS; ++k) {
+        uint32_t prev = words[(k + TIMELINE_WORDS - 1) % TIMELINE_WORDS];
+        if (!((prev >> a & 1) && !(words[k] >> a & 1))) continue;     // a falls at start[k]
+        for (uint32_t j = 0; j < TIMELINE_WORDS; ++j) {
+            uint32_t m = (k + j) % TIMELINE_WORDS;
+            uint32_t before = words[(m + TIMELINE_WORDS - 1) % TIMELINE_WORDS];
+            if (!(before >> b & 1) && (words[m] >> b & 1)) {
+                uint32_t g = (start[m] + period_cycles - start[k]) % period_cycles;
+                if (g < gap) gap = g;
+                break;
+            }
+        }
+    }
+    return gap;
+}
+
+// Full timeline for one operating point: phases on the 2-cycle grid the
+// timeline counts in, pulses cut back for the dead time, then re-checked on the
+// finished table because folding a sub-4-cycle segment moves an edge by 2
+// cycles. high[] gets the pulse each phase ends up with, requested[] the one
+// it asked for.
+bool timeline_layout_words(uint32_t period_cycles, const float angle_deg[4], const float duty[4],
+                           uint32_t dead_time_cycles, uint32_t words[TIMELINE_WORDS], uint32_t high[4],
+                           uint32_t requested[4]) {
+    uint32_t rise[4];
+    for (int i = 0; i < 4; ++i) {
+        rise[i] = (2 * round_to_uint(phase_rise_cycles(angle_deg, i, period_cycles) / 2.0)) % period_cycles;
+        high[i] = 2 * round_to_uint((double)duty[i] * period_cycles / 2.0);
+        if (high[i] > period_cycles) high[i] = period_cycles;
+        requested[i] = high[i];
+    }
+    if (dead_time_cycles > 0) {
+        // Fall at least dead_time_cycles before the complementary phase rises,
+        // rounded down onto the 2-cycle grid
+        for (int i = 0; i < 4; ++i) {
+            uint32_t gap = (rise[(i + 2) % 4] + period_cycles - rise[i]) % period_cycles;
+            uint32_t max_high = gap > dead_time_cycles ? (gap - dead_time_cycles) & ~1u : 0;
+            if (high[i] > max_high) high[i] = max_high;
+        }
+    }
+
+    bool trimmed;
+    do {
+        if (!timeline_build_words(period_cycles, rise, high, words)) {
+            return false;
+        }
+        trimmed = false;
+        for (int i = 0; dead_time_cycles > 0 && i < 4; ++i) {
+            if (timeline_min_gap(words, period_cycles, i, (i + 2) % 4) >= dead_time_cycles) continue;
+            if (high[i] == 0) {
+                printf("[ERROR] Dead time of %lu cycles cannot be met at this period\n",
+                       (unsigned long)dead_time_cycles);
+                return false;
+            }
+            high[i] -= 2;
+            trimmed = true;
+        }
+    } while (trimmed);
+    return true;
+}
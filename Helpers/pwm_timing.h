@@ -0,0 +1,79 @@
+#ifndef PWM_TIMING_H
+#define PWM_TIMING_H
+
+// Cycle arithmetic for the PIO phase engines: clock divider solver, chain word
+// packing and timeline tables. Plain C with no SDK calls, so the host tests in
+// tests/ build it unchanged and feed its words to the PIO simulator.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PWM_TIMING_MAX_PHASES   12
+
+// PIO clock dividers are 16.8 fixed point (integer + fractional/256), so the
+// timing solver works in 1/256ths of a system clock and never has to round a
+// float divider the way pio_sm_set_clkdiv() would.
+#define PIO_CLKDIV_MIN_Q8     (1u << 8)                 // 1.0
+#define PIO_CLKDIV_MAX_Q8     ((65535u << 8) | 0xFFu)   // 65535 + 255/256
+#define PIO_MIN_COUNTS        32u
+#define PIO_MAX_COUNTS        65535u
+#define TIMING_BAND_SHIFT     4u    // Periods searched: the longest usable one down to 1 - 1/2^shift of it
+#define TIMING_DIV_SPAN       32u   // Dividers searched: the smallest that reaches the band and the next span - 1
+
+// Timeline engine: one period of pin patterns per buffer
+#define TIMELINE_WORDS          8u      // 4 rises + 4 falls at most
+
+// Cycle model of the chain programs, see phase_pwm.pio. The OCP variant counts
+// its high time in 4-cycle steps to make room for the fault sample.
+typedef struct {
+    uint32_t leader_fixed;      // Leader period = 2 * counts + leader_fixed
+    uint32_t pulse_fixed;       // High time = high_step * high + pulse_fixed
+    uint32_t high_step;
+    uint32_t follower_link;
+    uint32_t follower_slack;
+    uint32_t restart;
+} chain_timing_t;
+
+extern const chain_timing_t CHAIN_TIMING;
+extern const chain_timing_t CHAIN_OCP_TIMING;
+
+static inline double absolute(double x) {
+    return x < 0.0 ? -x : x;
+}
+
+static inline uint32_t round_to_uint(double x) {
+    return (uint32_t)(x + 0.5);
+}
+
+// Phases alternate pair 1/pair 2 within each half, so phase i and its
+// complementary partner i + N/2 share a pair duty.
+static inline int pwm_phase_pair(int phase_count, int i) {
+    return (i % (phase_count / 2)) % 2;
+}
+
+static inline int pwm_phase_partner(int phase_count, int i) {
+    return (i + phase_count / 2) % phase_count;
+}
+
+uint64_t timing_target_q16(uint32_t sys_hz, float target_freq);
+bool counts_for_divider(uint64_t target_q16, uint32_t div_q8, uint32_t cycles_per_count, uint32_t fixed_cycles,
+                        uint32_t *out_counts, uint64_t *out_err);
+bool compute_best_timing(uint32_t sys_hz, float target_freq, uint32_t cycles_per_count, uint32_t fixed_cycles,
+                         uint32_t *out_counts, uint16_t *out_div_int, uint8_t *out_div_frac);
+void compute_best_timing_bruteforce(uint32_t sys_hz, float target_freq, uint32_t *out_total_cycles,
+                                    float *out_clkdiv);
+
+uint32_t phase_rise_cycles(const float angle_deg[], int i, uint32_t period_cycles);
+uint32_t duty_to_high_count(const chain_timing_t *t, float duty, uint32_t period_cycles, uint32_t max_count);
+bool chain_build_words(const chain_timing_t *t, int phase_count, uint32_t counts, uint32_t period_cycles,
+                       const float angle_deg[], const float duty[], uint32_t dead_time_cycles,
+                       uint32_t words[], bool verbose);
+
+bool timeline_build_words(uint32_t period_cycles, const uint32_t rise[4], const uint32_t high[4],
+                          uint32_t words[TIMELINE_WORDS]);
+uint32_t timeline_min_gap(const uint32_t words[TIMELINE_WORDS], uint32_t period_cycles, int a, int b);
+bool timeline_layout_words(uint32_t period_cycles, const float angle_deg[4], const float duty[4],
+                           uint32_t dead_time_cycles, uint32_t words[TIMELINE_WORDS], uint32_t high[4],
+                           uint32_t requested[4]);
+
+#endif
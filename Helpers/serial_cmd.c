@@ -15,22 +15,61 @@ void print_help(void) {
     printf("[COMMAND] \n");
     printf("Available commands:\n");
     printf("  FREQ <frequency> <duty_cycle1> <duty_cycle2> - Set frequency and duty cycles\n");
+    printf("  RAMP <ms> <frequency> <duty1> [duty2] - Sweep to a new operating point over <ms>\n");
+    printf("  RAMP_STOP                       - Abort a ramp and return to its start point\n");
     printf("  TC_ON 0|1                       - Toggle thermocouple auto print\n");
     printf("  TC_CSV                          - Print thermocouple log as CSV\n");
     printf("  TC_NOW                          - Print current thermocouple data\n");
     printf("  TC_PICO                         - Print onboard temperature\n");
-    printf("  DC_STEP <duration> CH1 <duties> CH2 <duties> - Quick discharge setup\n");
-    printf("  DC_CSV <step_duration>          - Start CSV discharge input mode\n");
+    printf("  DC_STEP <duration> CH1 <duties> CH2 <duties> - Quick discharge setup (ms, or 250us / 40p)\n");
+    printf("  DC_CSV <step_duration>          - Start CSV discharge input mode (ms, or 250us / 40p)\n");
     printf("  DC_CSV_END                      - End CSV input and commit sequence\n");
+    printf("  DC_ISTEP <time> CH1 <A1,..> [CH2 <A1,..>] - DC discharge current setpoints (closed loop)\n");
+    printf("  DC_CL_GAINS [<kp> <ki>]         - DC current loop gains (duty/A, duty/(A*s))\n");
+    printf("  DC_CL_RATE [<periods>]          - DC current loop update interval in PWM periods\n");
+    printf("  DC_CL_TELEM <ms>                - DC current loop telemetry interval (0 = off)\n");
+    printf("  DC_SAVE <name>                  - Save the DC discharge sequence to a flash slot\n");
+    printf("  DC_LOAD <name>                  - Load a DC discharge sequence from flash\n");
+    printf("  DC_DELETE <name>                - Delete a flash slot\n");
+    printf("  DC_LIST                         - List the flash slots\n");
+    printf("  DC_PL_CLEAR                     - Empty the DC discharge playlist\n");
+    printf("  DC_PL_ADD <name|.> [passes]     - Queue a flash slot (. = loaded sequence) n times\n");
+    printf("  DC_PL_GO [LOOP|ONCE|HOLD]       - Play the DC discharge playlist\n");
+    printf("  DC_LATENCY                      - DC discharge start latency histogram\n");
+    printf("  DC_LATENCY_RESET                - Clear the DC discharge latency histogram\n");
+    printf("  DC_LATENCY_TEST <edges>         - Measure DC discharge start latency on-chip\n");
+    printf("  DC_SEG [LOOP|ONCE|HOLD] [STEP|LINEAR|CUBIC] <d1>,<d2>,<time> ... - DC discharge segments with own lengths\n");
+    printf("  DC_END LOOP|ONCE|HOLD           - What the DC discharge does after its last step\n");
+    printf("  DC_INTERP [STEP|LINEAR|CUBIC]   - Ramp the DC discharge between steps\n");
+    printf("  DC_FREQ [<Hz>|<kHz>k]           - DC discharge switching frequency (default 50k)\n");
+    printf("  DC_PHASE [0..359]               - CH2 phase lag behind CH1 (180 = interleaved; 0/180 on a shared slice)\n");
+    printf("  DC_UPLOAD <step_duration>       - Binary discharge upload (COBS frame, CRC-32)\n");
+    printf("  DC_STREAM <step_duration>       - Stream discharge steps of any length (flow controlled)\n");
+    printf("  DC_STREAM_END                   - Mark the end of a discharge stream\n");
     printf("  DC_STATUS                       - Show current DC discharge sequence\n");
     printf("  DC_DEBUG 0|1                    - Enable/disable manual DC discharge trigger\n");
     printf("  DC_TRIGGER 0|1                  - Set manual DC discharge trigger (debug mode)\n");
     printf("  DC_TRIGGER_STATUS               - Show DC discharge trigger status\n");
     printf("  DC_INVERT 0|1                   - Toggle DC discharge output inversion\n");
+    printf("  DC_MODE [IRQ|DMA]               - DC discharge step engine (DMA: no CPU per step)\n");
     printf("  DC_VERBOSE 0|1                - Toggle step-by-step output messages\n");
     printf("  PIO_DEBUG 0|1                   - Enable/disable manual PIO trigger\n");
     printf("  PIO_TRIGGER 0|1                 - Set manual PIO trigger (debug mode)\n");
     printf("  PIO_TRIGGER_STATUS              - Show PIO trigger status\n");
+    printf("  PIO_SELFTEST                    - Measure PIO output timing on-chip (debug mode)\n");
+    printf("  PIO_TIMING_CHECK                - Compare PIO timing solver with brute-force search\n");
+    printf("  DITHER <periods>                - Sigma-delta dither the current duties (0 = off)\n");
+    printf("  DITHER_REPORT [periods]         - Print duty resolution per frequency with dithering\n");
+    printf("  DEADTIME [cycles]               - Show or set complementary-pair dead time (0 = off)\n");
+    printf("  PWM_ENGINE [CHAIN|TIMELINE|CHAIN_OCP] - Show or switch the four-phase PIO engine\n");
+    printf("  OCP_LIMIT [trips]               - Show cut-pulse counts or set the shutdown limit (0 = off)\n");
+    printf("  PHASE <n> <deg> [duty|PAIR]     - Set one phase's angle and (optionally) own duty\n");
+    printf("  PHASES <deg0> <deg1> ...        - Set every phase angle at once\n");
+    printf("  PHASE_STATUS / PHASE_RESET      - Show the phase layout / restore even spacing\n");
+    printf("  PROFILE_ADD <d[:d2],...>        - Append per-period duties to the PWM profile\n");
+    printf("  PROFILE_SINE <n> <mid> <amp> [deg] - Build an n-period sine duty profile\n");
+    printf("  PROFILE_ARM / PROFILE_STOP      - Start/stop DMA streaming of the profile\n");
+    printf("  PROFILE_STATUS / PROFILE_CLEAR  - Show or discard the profile\n");
     printf("  RELAY 0|1                       - Toggle relay state\n");
     printf("  ADC_STATUS                      - Show current voltage/current readings for ADC pins\n");
     printf("  HELP                            - Show this help message\n");
@@ -41,6 +80,12 @@ bool process_serial_commands(float *frequency, float *duty_cycle, int *auto_tc_p
     static int chars = 0;
     bool updated = false;
     
+    // A binary discharge upload reads the port itself until its frame is complete
+    if (is_discharge_upload_active()) {
+        discharge_upload_poll();
+        return false;
+    }
+    
     // Read command from serial input
     int c = getchar_timeout_us(0);
     while (c != PICO_ERROR_TIMEOUT && chars < sizeof(cmd) - 1) {
@@ -88,23 +133,25 @@ bool process_serial_commands(float *frequency, float *duty_cycle, int *auto_tc_p
                         printf("[ERROR] Invalid parameters.\n");
                         printf("[ERROR] Usage: FREQ <frequency> <duty_pair1> <duty_pair2>\n");
                     } else {
-                        *frequency = new_freq;
-                        *duty_cycle = new_duty1;  // Store first duty cycle for compatibility
-                        update_pwm_parameters(*frequency, new_duty1, new_duty2);
-                        printf("[COMMAND] Updated: Frequency = %.2f Hz, Pair1 = %.2f, Pair2 = %.2f\n", 
-                               *frequency, new_duty1, new_duty2);
-                        updated = true;
+                        if (update_pwm_parameters(new_freq, new_duty1, new_duty2)) {
+                            *frequency = new_freq;
+                            *duty_cycle = new_duty1;  // Store first duty cycle for compatibility
+                            printf("[COMMAND] Updated: Frequency = %.2f Hz, Pair1 = %.2f, Pair2 = %.2f\n", 
+                                   *frequency, new_duty1, new_duty2);
+                            updated = true;
+                        }
                     }
                 } else if (parsed == 2) {
                     // Only frequency and one duty cycle provided - use same for both pairs
                     if (new_freq <= 0 || new_freq >= 1e6 || new_duty1 < 0 || new_duty1 > 1.0) {
                         printf("[ERROR] Invalid parameters.\n");
                     } else {
-                        *frequency = new_freq;
-                        *duty_cycle = new_duty1;
-                        update_pwm_parameters(*frequency, new_duty1, new_duty1);  // Same duty for both pairs
-                        printf("[COMMAND] Updated: Frequency = %.2f Hz, Both pairs = %.2f\n", *frequency, new_duty1);
-                        updated = true;
+                        if (update_pwm_parameters(new_freq, new_duty1, new_duty1)) {  // Same duty for both pairs
+                            *frequency = new_freq;
+                            *duty_cycle = new_duty1;
+                            printf("[COMMAND] Updated: Frequency = %.2f Hz, Both pairs = %.2f\n", *frequency, new_duty1);
+                            updated = true;
+                        }
                     }
                 } else {
                     printf("[ERROR] Invalid FREQ command.\n");
@@ -113,6 +160,24 @@ bool process_serial_commands(float *frequency, float *duty_cycle, int *auto_tc_p
                     printf("[ERROR] Example: FREQ 100000 0.5 0.3\n");
                     printf("[ERROR] Example: FREQ 100000 0.5\n");
                 }
+            } else if (strcmp(cmd, "RAMP_STOP") == 0) {
+                pwm_ramp_stop();
+            } else if (strncmp(cmd, "RAMP", 4) == 0) {
+                unsigned long ramp_ms;
+                float new_freq, new_duty1, new_duty2;
+                int parsed = sscanf(cmd + 4, "%lu %f %f %f", &ramp_ms, &new_freq, &new_duty1, &new_duty2);
+                if (parsed == 3) new_duty2 = new_duty1;
+                if (parsed < 3 || ramp_ms == 0 || new_freq <= 0 || new_freq >= 1e6 ||
+                    new_duty1 < 0 || new_duty1 > 1.0 || new_duty2 < 0 || new_duty2 > 1.0) {
+                    printf("[ERROR] Invalid RAMP command.\n");
+                    printf("[ERROR] Usage: RAMP <ms> <frequency> <duty_pair1> [duty_pair2]\n");
+                    printf("[ERROR] Example: RAMP 200 100000 0.4\n");
+                } else if (pwm_ramp_start(new_freq, new_duty1, new_duty2, ramp_ms)) {
+                    // Completion is reported from the main loop; FREQ stays blocked until then
+                    *frequency = new_freq;
+                    *duty_cycle = new_duty1;
+                    printf("[COMMAND] RAMP started\n");
+                }
             } else if (strncmp(cmd, "TC_ON", 5) == 0) {
                 int tcon_val;
                 if (sscanf(cmd + 5, "%d", &tcon_val) == 1 && (tcon_val == 0 || tcon_val == 1)) {
@@ -159,6 +224,106 @@ bool process_serial_commands(float *frequency, float *duty_cycle, int *auto_tc_p
             else if (strcmp(cmd, "PIO_TRIGGER_STATUS") == 0) {
                 print_pio_trigger_status();
             }
+            else if (strcmp(cmd, "PIO_SELFTEST") == 0) {
+                pio_timing_selftest();
+            }
+            else if (strcmp(cmd, "PIO_TIMING_CHECK") == 0) {
+                pio_timing_solver_check();
+            }
+            else if (strncmp(cmd, "DITHER_REPORT", 13) == 0) {
+                unsigned long periods = 64;
+                sscanf(cmd + 13, "%lu", &periods);
+                if (periods < 2) periods = 2;
+                print_dither_report((uint32_t)periods);
+            }
+            else if (strncmp(cmd, "DITHER", 6) == 0) {
+                unsigned long periods;
+                if (sscanf(cmd + 6, "%lu", &periods) != 1) {
+                    printf("[ERROR] Invalid DITHER command. Usage: DITHER <periods> (0 = off)\n");
+                } else if (periods == 0) {
+                    pwm_profile_stop();
+                } else {
+                    pwm_dither_start((uint32_t)periods);
+                }
+            }
+            else if (strncmp(cmd, "DEADTIME", 8) == 0) {
+                long cycles;
+                int parsed = sscanf(cmd + 8, "%ld", &cycles);
+                if (parsed != 1) {
+                    print_pwm_dead_time();
+                } else if (cycles < 0 || cycles > 65535) {
+                    printf("[ERROR] Invalid DEADTIME command. Usage: DEADTIME <0-65535 PIO cycles>\n");
+                } else {
+                    set_pwm_dead_time((uint32_t)cycles);
+                }
+            }
+            else if (strncmp(cmd, "OCP_LIMIT", 9) == 0) {
+                long trips;
+                int parsed = sscanf(cmd + 9, "%ld", &trips);
+                if (parsed != 1) {
+                    print_pwm_fault_status();
+                } else if (trips < 0) {
+                    printf("[ERROR] Invalid OCP_LIMIT command. Usage: OCP_LIMIT <cut pulses per phase, 0 = off>\n");
+                } else {
+                    set_pwm_fault_limit((uint32_t)trips);
+                }
+            }
+            else if (strcmp(cmd, "PHASE_STATUS") == 0) {
+                print_pwm_phase_layout();
+            }
+            else if (strcmp(cmd, "PHASE_RESET") == 0) {
+                reset_pwm_phase_layout();
+            }
+            else if (strncmp(cmd, "PHASES", 6) == 0) {
+                float angle[PWM_PHASE_COUNT], duty[PWM_PHASE_COUNT];
+                const char *p = cmd + 6;
+                int n = 0, used;
+                while (n < PWM_PHASE_COUNT && sscanf(p, "%f%n", &angle[n], &used) == 1) {
+                    p += used;
+                    ++n;
+                }
+                if (n != PWM_PHASE_COUNT) {
+                    printf("[ERROR] Invalid PHASES command. Usage: PHASES <deg0> ... <deg%d>\n", PWM_PHASE_COUNT - 1);
+                } else {
+                    // Keep each phase's duty setting, only the angles move
+                    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
+                        duty[i] = get_pwm_phase_duty(i);
+                    }
+                    set_pwm_phase_layout(angle, duty);
+                }
+            }
+            else if (strncmp(cmd, "PHASE", 5) == 0) {
+                int phase;
+                float angle, duty = -1.0f;
+                char duty_str[16] = "PAIR";
+                int parsed = sscanf(cmd + 5, "%d %f %15s", &phase, &angle, duty_str);
+                if (parsed < 2 || (strcmp(duty_str, "PAIR") != 0 && sscanf(duty_str, "%f", &duty) != 1)) {
+                    printf("[ERROR] Invalid PHASE command. Usage: PHASE <0-%d> <deg> [duty|PAIR]\n",
+                           PWM_PHASE_COUNT - 1);
+                } else {
+                    if (parsed == 2 && phase >= 0 && phase < PWM_PHASE_COUNT) duty = get_pwm_phase_duty(phase);
+                    set_pwm_phase(phase, angle, duty);
+                }
+            }
+            else if (strncmp(cmd, "PWM_ENGINE", 10) == 0) {
+                char name[16];
+                if (sscanf(cmd + 10, "%15s", name) != 1) {
+                    printf("[INFO] PWM engine: %s\n", pwm_engine_name(get_pwm_engine()));
+                } else if (strcmp(name, "CHAIN") == 0) {
+                    set_pwm_engine(PWM_ENGINE_CHAIN);
+                } else if (strcmp(name, "TIMELINE") == 0) {
+                    set_pwm_engine(PWM_ENGINE_TIMELINE);
+                } else if (strcmp(name, "CHAIN_OCP") == 0) {
+                    set_pwm_engine(PWM_ENGINE_CHAIN_OCP);
+                } else {
+                    printf("[ERROR] Invalid PWM_ENGINE command. Usage: PWM_ENGINE [CHAIN|TIMELINE|CHAIN_OCP]\n");
+                }
+            }
+            else if (strncmp(cmd, "PROFILE_", 8) == 0) {
+                if (!process_pwm_profile_command(cmd)) {
+                    printf("[ERROR] Unknown profile command. Type HELP for help.\n");
+                }
+            }
             else if (strncmp(cmd, "RELAY", 5) == 0) {
                 int relay_state;
                 if (sscanf(cmd + 6, "%d", &relay_state) == 1 && (relay_state == 0 || relay_state == 1)) {
@@ -25,15 +25,15 @@ void shutdown(void) {
     printf("[ALERT] SYSTEM SHUTDOWN INITIATED\n");
     
     // 1. Set all PWM output pins low
-    for (int i = 0; i < 4; ++i) {
+    for (int i = 0; i < PWM_PHASE_COUNT; ++i) {
         gpio_init(PWM_PINS[i]);
         gpio_set_dir(PWM_PINS[i], GPIO_OUT);
         gpio_put(PWM_PINS[i], 0);
     }
 
-    // 2. Stop all PIO state machines (assuming 4 SMs)
-    for (int sm = 0; sm < 4; ++sm) {
-        pio_sm_set_enabled(pio0, sm, false);
+    // 2. Stop every phase state machine, on whichever PIO block it runs
+    for (uint i = 0; i < PWM_PHASE_COUNT; ++i) {
+        pio_sm_set_enabled(pwm_phase_pio(i), pwm_phase_sm(i), false);
     }
 
     // 3. Trigger external relay if used
@@ -4,17 +4,23 @@
 #include "thermocouple.h"
 #include "hardware/spi.h"
 #include "hardware/gpio.h"
-#include "hardware/adc.h"
+#include "adc_monitor.h"
 #include <stdio.h>
 
 #define SPI_PORT spi1
 
+#if NUM_THERMOCOUPLES == 4
 const uint CS_PINS[NUM_THERMOCOUPLES] = {9, 13, 14, 15};
+#else
+const uint CS_PINS[NUM_THERMOCOUPLES] = {9, 13, 14};    // GPIO 15 is a PWM phase
+#endif
 const char* TC_LABELS[NUM_THERMOCOUPLES] = {
     "BODY",            // Pin 9
     "PSU",             // Pin 13
     "INVERTER PHASE 2",// Pin 14
+#if NUM_THERMOCOUPLES == 4
     "INVERTER PHASE 1" // Pin 15
+#endif
 };
 TCLogEntry tc_log[LOG_SIZE];
 int log_head = 0;
@@ -102,15 +108,8 @@ void print_current_temperatures(void) {
 }
 
 float read_onboard_temp_c(void) {
-    static bool adc_initialized = false;
-    if (!adc_initialized) {
-        adc_init();
-        adc_set_temp_sensor_enabled(true);
-        adc_initialized = true;
-    }
-    
-    adc_select_input(4);  // Temperature sensor is on ADC4
-    const uint16_t raw = adc_read();
+    // The ADC free-runs in adc_monitor.c; the temperature sensor is one of its inputs
+    const uint16_t raw = adc_latest_raw(ADC_TEMP_INPUT);
     
     // RP2350 specific temperature conversion
     // According to datasheet:
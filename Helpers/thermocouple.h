@@ -5,7 +5,13 @@
 #include <stdbool.h>  // Add this line
 #include "pico/stdlib.h"
 
+// A 12-phase PWM build drives phase 11 on GPIO 15, the fourth chip select
+// (pwm_control.c), so that board is left out
+#if defined(PWM_PHASE_COUNT) && PWM_PHASE_COUNT > 10
+#define NUM_THERMOCOUPLES 3
+#else
 #define NUM_THERMOCOUPLES 4
+#endif
 #define LOG_SIZE 600
 #define LOG_INTERVAL_MS 100
 #define PRINT_INTERVAL_MS 1000
@@ -76,6 +76,14 @@ int main()
         
         // 1.2 Push frequency and duty cycle to PIO state machines if they are free
         // process_pio_state_machines(pio0, frequency, duty_cycle);
+
+        // 1.3 Report a finished RAMP (the ramp itself runs on DMA) and finish a
+        // profile rewind the trigger drop left to this loop
+        pwm_ramp_poll();
+        pwm_profile_poll();
+
+        // 1.4 Stream flow control and underrun reports from the discharge player
+        discharge_poll();
         
         // 2. Read thermocouples
         // 2.1 Fast overtemperature protection (read every loop)
@@ -114,6 +122,12 @@ int main()
             shutdown();
         }
 
+        // 3.1 Cycle-by-cycle limit (CHAIN_OCP engine) tripping without letting up
+        if (pwm_fault_check()) {
+            printf("[ALERT] EMERGENCY: Current limit cutting pulses continuously! Shutting down...\n");
+            shutdown();
+        }
+
         sleep_ms(5); // Adjust as needed for Core 0 loop timing
     }
 }
@@ -0,0 +1,169 @@
+// chain_rig.cpp
+// Simulated phase engines, see chain_rig.h
+
+#include "chain_rig.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifndef PIO_SOURCE_DIR
+#error "PIO_SOURCE_DIR must point at the directory holding phase_pwm.pio"
+#endif
+
+namespace rig {
+
+namespace {
+
+constexpr int kFaultCountBlock = 1;     // FAULT_COUNT_PIO
+
+// Config shared by the chain programs: output on side-set, trigger on the JMP
+// pin, 32-bit words shifted out to the right without autopull
+pio_sim::SmConfig chain_config(int pin, uint32_t clkdiv_q8) {
+    pio_sim::SmConfig c;
+    c.sideset_base = pin;
+    c.in_base = kTriggerPin;
+    c.jmp_pin = kTriggerPin;
+    c.out_shift_right = true;
+    c.autopull = false;
+    c.pull_threshold = 32;
+    c.clkdiv_q8 = clkdiv_q8;
+    return c;
+}
+
+}  // namespace
+
+const pio_sim::Source& phase_pwm_source() {
+    static const pio_sim::Source source = pio_sim::assemble_file(std::string(PIO_SOURCE_DIR) + "/phase_pwm.pio");
+    return source;
+}
+
+ChainRig::ChainRig(int phase_count, uint32_t clkdiv_q8, bool ocp) : phases(phase_count), ocp(ocp) {
+    const pio_sim::Source& src = phase_pwm_source();
+    if (phase_count < 1 || phase_count > 3 * kPhasesPerBank || (ocp && phase_count != 4)) {
+        throw std::invalid_argument("unsupported phase count");
+    }
+
+    if (ocp) {
+        // chain_ocp_engine_load()
+        const pio_sim::Program& leader = src.program("phase_pwm_ocp");
+        const pio_sim::Program& follower = src.program("phase_pwm_ocp_follower");
+        const pio_sim::Program& counter = src.program("phase_fault_count");
+        for (int sm = 0; sm < 4; ++sm) {
+            pio_sim::SmConfig c = chain_config(phase_pin(sm), clkdiv_q8);
+            c.in_base = kFaultPin;
+            c.in_count = 1;
+            if (sm == 0) m.init(0, 0, leader, c, leader.public_labels.at("wait_for_trigger"));
+            else m.init(0, sm, follower, c);
+        }
+        for (int sm = 0; sm < 4; ++sm) {
+            pio_sim::SmConfig c;
+            c.in_base = phase_pin(sm);
+            c.in_count = 1;
+            c.jmp_pin = kFaultPin;
+            m.init(kFaultCountBlock, sm, counter, c, counter.public_labels.at("watch"));
+            m.exec(kFaultCountBlock, sm, "mov x, ~null");
+            m.set_enabled(kFaultCountBlock, sm, true);
+        }
+        return;
+    }
+
+    // chain_engine_load(): pio0 SM0 leads, SM0 of pio1/pio2 bridges
+    const pio_sim::Program& leader = src.program("phase_pwm");
+    const pio_sim::Program& follower = src.program("phase_pwm_follower");
+    const pio_sim::Program& bridge = src.program("phase_pwm_bridge");
+    const int commit_irq = static_cast<int>(src.define("PHASE_PWM_COMMIT_IRQ"));
+    for (int i = 0; i < phase_count; ++i) {
+        const int block = i / kPhasesPerBank, sm = i % kPhasesPerBank;
+        pio_sim::SmConfig c = chain_config(phase_pin(i), clkdiv_q8);
+        if (i == 0) {
+            c.status_sel = pio_sim::SmConfig::Status::TxLessThan;
+            c.status_n = 1;
+            m.init(block, sm, leader, c, leader.public_labels.at("wait_for_trigger"));
+            continue;
+        }
+        // phase_pwm_commit_status(): the commit flag on the block after the leader's
+        const pio_sim::Program& p = sm == 0 ? bridge : follower;
+        c.status_sel = pio_sim::SmConfig::Status::IrqSet;
+        c.status_n = (block == 0 ? 0x10 : block == 2 ? 0x08 : 0) | commit_irq;
+        m.init(block, sm, p, c, p.wrap_target);
+    }
+}
+
+bool ChainRig::queue(const uint32_t words[]) {
+    for (int i = phases - 1; i >= 0; --i) {
+        if (!m.put(i / kPhasesPerBank, i % kPhasesPerBank, words[i])) return false;
+    }
+    return true;
+}
+
+void ChainRig::enable() {
+    uint32_t masks[pio_sim::kBlocks] = {};
+    for (int i = 0; i < phases; ++i) {
+        masks[i / kPhasesPerBank] |= 1u << (i % kPhasesPerBank);
+    }
+    m.enable_in_sync(masks);
+}
+
+void ChainRig::set_trigger(bool level) {
+    m.set_input(kTriggerPin, level);
+}
+
+uint32_t ChainRig::fault_count(int i) {
+    m.exec(kFaultCountBlock, i, "mov isr, ~x");
+    m.exec(kFaultCountBlock, i, "push noblock");
+    uint32_t count = 0;
+    if (!m.get(kFaultCountBlock, i, &count)) throw std::runtime_error("fault count not pushed");
+    return count;
+}
+
+TimelineRig::TimelineRig(uint32_t clkdiv_q8, const uint32_t words[], int word_count)
+    : ring_(words, words + word_count) {
+    // phase_timeline_program_init()
+    const pio_sim::Program& p = phase_pwm_source().program("phase_timeline");
+    pio_sim::SmConfig c;
+    c.out_base = phase_pin(0);
+    c.out_count = 4;
+    c.in_base = kTriggerPin;
+    c.jmp_pin = kTriggerPin;
+    c.out_shift_right = true;
+    c.autopull = true;
+    c.pull_threshold = 32;
+    c.join_tx = true;
+    c.clkdiv_q8 = clkdiv_q8;
+    m.init(0, 0, p, c, p.public_labels.at("park"));
+    m.set_enabled(0, 0, true);
+}
+
+void TimelineRig::run(uint64_t clocks) {
+    for (uint64_t k = 0; k < clocks; ++k) {
+        while (m.put(0, 0, ring_[next_])) next_ = (next_ + 1) % ring_.size();
+        m.step();
+    }
+}
+
+std::vector<Pulse> pulses(const pio_sim::Machine& m, int pin) {
+    std::vector<Pulse> out;
+    bool high = false;
+    uint64_t rise = 0;
+    for (const pio_sim::Edge& e : m.edges()) {
+        if (e.pin != pin) continue;
+        if (e.level) {
+            rise = e.clock;
+            high = true;
+        } else if (high) {
+            out.push_back({rise, e.clock});
+            high = false;
+        }
+    }
+    return out;
+}
+
+uint64_t first_rise_after(const pio_sim::Machine& m, int pin, uint64_t clock) {
+    for (const pio_sim::Edge& e : m.edges()) {
+        if (e.pin == pin && e.level && e.clock >= clock) return e.clock;
+    }
+    return UINT64_MAX;
+}
+
+}  // namespace rig
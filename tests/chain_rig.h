@@ -0,0 +1,81 @@
+// chain_rig.h
+// The phase engines wired up on the PIO simulator the way pwm_control.c loads
+// them: same programs, SM placement, pin config and start-up order. Phase i
+// drives GPIO kFirstPhasePin + i here rather than PWM_PINS[i]; only the timing
+// is under test.
+
+#ifndef CHAIN_RIG_H
+#define CHAIN_RIG_H
+
+#include "pio_sim.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace rig {
+
+constexpr int kTriggerPin = 6;
+constexpr int kFaultPin = 7;
+constexpr int kFirstPhasePin = 16;
+constexpr int kPhasesPerBank = 4;
+
+inline int phase_pin(int i) { return kFirstPhasePin + i; }
+
+// phase_pwm.pio from the source tree, assembled once
+const pio_sim::Source& phase_pwm_source();
+
+// Chain engine (PWM_ENGINE_CHAIN, or CHAIN_OCP with ocp = true, which is four
+// phases plus the fault counters on pio1).
+class ChainRig {
+public:
+    ChainRig(int phase_count, uint32_t clkdiv_q8, bool ocp = false);
+
+    // Followers first, like update_pwm_parameters(). False if a FIFO is full.
+    bool queue(const uint32_t words[]);
+    // chain_enable_in_sync(): every SM parks on its wait with its output LOW
+    void enable();
+    void set_trigger(bool level);
+    void set_fault(bool level) { m.set_input(kFaultPin, level); }
+    // Cut pulses counted so far on phase i (CHAIN_OCP), read the way
+    // pwm_fault_poll() does: exec `mov isr, ~x` and `push noblock`
+    uint32_t fault_count(int i);
+
+    void run(uint64_t clocks) { m.run(clocks); }
+
+    pio_sim::Machine m;
+    const int phases;
+    const bool ocp;
+};
+
+// Timeline engine: pio0 SM0 with the TX FIFO joined, refilled from a ring of
+// words the way the DMA data/control channel pair streams it.
+class TimelineRig {
+public:
+    TimelineRig(uint32_t clkdiv_q8, const uint32_t words[], int word_count);
+
+    void set_trigger(bool level) { m.set_input(kTriggerPin, level); }
+    void run(uint64_t clocks);
+
+    pio_sim::Machine m;
+
+private:
+    std::vector<uint32_t> ring_;
+    size_t next_ = 0;
+};
+
+struct Pulse {
+    uint64_t rise;
+    uint64_t fall;
+
+    bool operator==(const Pulse& o) const { return rise == o.rise && fall == o.fall; }
+};
+
+// Complete HIGH pulses on a pin, in clk_sys
+std::vector<Pulse> pulses(const pio_sim::Machine& m, int pin);
+
+// The first rise on a pin at or after a clock, or UINT64_MAX
+uint64_t first_rise_after(const pio_sim::Machine& m, int pin, uint64_t clock);
+
+}  // namespace rig
+
+#endif
@@ -0,0 +1,48 @@
+// pio_header.cpp
+// Host stand-in for pioasm: writes the defines of a .pio file as a C header so
+// the timing code builds off-target against the same constants as the
+// firmware. Same naming as pioasm: PUBLIC defines before the first .program
+// keep their name, later ones get the program name as a prefix.
+//
+//   pio_header <in.pio> <out.h>
+
+#include "pio_sim.h"
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::fprintf(stderr, "usage: %s <in.pio> <out.h>\n", argv[0]);
+        return 2;
+    }
+    try {
+        const pio_sim::Source src = pio_sim::assemble_file(argv[1]);
+        std::ofstream out(argv[2]);
+        out << "// Generated from " << argv[1] << " by pio_header, do not edit\n#pragma once\n\n";
+        for (const auto& [name, value] : src.public_defines) {
+            out << "#define " << name << ' ' << value << '\n';
+        }
+        for (const pio_sim::Program& p : src.programs) {
+            out << '\n';
+            for (const auto& [name, value] : p.public_defines) {
+                out << "#define " << p.name << '_' << name << ' ' << value << '\n';
+            }
+            out << "#define " << p.name << "_wrap_target " << p.wrap_target << '\n';
+            out << "#define " << p.name << "_wrap " << p.wrap << '\n';
+            out << "#define " << p.name << "_length " << p.code.size() << '\n';
+            for (const auto& [label, at] : p.public_labels) {
+                out << "#define " << p.name << "_offset_" << label << ' ' << at << "u\n";
+            }
+        }
+        if (!out) {
+            std::fprintf(stderr, "cannot write %s\n", argv[2]);
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    return 0;
+}
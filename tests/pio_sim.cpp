@@ -0,0 +1,684 @@
+// pio_sim.cpp
+// PIO assembler and cycle-level simulator for the host tests, see pio_sim.h
+
+#include "pio_sim.h"
+
+#include <cctype>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+namespace pio_sim {
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t a = 0, b = s.size();
+    while (a < b && std::isspace(static_cast<unsigned char>(s[a]))) ++a;
+    while (b > a && std::isspace(static_cast<unsigned char>(s[b - 1]))) --b;
+    return s.substr(a, b - a);
+}
+
+std::string strip_comment(const std::string& line) {
+    size_t cut = line.find(';');
+    size_t slashes = line.find("//");
+    if (slashes < cut) cut = slashes;
+    return cut == std::string::npos ? line : line.substr(0, cut);
+}
+
+// Whitespace and commas both separate operands
+std::vector<std::string> split_operands(const std::string& s) {
+    std::vector<std::string> out;
+    std::string cur;
+    for (char c : s) {
+        if (std::isspace(static_cast<unsigned char>(c)) || c == ',') {
+            if (!cur.empty()) out.push_back(cur);
+            cur.clear();
+        } else {
+            cur += c;
+        }
+    }
+    if (!cur.empty()) out.push_back(cur);
+    return out;
+}
+
+[[noreturn]] void fail(const std::string& what, const std::string& line) {
+    throw std::runtime_error(what + ": '" + line + "'");
+}
+
+using Defines = std::map<std::string, long>;
+
+long parse_value(const std::string& tok, const Defines& local, const Defines& global, const std::string& line) {
+    if (tok.empty()) fail("missing value", line);
+    auto it = local.find(tok);
+    if (it != local.end()) return it->second;
+    it = global.find(tok);
+    if (it != global.end()) return it->second;
+    try {
+        size_t used = 0;
+        long v;
+        if (tok.rfind("0b", 0) == 0) {
+            v = std::stol(tok.substr(2), &used, 2);
+            used += 2;
+        } else {
+            v = std::stol(tok, &used, 0);
+        }
+        if (used != tok.size()) fail("bad number", line);
+        return v;
+    } catch (const std::logic_error&) {
+        fail("unknown symbol '" + tok + "'", line);
+    }
+}
+
+// Decode one instruction. labels may be empty for exec(), where only
+// numeric jump targets make sense.
+Instr decode(const std::string& source_text, const Program& prog, const Defines& local, const Defines& global) {
+    Instr in;
+    in.text = source_text;
+    std::string text = source_text;
+    std::smatch m;
+
+    static const std::regex delay_re(R"(\[\s*([A-Za-z0-9_]+)\s*\]\s*$)");
+    if (std::regex_search(text, m, delay_re)) {
+        in.delay = static_cast<int>(parse_value(m[1], local, global, source_text));
+        text = trim(text.substr(0, m.position(0)));
+    }
+    static const std::regex side_re(R"(\bside\s+([A-Za-z0-9_]+)\s*$)");
+    if (std::regex_search(text, m, side_re)) {
+        in.side = static_cast<int>(parse_value(m[1], local, global, source_text));
+        text = trim(text.substr(0, m.position(0)));
+    }
+
+    const int sideset_field = prog.sideset_bits + (prog.sideset_opt ? 1 : 0);
+    const int max_delay = (1 << (5 - sideset_field)) - 1;
+    if (in.delay < 0 || in.delay > max_delay) fail("delay out of range", source_text);
+    if (in.side >= 0) {
+        if (prog.sideset_bits == 0) fail("side-set without .side_set", source_text);
+        if (in.side >= (1 << prog.sideset_bits)) fail("side-set value too wide", source_text);
+    } else if (prog.sideset_bits > 0 && !prog.sideset_opt) {
+        fail("side-set is not optional in this program", source_text);
+    }
+
+    std::vector<std::string> ops = split_operands(text);
+    if (ops.empty()) fail("empty instruction", source_text);
+    const std::string op = ops[0];
+    ops.erase(ops.begin());
+    auto value = [&](const std::string& tok) {
+        return static_cast<int>(parse_value(tok, local, global, source_text));
+    };
+
+    if (op == "jmp") {
+        in.op = Op::Jmp;
+        if (ops.empty() || ops.size() > 2) fail("bad jmp", source_text);
+        if (ops.size() == 2) {
+            in.cond = ops[0];
+            static const char *conds[] = {"!x", "x--", "!y", "y--", "x!=y", "pin", "!osre"};
+            bool known = false;
+            for (const char *c : conds) known |= in.cond == c;
+            if (!known) fail("bad jmp condition", source_text);
+        }
+        auto label = prog.labels.find(ops.back());
+        in.target = label != prog.labels.end() ? label->second : value(ops.back());
+    } else if (op == "wait") {
+        in.op = Op::Wait;
+        if (ops.size() < 2) fail("bad wait", source_text);
+        in.polarity = value(ops[0]);
+        in.src = ops[1];
+        std::vector<std::string> rest(ops.begin() + 2, ops.end());
+        std::vector<std::string> numbers;
+        for (const std::string& t : rest) {
+            if (t == "rel") in.rel = true;
+            else if (t == "prev") in.prev = true;
+            else if (t == "next") in.next = true;
+            else if (t != "+") numbers.push_back(t);
+        }
+        if (in.src != "gpio" && in.src != "pin" && in.src != "irq" && in.src != "jmppin") {
+            fail("bad wait source", source_text);
+        }
+        if (in.src == "jmppin" && (in.prev || in.next || in.rel)) fail("bad wait", source_text);
+        if (numbers.size() > 1 || (numbers.empty() && in.src != "jmppin")) fail("bad wait index", source_text);
+        in.index = numbers.empty() ? 0 : value(numbers[0]);
+        if ((in.prev || in.next || in.src == "jmppin") && prog.pio_version < 1) {
+            fail("needs .pio_version 1", source_text);
+        }
+    } else if (op == "in" || op == "out") {
+        in.op = op == "in" ? Op::In : Op::Out;
+        if (ops.size() != 2) fail("bad " + op, source_text);
+        (op == "in" ? in.src : in.dst) = ops[0];
+        in.bits = value(ops[1]);
+        if (in.bits < 1 || in.bits > 32) fail("bad bit count", source_text);
+    } else if (op == "push" || op == "pull") {
+        in.op = op == "push" ? Op::Push : Op::Pull;
+        for (const std::string& t : ops) {
+            if (t == "block") in.block = true;
+            else if (t == "noblock") in.block = false;
+            else if (t == "iffull" || t == "ifempty") in.if_flag = true;
+            else fail("bad " + op, source_text);
+        }
+    } else if (op == "mov") {
+        in.op = Op::Mov;
+        if (ops.size() < 2) fail("bad mov", source_text);
+        in.dst = ops[0];
+        std::string src;
+        for (size_t i = 1; i < ops.size(); ++i) src += ops[i];
+        if (src.rfind("::", 0) == 0) {
+            in.reverse = true;
+            src = src.substr(2);
+        } else if (!src.empty() && (src[0] == '~' || src[0] == '!')) {
+            in.invert = true;
+            src = src.substr(1);
+        }
+        in.src = src;
+    } else if (op == "irq") {
+        in.op = Op::Irq;
+        in.irq_mode = "set";
+        std::vector<std::string> numbers;
+        for (const std::string& t : ops) {
+            if (t == "set" || t == "nowait") in.irq_mode = "set";
+            else if (t == "wait" || t == "clear") in.irq_mode = t;
+            else if (t == "rel") in.rel = true;
+            else if (t == "prev") in.prev = true;
+            else if (t == "next") in.next = true;
+            else numbers.push_back(t);
+        }
+        if (numbers.size() != 1) fail("bad irq", source_text);
+        in.index = value(numbers[0]);
+        if ((in.prev || in.next) && prog.pio_version < 1) fail("needs .pio_version 1", source_text);
+    } else if (op == "set") {
+        in.op = Op::Set;
+        if (ops.size() != 2) fail("bad set", source_text);
+        in.dst = ops[0];
+        in.value = value(ops[1]);
+        if (in.value < 0 || in.value > 31) fail("set value out of range", source_text);
+    } else if (op == "nop") {
+        in.op = Op::Nop;
+    } else {
+        fail("unknown instruction", source_text);
+    }
+    if (in.index < 0 || in.index > 31) fail("index out of range", source_text);
+    return in;
+}
+
+}  // namespace
+
+const Program& Source::program(const std::string& name) const {
+    for (const Program& p : programs) {
+        if (p.name == name) return p;
+    }
+    throw std::runtime_error("no program " + name);
+}
+
+long Source::define(const std::string& name) const {
+    auto it = public_defines.find(name);
+    if (it == public_defines.end()) throw std::runtime_error("no global define " + name);
+    return it->second;
+}
+
+Source assemble(const std::string& text) {
+    struct Pending {
+        Defines defines;                    // Every define in scope, public or not
+        std::vector<std::string> lines;
+    };
+    Source src;
+    Defines global;
+    std::vector<Pending> pending;
+    Program *cur = nullptr;
+    bool in_code_block = false;
+
+    std::istringstream stream(text);
+    std::string raw;
+    static const std::regex label_re(R"(^(public\s+|PUBLIC\s+)?([A-Za-z_][A-Za-z0-9_]*):\s*(.*)$)");
+    while (std::getline(stream, raw)) {
+        const std::string stripped = trim(raw);
+        if (in_code_block) {
+            if (stripped.rfind("%}", 0) == 0) in_code_block = false;
+            continue;
+        }
+        if (stripped.rfind("%", 0) == 0) {
+            in_code_block = true;           // % c-sdk { ... %}
+            continue;
+        }
+        std::string line = trim(strip_comment(raw));
+        if (line.empty()) continue;
+
+        if (line[0] == '.') {
+            std::vector<std::string> t = split_operands(line);
+            const std::string& d = t[0];
+            if (d == ".program") {
+                if (t.size() != 2) fail("bad .program", line);
+                src.programs.emplace_back();
+                pending.emplace_back();
+                cur = &src.programs.back();
+                cur->name = t[1];
+                continue;
+            }
+            if (d == ".define") {
+                bool is_public = t.size() == 4 && (t[1] == "PUBLIC" || t[1] == "public");
+                if (t.size() != (is_public ? 4u : 3u)) fail("bad .define", line);
+                const std::string& name = t[is_public ? 2 : 1];
+                Defines& scope = cur ? pending.back().defines : global;
+                long v = parse_value(t[is_public ? 3 : 2], scope, global, line);
+                scope[name] = v;
+                if (is_public) (cur ? cur->public_defines : src.public_defines)[name] = v;
+                continue;
+            }
+            if (!cur) fail("directive outside a program", line);
+            if (d == ".side_set") {
+                if (t.size() < 2) fail("bad .side_set", line);
+                cur->sideset_bits = static_cast<int>(parse_value(t[1], pending.back().defines, global, line));
+                for (size_t i = 2; i < t.size(); ++i) {
+                    if (t[i] == "opt") cur->sideset_opt = true;
+                    else if (t[i] != "pindirs") fail("bad .side_set", line);
+                }
+            } else if (d == ".wrap_target") {
+                cur->wrap_target = static_cast<int>(pending.back().lines.size());
+            } else if (d == ".wrap") {
+                cur->wrap = static_cast<int>(pending.back().lines.size()) - 1;
+            } else if (d == ".pio_version") {
+                cur->pio_version = static_cast<int>(parse_value(t.at(1), pending.back().defines, global, line));
+            } else if (d == ".origin" || d == ".lang_opt" || d == ".fifo" || d == ".in" || d == ".out" ||
+                       d == ".set" || d == ".clock_div" || d == ".mov_status") {
+                // Config hints pioasm puts in the default config; the tests set
+                // the config explicitly, like the *_program_init() helpers do
+            } else {
+                fail("unknown directive", line);
+            }
+            continue;
+        }
+
+        if (!cur) fail("instruction outside a program", line);
+        std::smatch m;
+        if (std::regex_match(line, m, label_re)) {
+            const int at = static_cast<int>(pending.back().lines.size());
+            cur->labels[m[2]] = at;
+            if (m[1].matched) cur->public_labels[m[2]] = at;
+            line = trim(m[3]);
+            if (line.empty()) continue;
+        }
+        pending.back().lines.push_back(line);
+    }
+
+    for (size_t i = 0; i < src.programs.size(); ++i) {
+        Program& p = src.programs[i];
+        for (const std::string& line : pending[i].lines) {
+            p.code.push_back(decode(line, p, pending[i].defines, global));
+        }
+        if (p.code.empty()) fail("empty program", p.name);
+        if (static_cast<int>(p.code.size()) > kInstructionMemory) fail("program too long", p.name);
+        if (p.wrap < 0) p.wrap = static_cast<int>(p.code.size()) - 1;
+        for (const Instr& in : p.code) {
+            if (in.op == Op::Jmp && (in.target < 0 || in.target >= static_cast<int>(p.code.size()))) {
+                fail("jump out of program", in.text);
+            }
+        }
+    }
+    return src;
+}
+
+Source assemble_file(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot open " + path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return assemble(ss.str());
+}
+
+Instr assemble_instr(const std::string& text) {
+    Program bare;
+    return decode(text, bare, Defines(), Defines());
+}
+
+Machine::Machine() = default;
+
+Machine::Sm& Machine::sm_at(int block, int sm) {
+    if (block < 0 || block >= kBlocks || sm < 0 || sm >= kSmsPerBlock) throw std::out_of_range("no such SM");
+    return sms_[block][sm];
+}
+
+const Machine::Sm& Machine::sm_at(int block, int sm) const {
+    if (block < 0 || block >= kBlocks || sm < 0 || sm >= kSmsPerBlock) throw std::out_of_range("no such SM");
+    return sms_[block][sm];
+}
+
+void Machine::init(int block, int sm, const Program& program, const SmConfig& config, int start_pc) {
+    Sm& s = sm_at(block, sm);
+    s = Sm();
+    s.program = &program;
+    s.config = config;
+    s.pc = start_pc;
+}
+
+void Machine::set_enabled(int block, int sm, bool enabled) {
+    sm_at(block, sm).enabled = enabled;
+}
+
+void Machine::enable_in_sync(const uint32_t masks[kBlocks]) {
+    clkdiv_restart(masks);
+    for (int b = 0; b < kBlocks; ++b) {
+        for (int i = 0; i < kSmsPerBlock; ++i) {
+            if (masks[b] >> i & 1) sms_[b][i].enabled = true;
+        }
+    }
+}
+
+void Machine::set_clkdiv(int block, int sm, uint32_t clkdiv_q8) {
+    if (clkdiv_q8 < 256) throw std::invalid_argument("clkdiv below 1.0");
+    sm_at(block, sm).config.clkdiv_q8 = clkdiv_q8;
+}
+
+void Machine::clkdiv_restart(const uint32_t masks[kBlocks]) {
+    for (int b = 0; b < kBlocks; ++b) {
+        for (int i = 0; i < kSmsPerBlock; ++i) {
+            if (masks[b] >> i & 1) sms_[b][i].div_acc = 0;
+        }
+    }
+}
+
+bool Machine::put(int block, int sm, uint32_t word) {
+    Sm& s = sm_at(block, sm);
+    const size_t depth = s.config.join_tx ? 2 * kFifoDepth : kFifoDepth;
+    if (s.tx.size() >= depth) return false;
+    s.tx.push_back(word);
+    return true;
+}
+
+bool Machine::get(int block, int sm, uint32_t *word) {
+    Sm& s = sm_at(block, sm);
+    if (s.rx.empty()) return false;
+    *word = s.rx.front();
+    s.rx.pop_front();
+    return true;
+}
+
+int Machine::tx_level(int block, int sm) const {
+    return static_cast<int>(sm_at(block, sm).tx.size());
+}
+
+int Machine::pc(int block, int sm) const {
+    return sm_at(block, sm).pc;
+}
+
+uint32_t Machine::x(int block, int sm) const {
+    return sm_at(block, sm).x;
+}
+
+void Machine::exec(int block, int sm, const std::string& text) {
+    Sm& s = sm_at(block, sm);
+    const Instr in = assemble_instr(text);
+    int jump_to = -1;
+    if (!execute(block, sm, s, in, &jump_to)) throw std::runtime_error("exec'd instruction stalled: " + text);
+    if (jump_to >= 0) s.pc = jump_to;
+    apply_pending();
+}
+
+void Machine::set_input(int pin, bool level) {
+    if (level_[pin] != level) {
+        level_[pin] = level;
+        edges_.push_back({clock_, pin, level});
+    }
+}
+
+bool Machine::pin(int pin) const {
+    return level_[pin];
+}
+
+bool Machine::visible(int pin) const {
+    return sync_[kInputSyncClocks - 1][pin];
+}
+
+uint32_t Machine::read_in_pins(const Sm& s) const {
+    uint32_t v = 0;
+    for (int i = 0; i < s.config.in_count && i < 32; ++i) {
+        v |= static_cast<uint32_t>(visible((s.config.in_base + i) % 32)) << i;
+    }
+    return v;
+}
+
+Machine::IrqRef Machine::irq_ref(int block, int sm_index, const Instr& in) const {
+    int index = in.index & 7;
+    if (in.rel) index = (index & 4) | ((index + sm_index) & 3);
+    if (in.prev) block = (block + kBlocks - 1) % kBlocks;
+    if (in.next) block = (block + 1) % kBlocks;
+    return {block, index};
+}
+
+bool Machine::status(int block, const Sm& s) const {
+    const SmConfig& c = s.config;
+    switch (c.status_sel) {
+    case SmConfig::Status::TxLessThan: return static_cast<int>(s.tx.size()) < c.status_n;
+    case SmConfig::Status::RxLessThan: return static_cast<int>(s.rx.size()) < c.status_n;
+    case SmConfig::Status::IrqSet: break;
+    }
+    if (c.status_n & 0x08) block = (block + kBlocks - 1) % kBlocks;
+    if (c.status_n & 0x10) block = (block + 1) % kBlocks;
+    return irq_[block][c.status_n & 7];
+}
+
+void Machine::write_pins(int base, int count, uint32_t value) {
+    for (int i = 0; i < count; ++i) {
+        pending_pins_.push_back({(base + i) % 32, (value >> i & 1) != 0});
+    }
+}
+
+bool Machine::tick_divider(Sm& s) {
+    s.div_acc += 256;
+    if (s.div_acc < s.config.clkdiv_q8) return false;
+    s.div_acc -= s.config.clkdiv_q8;
+    return true;
+}
+
+bool Machine::execute(int block, int sm_index, Sm& s, const Instr& in, int *jump_to) {
+    const SmConfig& c = s.config;
+    auto read_source = [&](const std::string& src) -> uint32_t {
+        if (src == "x") return s.x;
+        if (src == "y") return s.y;
+        if (src == "null") return 0;
+        if (src == "isr") return s.isr;
+        if (src == "osr") return s.osr;
+        if (src == "pins") return read_in_pins(s);
+        if (src == "status") return status(block, s) ? 0xFFFFFFFFu : 0;
+        throw std::runtime_error("unsupported source in '" + in.text + "'");
+    };
+
+    switch (in.op) {
+    case Op::Jmp: {
+        bool take = true;
+        if (in.cond == "!x") take = s.x == 0;
+        else if (in.cond == "x--") take = s.x-- != 0;
+        else if (in.cond == "!y") take = s.y == 0;
+        else if (in.cond == "y--") take = s.y-- != 0;
+        else if (in.cond == "x!=y") take = s.x != s.y;
+        else if (in.cond == "pin") take = visible(c.jmp_pin);
+        else if (in.cond == "!osre") take = s.osr_count < c.pull_threshold;
+        if (take) *jump_to = in.target;
+        return true;
+    }
+    case Op::Wait: {
+        bool level;
+        if (in.src == "gpio") {
+            level = visible(in.index);
+        } else if (in.src == "pin") {
+            level = visible((c.in_base + in.index) % 32);
+        } else if (in.src == "jmppin") {
+            level = visible((c.jmp_pin + in.index) % 32);
+        } else {
+            const IrqRef r = irq_ref(block, sm_index, in);
+            level = irq_[r.block][r.index];
+            if (level && in.polarity == 1) pending_clear_.push_back(r);
+        }
+        return level == (in.polarity != 0);
+    }
+    case Op::In: {
+        uint32_t v = in.src == "pins" ? read_in_pins(s) : read_source(in.src);
+        if (in.bits < 32) v &= (1u << in.bits) - 1;
+        if (in.bits == 32) s.isr = v;
+        else if (c.in_shift_right) s.isr = (s.isr >> in.bits) | (v << (32 - in.bits));
+        else s.isr = (s.isr << in.bits) | v;
+        s.isr_count = std::min(32, s.isr_count + in.bits);
+        if (c.autopush && s.isr_count >= c.push_threshold) {
+            if (s.rx.size() >= static_cast<size_t>(kFifoDepth)) return false;
+            s.rx.push_back(s.isr);
+            s.isr = 0;
+            s.isr_count = 0;
+        }
+        return true;
+    }
+    case Op::Out: {
+        if (c.autopull && s.osr_count >= c.pull_threshold) {
+            if (s.tx.empty()) return false;
+            s.osr = s.tx.front();
+            s.tx.pop_front();
+            s.osr_count = 0;
+        }
+        uint32_t v;
+        if (in.bits == 32) {
+            v = s.osr;
+            s.osr = 0;
+        } else if (c.out_shift_right) {
+            v = s.osr & ((1u << in.bits) - 1);
+            s.osr >>= in.bits;
+        } else {
+            v = s.osr >> (32 - in.bits);
+            s.osr <<= in.bits;
+        }
+        s.osr_count = std::min(32, s.osr_count + in.bits);
+        if (in.dst == "x") s.x = v;
+        else if (in.dst == "y") s.y = v;
+        else if (in.dst == "pins") write_pins(c.out_base, c.out_count, v);
+        else if (in.dst == "pc") *jump_to = static_cast<int>(v);
+        else if (in.dst == "isr") { s.isr = v; s.isr_count = in.bits; }
+        else if (in.dst != "null" && in.dst != "pindirs") {
+            throw std::runtime_error("unsupported destination in '" + in.text + "'");
+        }
+        return true;
+    }
+    case Op::Push: {
+        if (in.if_flag && s.isr_count < c.push_threshold) return true;
+        if (s.rx.size() >= static_cast<size_t>(kFifoDepth)) {
+            if (in.block) return false;
+        } else {
+            s.rx.push_back(s.isr);
+        }
+        s.isr = 0;
+        s.isr_count = 0;
+        return true;
+    }
+    case Op::Pull: {
+        if (in.if_flag && s.osr_count < c.pull_threshold) return true;
+        if (!s.tx.empty()) {
+            s.osr = s.tx.front();
+            s.tx.pop_front();
+        } else if (in.block) {
+            return false;
+        } else {
+            s.osr = s.x;
+        }
+        s.osr_count = 0;
+        return true;
+    }
+    case Op::Mov: {
+        uint32_t v = read_source(in.src);
+        if (in.invert) v = ~v;
+        if (in.reverse) {
+            uint32_t r = 0;
+            for (int i = 0; i < 32; ++i) r |= (v >> i & 1) << (31 - i);
+            v = r;
+        }
+        if (in.dst == "x") s.x = v;
+        else if (in.dst == "y") s.y = v;
+        else if (in.dst == "isr") { s.isr = v; s.isr_count = 0; }
+        else if (in.dst == "osr") { s.osr = v; s.osr_count = 0; }
+        else if (in.dst == "pins") write_pins(c.out_base, c.out_count, v);
+        else if (in.dst == "pc") *jump_to = static_cast<int>(v & 31);
+        else if (in.dst != "pindirs") throw std::runtime_error("unsupported destination in '" + in.text + "'");
+        return true;
+    }
+    case Op::Irq: {
+        const IrqRef r = irq_ref(block, sm_index, in);
+        if (in.irq_mode == "clear") pending_clear_.push_back(r);
+        else if (in.irq_mode == "set") pending_set_.push_back(r);
+        else throw std::runtime_error("irq wait is not modelled: '" + in.text + "'");
+        return true;
+    }
+    case Op::Set:
+        if (in.dst == "x") s.x = static_cast<uint32_t>(in.value);
+        else if (in.dst == "y") s.y = static_cast<uint32_t>(in.value);
+        else if (in.dst == "pins") write_pins(c.set_base, c.set_count, static_cast<uint32_t>(in.value));
+        else if (in.dst != "pindirs") throw std::runtime_error("unsupported destination in '" + in.text + "'");
+        return true;
+    case Op::Nop:
+        return true;
+    }
+    return true;
+}
+
+void Machine::apply_pending() {
+    for (const PinWrite& w : pending_pins_) {
+        if (level_[w.pin] != w.level) {
+            level_[w.pin] = w.level;
+            edges_.push_back({clock_, w.pin, w.level});
+        }
+    }
+    pending_pins_.clear();
+    for (const IrqRef& r : pending_clear_) irq_[r.block][r.index] = false;
+    for (const IrqRef& r : pending_set_) irq_[r.block][r.index] = true;
+    pending_clear_.clear();
+    pending_set_.clear();
+}
+
+void Machine::step() {
+    std::vector<PinWrite> side_writes;
+    for (int b = 0; b < kBlocks; ++b) {
+        for (int i = 0; i < kSmsPerBlock; ++i) {
+            Sm& s = sms_[b][i];
+            if (!s.enabled || !tick_divider(s)) continue;
+            if (s.delay > 0) {
+                --s.delay;
+                continue;
+            }
+            const Instr& in = s.program->code[s.pc];
+            if (in.side >= 0) {
+                for (int bit = 0; bit < s.program->sideset_bits; ++bit) {
+                    side_writes.push_back({(s.config.sideset_base + bit) % 32, (in.side >> bit & 1) != 0});
+                }
+            }
+            int jump_to = -1;
+            if (!execute(b, i, s, in, &jump_to)) continue;
+            if (jump_to >= 0) s.pc = jump_to;
+            else s.pc = s.pc == s.program->wrap ? s.program->wrap_target : s.pc + 1;
+            s.delay = in.delay;
+        }
+    }
+    // Side-set wins over an OUT/SET to the same pin in the same cycle
+    pending_pins_.insert(pending_pins_.end(), side_writes.begin(), side_writes.end());
+    apply_pending();
+
+    for (int k = kInputSyncClocks - 1; k > 0; --k) {
+        std::copy(std::begin(sync_[k - 1]), std::end(sync_[k - 1]), std::begin(sync_[k]));
+    }
+    std::copy(std::begin(level_), std::end(level_), std::begin(sync_[0]));
+    ++clock_;
+}
+
+void Machine::run(uint64_t clocks) {
+    for (uint64_t i = 0; i < clocks; ++i) step();
+}
+
+std::vector<uint64_t> Machine::rises(int pin) const {
+    std::vector<uint64_t> out;
+    for (const Edge& e : edges_) {
+        if (e.pin == pin && e.level) out.push_back(e.clock);
+    }
+    return out;
+}
+
+std::vector<uint64_t> Machine::falls(int pin) const {
+    std::vector<uint64_t> out;
+    for (const Edge& e : edges_) {
+        if (e.pin == pin && !e.level) out.push_back(e.clock);
+    }
+    return out;
+}
+
+}  // namespace pio_sim
@@ -0,0 +1,201 @@
+// pio_sim.h
+// Cycle-level model of the RP2350 PIO blocks for the host tests.
+//
+// assemble() reads the .pio sources in this repo (the subset of pioasm syntax
+// they use) and Machine runs the programs one clk_sys at a time on three blocks
+// of four state machines: 16.8 clock dividers, 4-deep TX/RX FIFOs, OSR/ISR
+// shift counts and autopull, side-set, delay cycles, `jmp pin`, every `wait`
+// source, `mov status`, and IRQ flags with rel/prev/next addressing. GPIO inputs go through
+// the same 2-clk_sys synchroniser as on the chip.
+//
+// Timing rules, as in the RP2350 datasheet: an instruction takes one PIO clock
+// plus its delay; side-set and pin writes show at the end of the cycle that
+// issues the instruction (and hold while it stalls); an IRQ flag set in one
+// cycle is seen by waiting SMs in the next.
+
+#ifndef PIO_SIM_H
+#define PIO_SIM_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace pio_sim {
+
+constexpr int kBlocks = 3;
+constexpr int kSmsPerBlock = 4;
+constexpr int kPins = 48;
+constexpr int kInstructionMemory = 32;  // Per block
+constexpr int kFifoDepth = 4;
+constexpr int kInputSyncClocks = 2;
+
+enum class Op { Jmp, Wait, In, Out, Push, Pull, Mov, Irq, Set, Nop };
+
+struct Instr {
+    Op op = Op::Nop;
+    std::string text;           // Source line, for error messages
+    int delay = 0;
+    int side = -1;              // -1 = no side-set on this instruction
+    std::string cond;           // jmp condition, empty = always
+    int target = 0;             // jmp target, program-relative
+    std::string src;            // wait/mov/in source
+    std::string dst;            // mov/out/set destination
+    bool invert = false;        // mov ~src
+    bool reverse = false;       // mov ::src
+    int bits = 0;               // in/out bit count
+    int value = 0;              // set value
+    int polarity = 1;           // wait polarity
+    int index = 0;              // wait pin/irq index, irq index
+    bool block = true;          // push/pull
+    bool if_flag = false;       // pull ifempty / push iffull
+    bool rel = false;
+    bool prev = false;
+    bool next = false;
+    std::string irq_mode;       // "set", "wait" or "clear"
+};
+
+struct Program {
+    std::string name;
+    std::vector<Instr> code;
+    std::map<std::string, int> labels;
+    std::map<std::string, int> public_labels;
+    std::map<std::string, long> public_defines;     // Emitted as <name>_<define>
+    int wrap_target = 0;
+    int wrap = -1;
+    int sideset_bits = 0;       // Not counting the opt bit
+    bool sideset_opt = false;
+    int pio_version = 0;
+};
+
+struct Source {
+    std::map<std::string, long> public_defines;     // Global: before the first .program
+    std::vector<Program> programs;
+
+    const Program& program(const std::string& name) const;
+    long define(const std::string& name) const;
+};
+
+// Throws std::runtime_error with the offending line on anything it can't parse.
+Source assemble(const std::string& text);
+Source assemble_file(const std::string& path);
+Instr assemble_instr(const std::string& text);      // One instruction, for exec()
+
+struct SmConfig {
+    int sideset_base = 0;
+    int in_base = 0;
+    int in_count = 32;
+    int jmp_pin = 0;
+    int out_base = 0;
+    int out_count = 0;
+    int set_base = 0;
+    int set_count = 0;
+    bool out_shift_right = true;
+    bool in_shift_right = true;
+    bool autopull = false;
+    int pull_threshold = 32;
+    bool autopush = false;
+    int push_threshold = 32;
+    bool join_tx = false;       // 8-deep TX FIFO
+    uint32_t clkdiv_q8 = 256;   // 16.8 divider, 1.0 = every clk_sys
+    // EXECCTRL STATUS_SEL/STATUS_N: `mov status` reads all-ones while the TX
+    // (RX) FIFO holds fewer than status_n words, or while IRQ flag status_n is
+    // set (0x08 = previous block, 0x10 = next block), all-zeroes otherwise
+    enum class Status { TxLessThan, RxLessThan, IrqSet };
+    Status status_sel = Status::TxLessThan;
+    int status_n = 0;
+};
+
+struct Edge {
+    uint64_t clock;
+    int pin;
+    bool level;
+};
+
+class Machine {
+public:
+    Machine();
+
+    // pio_sm_init(): program, config and start PC; leaves the SM disabled with
+    // empty FIFOs and cleared registers.
+    void init(int block, int sm, const Program& program, const SmConfig& config, int start_pc = 0);
+    void set_enabled(int block, int sm, bool enabled);
+    // pio_enable_sm_multi_mask_in_sync(): dividers restarted and SMs enabled on
+    // the same clk_sys, across blocks.
+    void enable_in_sync(const uint32_t masks[kBlocks]);
+    void set_clkdiv(int block, int sm, uint32_t clkdiv_q8);
+    void clkdiv_restart(const uint32_t masks[kBlocks]);
+
+    bool put(int block, int sm, uint32_t word);     // false if the TX FIFO is full
+    bool get(int block, int sm, uint32_t *word);    // false if the RX FIFO is empty
+    int tx_level(int block, int sm) const;
+    bool irq(int block, int index) const { return irq_[block][index & 7]; }   // pio_interrupt_get()
+    int pc(int block, int sm) const;
+    uint32_t x(int block, int sm) const;
+
+    // pio_sm_exec(): runs one instruction at once, between clocks. Only for
+    // instructions that can't stall.
+    void exec(int block, int sm, const std::string& text);
+
+    // Drive an input pin from outside, e.g. the trigger
+    void set_input(int pin, bool level);
+    bool pin(int pin) const;
+
+    void step();                                    // One clk_sys
+    void run(uint64_t clocks);
+    uint64_t clock() const { return clock_; }
+
+    // Every pin change so far, in order
+    const std::vector<Edge>& edges() const { return edges_; }
+    void clear_edges() { edges_.clear(); }
+    std::vector<uint64_t> rises(int pin) const;
+    std::vector<uint64_t> falls(int pin) const;
+
+private:
+    struct Sm {
+        const Program *program = nullptr;
+        SmConfig config;
+        bool enabled = false;
+        int pc = 0;
+        uint32_t x = 0, y = 0, osr = 0, isr = 0;
+        int osr_count = 32;     // Bits shifted out; 32 = empty
+        int isr_count = 0;
+        std::deque<uint32_t> tx, rx;
+        int delay = 0;
+        uint32_t div_acc = 0;
+    };
+    struct PinWrite {
+        int pin;
+        bool level;
+    };
+    struct IrqRef {
+        int block;
+        int index;
+    };
+
+    Sm& sm_at(int block, int sm);
+    const Sm& sm_at(int block, int sm) const;
+    bool tick_divider(Sm& s);
+    // Executes one instruction; false if it stalls. Sets *jump_to when it jumps.
+    bool execute(int block, int sm_index, Sm& s, const Instr& in, int *jump_to);
+    bool visible(int pin) const;
+    uint32_t read_in_pins(const Sm& s) const;
+    IrqRef irq_ref(int block, int sm_index, const Instr& in) const;
+    bool status(int block, const Sm& s) const;
+    void write_pins(int base, int count, uint32_t value);
+    void apply_pending();
+
+    Sm sms_[kBlocks][kSmsPerBlock];
+    bool irq_[kBlocks][8] = {};
+    bool level_[kPins] = {};
+    bool sync_[kInputSyncClocks][kPins] = {};
+    uint64_t clock_ = 0;
+    std::vector<Edge> edges_;
+    std::vector<PinWrite> pending_pins_;
+    std::vector<IrqRef> pending_set_, pending_clear_;
+};
+
+}  // namespace pio_sim
+
+#endif
@@ -0,0 +1,186 @@
+// test_discharge_steps.cpp
+// Discharge compare levels (discharge_steps.c): duty to level conversion with
+// the inversion folded in, DC_INVERT and wrap changes on stored levels, the
+// interpolation endpoints, and the step path the wrap IRQ runs, checked
+// against the float path it replaced. Prints host timings of both.
+
+#include "test_util.h"
+
+extern "C" {
+#include "discharge_steps.h"
+}
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+namespace {
+
+const uint16_t kWraps[] = {99, 2999, 65534};
+
+// The step path before compare levels were precomputed: float duties,
+// inversion and modulo on every step, truncated to a level
+struct FloatChannel {
+    float duty_cycles[DISCHARGE_MAX_STEPS];
+    int num_steps;
+};
+
+uint16_t float_level(const FloatChannel* ch, uint32_t step, uint16_t wrap, bool invert) {
+    if (ch->num_steps <= 0) return 0;
+    float duty = ch->duty_cycles[step % ch->num_steps];
+    float final_duty = invert ? (1.0f - duty) : duty;
+    return (uint16_t)(final_duty * wrap);
+}
+
+// A channel of n pseudo-random duties, as floats and as levels
+void make_channel(int n, uint16_t wrap, bool invert, unsigned seed, FloatChannel* f, ChannelSequence* c) {
+    std::srand(seed);
+    f->num_steps = c->num_steps = n;
+    for (int i = 0; i < n; ++i) {
+        f->duty_cycles[i] = (float)(std::rand() % 10001) / 10000.0f;
+        c->levels[i] = discharge_duty_to_level(f->duty_cycles[i], wrap, invert);
+    }
+}
+
+void check_footprint() {
+    CHECKF(sizeof(ChannelSequence::levels) * 2 == sizeof(FloatChannel::duty_cycles),
+           "levels take %zu bytes, float duties %zu", sizeof(ChannelSequence::levels),
+           sizeof(FloatChannel::duty_cycles));
+}
+
+// Nearest level, one at most above the old truncated one, and back to the
+// duty within half a level
+void check_duty_to_level() {
+    for (uint16_t wrap : kWraps) {
+        for (bool invert : {false, true}) {
+            for (int k = 0; k <= 1000; ++k) {
+                const float duty = k / 1000.0f;
+                const uint16_t level = discharge_duty_to_level(duty, wrap, invert);
+                const float final_duty = invert ? 1.0f - duty : duty;
+                const uint16_t truncated = (uint16_t)(final_duty * wrap);
+                CHECKF(level >= truncated && level - truncated <= 1, "wrap %u invert %d duty %.3f: level %u, truncated %u", wrap, invert,
+                       duty, level, truncated);
+                CHECKF(std::fabs(discharge_level_to_duty(level, wrap, invert) - duty) <= 0.5f / wrap + 1e-6f,
+                       "wrap %u invert %d duty %.3f: level %u reads back as %.6f", wrap, invert, duty, level,
+                       discharge_level_to_duty(level, wrap, invert));
+            }
+        }
+    }
+}
+
+// DC_INVERT on stored levels and a new wrap both keep every step's duty
+void check_invert_and_rescale() {
+    for (uint16_t wrap : kWraps) {
+        FloatChannel f;
+        ChannelSequence c;
+        make_channel(DISCHARGE_MAX_STEPS, wrap, false, wrap, &f, &c);
+        ChannelSequence inverted = c;
+        discharge_invert_levels(&inverted, wrap);
+        for (int i = 0; i < c.num_steps; ++i) {
+            CHECKF(std::fabs(discharge_level_to_duty(inverted.levels[i], wrap, true) - f.duty_cycles[i]) <=
+                       0.5f / wrap + 1e-6f,
+                   "wrap %u step %d: inverted level %u", wrap, i, inverted.levels[i]);
+        }
+        for (uint16_t to : kWraps) {
+            ChannelSequence scaled = c;
+            discharge_rescale_levels(&scaled, wrap, to);
+            for (int i = 0; i < c.num_steps; ++i) {
+                CHECKF(std::fabs(discharge_level_to_duty(scaled.levels[i], to, false) - f.duty_cycles[i]) <=
+                           0.5f / wrap + 0.5f / to + 1e-6f,
+                       "wrap %u -> %u step %d: level %u", wrap, to, i, scaled.levels[i]);
+            }
+        }
+    }
+}
+
+// Both curves start on k[1], end on k[2] and stay inside the PWM range
+void check_interp() {
+    const int32_t corners[][4] = {{0, 0, 2999, 2999}, {2999, 0, 2999, 0}, {100, 500, 900, 1300}, {0, 3000, 0, 3000}};
+    for (InterpMode mode : {INTERP_LINEAR, INTERP_CUBIC}) {
+        for (const auto& k : corners) {
+            CHECK(discharge_interp_level(mode, k, 0, 2999) == k[1]);
+            CHECK(discharge_interp_level(mode, k, 65536, 2999) == k[2]);
+            int prev = k[1];
+            for (uint32_t t = 0; t <= 65536; t += 512) {
+                const int v = discharge_interp_level(mode, k, t, 2999);
+                CHECKF(v >= 0 && v <= 3000, "mode %d t %u: level %d", mode, t, v);
+                if (mode == INTERP_LINEAR) {
+                    CHECKF(k[2] >= k[1] ? v >= prev : v <= prev, "linear not monotonic at t %u", t);
+                }
+                prev = v;
+            }
+        }
+    }
+}
+
+// Two channels of different lengths stepped the way discharge_advance() does:
+// the indices follow step % num_steps and the levels written are those of
+// the old float path, rounded instead of truncated
+void check_step_path() {
+    for (bool invert : {false, true}) {
+        FloatChannel f1, f2;
+        ChannelSequence c1, c2;
+        make_channel(7, 2999, invert, 1, &f1, &c1);
+        make_channel(DISCHARGE_MAX_STEPS, 2999, invert, 2, &f2, &c2);
+        uint32_t i1 = 0, i2 = 0;
+        bool ok = true;
+        for (uint32_t step = 0; step < 10000 && ok; ++step) {
+            ok &= CHECKF(i1 == step % 7 && i2 == step % DISCHARGE_MAX_STEPS, "step %u: indices %u %u", step, i1, i2);
+            ok &= CHECK(c1.levels[i1] == discharge_channel_level(&c1, step));
+            const int d1 = c1.levels[i1] - float_level(&f1, step, 2999, invert);
+            const int d2 = c2.levels[i2] - float_level(&f2, step, 2999, invert);
+            ok &= CHECKF(d1 >= 0 && d1 <= 1 && d2 >= 0 && d2 <= 1,
+                         "step %u: levels %u %u, float path %u %u", step, c1.levels[i1], c2.levels[i2],
+                         float_level(&f1, step, 2999, invert), float_level(&f2, step, 2999, invert));
+            i1 = discharge_next_index(i1, c1.num_steps);
+            i2 = discharge_next_index(i2, c2.num_steps);
+        }
+    }
+    ChannelSequence empty{};
+    CHECK(discharge_next_index(0, empty.num_steps) == 0 && discharge_channel_level(&empty, 5) == 0);
+}
+
+template <typename F>
+double mean_ns(int calls, F&& fn) {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i) fn(i);
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / calls;
+}
+
+// Informational only: host times vary, the on-target figure is the step
+// update time DC_STATUS reports
+void benchmark() {
+    constexpr int kSteps = 1000000;
+    FloatChannel f1, f2;
+    ChannelSequence c1, c2;
+    make_channel(37, 2999, true, 3, &f1, &c1);
+    make_channel(DISCHARGE_MAX_STEPS, 2999, true, 4, &f2, &c2);
+    volatile uint32_t sink = 0;
+    volatile bool invert = true;    // A runtime flag in the firmware too
+
+    const double old_ns = mean_ns(kSteps, [&](int step) {
+        sink = sink + float_level(&f1, step, 2999, invert) + float_level(&f2, step, 2999, invert);
+    });
+    uint32_t i1 = 0, i2 = 0;
+    const double new_ns = mean_ns(kSteps, [&](int) {
+        sink = sink + c1.levels[i1] + c2.levels[i2];
+        i1 = discharge_next_index(i1, c1.num_steps);
+        i2 = discharge_next_index(i2, c2.num_steps);
+    });
+    std::printf("[DATA] host ns/step for both channels: float duties %.2f, compare levels %.2f\n", old_ns, new_ns);
+}
+
+}  // namespace
+
+int main() {
+    check_footprint();
+    check_duty_to_level();
+    check_invert_and_rescale();
+    check_interp();
+    check_step_path();
+    benchmark();
+    return test::exit_code("test_discharge_steps");
+}
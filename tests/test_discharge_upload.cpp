@@ -0,0 +1,201 @@
+// test_discharge_upload.cpp
+// DC_UPLOAD frames (discharge_upload.c): the CRC against the standard check
+// value, COBS round trips at the block boundaries, frames built and parsed
+// back for every step count, and the rejections finish_upload() reports: a
+// corrupted CRC, broken COBS and a length that does not match the contents.
+// Prints the host parse time of a full frame.
+
+#include "test_util.h"
+
+extern "C" {
+#include "discharge_upload.h"
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Encoded frame for steps x channels pseudo-random duties, without the delimiter
+std::vector<uint8_t> make_encoded(uint32_t steps, uint32_t channels, unsigned seed, std::vector<uint16_t>* duty) {
+    std::srand(seed);
+    duty->assign(steps * channels, 0);
+    for (auto& d : *duty) d = (uint16_t)(std::rand() % 4 == 0 ? 0 : std::rand() & 0xFFFF);
+    uint8_t frame[UPLOAD_MAX_FRAME];
+    const uint32_t len = upload_build_frame(duty->data(), steps, channels, frame, sizeof(frame));
+    std::vector<uint8_t> out(UPLOAD_MAX_ENCODED);
+    out.resize(upload_cobs_encode(frame, len, out.data(), (uint32_t)out.size()));
+    return out;
+}
+
+// Builds a decoded frame by hand, so the length fields can lie
+std::vector<uint8_t> raw_frame(uint32_t len_field, uint32_t steps, uint32_t channels, uint32_t payload) {
+    std::vector<uint8_t> f = {(uint8_t)len_field, (uint8_t)(len_field >> 8), (uint8_t)steps, (uint8_t)(steps >> 8),
+                              (uint8_t)channels, 0};
+    f.resize(UPLOAD_HEADER_BYTES + payload, 0x55);
+    const uint32_t crc = upload_crc32_update(0xFFFFFFFFu, f.data(), (uint32_t)f.size()) ^ 0xFFFFFFFFu;
+    for (int i = 0; i < 4; ++i) f.push_back((uint8_t)(crc >> (8 * i)));
+    return f;
+}
+
+UploadStatus parse_raw(const std::vector<uint8_t>& frame) {
+    std::vector<uint8_t> enc(frame.size() + frame.size() / 254 + 2);
+    enc.resize(upload_cobs_encode(frame.data(), (uint32_t)frame.size(), enc.data(), (uint32_t)enc.size()));
+    uint8_t out[UPLOAD_MAX_FRAME + 16];
+    UploadFrame parsed;
+    return upload_parse_frame(enc.data(), (uint32_t)enc.size(), out, sizeof(out), &parsed);
+}
+
+void check_crc() {
+    const char* check = "123456789";
+    CHECKF((upload_crc32_update(0xFFFFFFFFu, (const uint8_t*)check, 9) ^ 0xFFFFFFFFu) == 0xCBF43926u,
+           "CRC-32 check value %08x",
+           upload_crc32_update(0xFFFFFFFFu, (const uint8_t*)check, 9) ^ 0xFFFFFFFFu);
+    // Split updates give the same result
+    const uint32_t a = upload_crc32_update(0xFFFFFFFFu, (const uint8_t*)check, 4);
+    CHECK(upload_crc32_update(a, (const uint8_t*)check + 4, 5) ==
+          upload_crc32_update(0xFFFFFFFFu, (const uint8_t*)check, 9));
+}
+
+// All zeros, no zeros and mixed data across the 254-byte block length
+void check_cobs_round_trip() {
+    for (uint32_t n : {0u, 1u, 253u, 254u, 255u, 508u, 509u, (uint32_t)UPLOAD_MAX_FRAME}) {
+        for (int fill = 0; fill < 3; ++fill) {
+            std::vector<uint8_t> in(n);
+            for (uint32_t i = 0; i < n; ++i) in[i] = fill == 0 ? 0 : fill == 1 ? (uint8_t)(i % 255 + 1) : (uint8_t)(i * 7);
+            std::vector<uint8_t> enc(n + n / 254 + 2);
+            const uint32_t elen = upload_cobs_encode(in.data(), n, enc.data(), (uint32_t)enc.size());
+            CHECKF(elen > 0 && elen <= n + n / 254 + 1, "n %u fill %d: encoded %u bytes", n, fill, elen);
+            CHECKF(std::memchr(enc.data(), 0, elen) == nullptr, "n %u fill %d: zero in the encoding", n, fill);
+            std::vector<uint8_t> out(n + 1);
+            const int dlen = upload_cobs_decode(enc.data(), elen, out.data(), (uint32_t)out.size());
+            CHECKF(dlen == (int)n && std::memcmp(in.data(), out.data(), n) == 0, "n %u fill %d: decoded %d bytes", n,
+                   fill, dlen);
+        }
+    }
+}
+
+// Every step count and both channel counts parse back to the duties they were built from
+void check_frame_round_trip() {
+    for (uint32_t channels = 1; channels <= 2; ++channels) {
+        for (uint32_t steps = 1; steps <= DISCHARGE_MAX_STEPS; ++steps) {
+            std::vector<uint16_t> duty;
+            const auto enc = make_encoded(steps, channels, steps * 3 + channels, &duty);
+            CHECK(enc.size() <= UPLOAD_MAX_ENCODED);
+            uint8_t frame[UPLOAD_MAX_FRAME];
+            UploadFrame parsed;
+            const UploadStatus st = upload_parse_frame(enc.data(), (uint32_t)enc.size(), frame, sizeof(frame), &parsed);
+            if (!CHECKF(st == UPLOAD_OK && parsed.steps == steps && parsed.channels == channels,
+                        "%u x %u: status %d, %u x %u", steps, channels, st, parsed.steps, parsed.channels)) {
+                continue;
+            }
+            bool same = true;
+            for (uint32_t i = 0; i < steps * channels; ++i) same &= upload_get_le16(parsed.duty + 2 * i) == duty[i];
+            CHECKF(same, "%u x %u: duties differ", steps, channels);
+        }
+    }
+    uint8_t small[8];
+    const uint16_t duty[2] = {1, 2};
+    CHECK(upload_build_frame(duty, 1, 2, small, sizeof(small)) == 0);
+    CHECK(upload_build_frame(duty, 0, 1, small, sizeof(small)) == 0);
+    CHECK(upload_build_frame(duty, 1, 3, small, sizeof(small)) == 0);
+}
+
+// Any flipped byte in the payload or the CRC itself is caught
+void check_corrupted_crc() {
+    std::vector<uint16_t> duty;
+    const auto good = make_encoded(DISCHARGE_MAX_STEPS, 2, 11, &duty);
+    uint8_t ref[UPLOAD_MAX_FRAME];
+    UploadFrame ref_parsed;
+    CHECK(upload_parse_frame(good.data(), (uint32_t)good.size(), ref, sizeof(ref), &ref_parsed) == UPLOAD_OK);
+    const uint32_t len = ref_parsed.len;
+    for (uint32_t pos = UPLOAD_HEADER_BYTES; pos < len; pos += 7) {
+        std::vector<uint8_t> frame(ref, ref + len);
+        frame[pos] ^= 0x10;
+        const UploadStatus st = parse_raw(frame);
+        CHECKF(st == UPLOAD_BAD_CRC, "bit flip at byte %u: status %d", pos, st);
+    }
+    std::vector<uint8_t> frame(ref, ref + len);
+    frame[len - 1] ^= 0x80;
+    uint8_t out[UPLOAD_MAX_FRAME];
+    UploadFrame parsed;
+    std::vector<uint8_t> enc(UPLOAD_MAX_ENCODED);
+    enc.resize(upload_cobs_encode(frame.data(), len, enc.data(), (uint32_t)enc.size()));
+    CHECK(upload_parse_frame(enc.data(), (uint32_t)enc.size(), out, sizeof(out), &parsed) == UPLOAD_BAD_CRC);
+    CHECK(parsed.crc == ref_parsed.crc && parsed.expected_crc == (ref_parsed.crc ^ 0x80000000u));
+}
+
+void check_bad_cobs() {
+    std::vector<uint16_t> duty;
+    const auto good = make_encoded(20, 2, 5, &duty);
+    uint8_t out[UPLOAD_MAX_FRAME];
+    UploadFrame parsed;
+
+    // A code byte that runs past the end of the data
+    auto truncated = good;
+    truncated.push_back(0xFE);
+    CHECK(upload_parse_frame(truncated.data(), (uint32_t)truncated.size(), out, sizeof(out), &parsed) ==
+          UPLOAD_BAD_FRAMING);
+    CHECK(parsed.len == -1);
+
+    // A zero inside the frame: the delimiter arrived early
+    auto zero = good;
+    zero[0] = 0;
+    CHECK(upload_parse_frame(zero.data(), (uint32_t)zero.size(), out, sizeof(out), &parsed) == UPLOAD_BAD_FRAMING);
+
+    // Decodes to more than the buffer holds
+    CHECK(upload_parse_frame(good.data(), (uint32_t)good.size(), out, 20, &parsed) == UPLOAD_BAD_FRAMING);
+
+    // Empty, and too short for a header and CRC
+    CHECK(upload_parse_frame(good.data(), 0, out, sizeof(out), &parsed) == UPLOAD_BAD_FRAMING);
+    const uint8_t tiny[] = {0x04, 1, 2, 3};
+    CHECK(upload_parse_frame(tiny, sizeof(tiny), out, sizeof(out), &parsed) == UPLOAD_BAD_FRAMING);
+}
+
+// CRCs are valid in all of these; only the lengths disagree
+void check_length_mismatch() {
+    const uint32_t full = UPLOAD_HEADER_BYTES + 10 * 2 * 2 + UPLOAD_CRC_BYTES;
+    CHECK(parse_raw(raw_frame(full, 10, 2, 10 * 2 * 2)) == UPLOAD_OK);
+    CHECK(parse_raw(raw_frame(full + 2, 10, 2, 10 * 2 * 2)) == UPLOAD_BAD_LENGTH);   // length field off
+    CHECK(parse_raw(raw_frame(full, 11, 2, 10 * 2 * 2)) == UPLOAD_BAD_LENGTH);       // steps off
+    CHECK(parse_raw(raw_frame(full, 10, 1, 10 * 2 * 2)) == UPLOAD_BAD_LENGTH);       // channels off
+    CHECK(parse_raw(raw_frame(full - 2, 10, 2, 10 * 2 * 2 - 2)) == UPLOAD_BAD_LENGTH);  // a duty short
+    CHECK(parse_raw(raw_frame(full, 10, 3, 10 * 2 * 2)) == UPLOAD_BAD_LENGTH);
+    CHECK(parse_raw(raw_frame(UPLOAD_HEADER_BYTES + UPLOAD_CRC_BYTES, 0, 1, 0)) == UPLOAD_BAD_LENGTH);
+    const uint32_t over = DISCHARGE_MAX_STEPS + 1;
+    CHECK(parse_raw(raw_frame(UPLOAD_HEADER_BYTES + over * 2 + UPLOAD_CRC_BYTES, over, 1, over * 2)) ==
+          UPLOAD_BAD_LENGTH);
+}
+
+// Informational only: the on-target figure is the decode time the Upload OK
+// reply reports
+void benchmark() {
+    constexpr int kCalls = 20000;
+    std::vector<uint16_t> duty;
+    const auto enc = make_encoded(DISCHARGE_MAX_STEPS, 2, 99, &duty);
+    uint8_t frame[UPLOAD_MAX_FRAME];
+    volatile uint32_t sink = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < kCalls; ++i) {
+        UploadFrame parsed;
+        sink = sink + upload_parse_frame(enc.data(), (uint32_t)enc.size(), frame, sizeof(frame), &parsed);
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / kCalls;
+    std::printf("[DATA] host us per %zu-byte frame (decode, length and CRC checks): %.2f\n", enc.size(), us);
+}
+
+}  // namespace
+
+int main() {
+    check_crc();
+    check_cobs_round_trip();
+    check_frame_round_trip();
+    check_corrupted_crc();
+    check_bad_cobs();
+    check_length_mismatch();
+    benchmark();
+    return test::exit_code("test_discharge_upload");
+}
@@ -0,0 +1,162 @@
+// test_phase_pwm.cpp
+// Chain engine timing for every phase count the firmware builds (4-12): the
+// solver and word builder from pwm_timing.c produce the words, the simulated
+// PIO blocks run them, and the measured period, high time and phase offset of
+// every output must match both the cycle model in phase_pwm.pio and the
+// requested frequency, duty and angle.
+
+#include "chain_rig.h"
+#include "test_util.h"
+
+extern "C" {
+#include "phase_pwm.pio.h"
+#include "pwm_timing.h"
+}
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+constexpr uint32_t kSysHz = 150000000;  // clk_sys on the Pico 2 W
+constexpr int kWarmPeriods = 1;
+constexpr int kMeasuredPeriods = 3;
+
+struct Expected {
+    uint32_t period;                            // PIO cycles
+    uint32_t high[PWM_TIMING_MAX_PHASES];
+    uint32_t rise[PWM_TIMING_MAX_PHASES];       // After phase 0's
+};
+
+// What phase_pwm.pio says the words do
+Expected model(const uint32_t words[], int n, uint32_t counts) {
+    Expected e{};
+    e.period = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+    e.high[0] = 2 * (words[0] & 0xFFFF) + PHASE_PWM_PULSE_FIXED_CYCLES;
+    for (int i = 1; i < n; ++i) {
+        e.rise[i] = e.rise[i - 1] + 2 * (words[i] & 0xFFFF) + PHASE_PWM_FOLLOWER_LINK_CYCLES;
+        e.high[i] = 2 * (words[i] >> 16) + PHASE_PWM_PULSE_FIXED_CYCLES;
+    }
+    return e;
+}
+
+// PIO cycles in clk_sys at a 16.8 divider. Edges land on whole clk_sys ticks,
+// so a measured interval is within one clock of this.
+double sys_clocks(uint32_t cycles, uint32_t div_q8) {
+    return cycles * (div_q8 / 256.0);
+}
+
+void check_program_sizes() {
+    const pio_sim::Source& src = rig::phase_pwm_source();
+    auto size = [&](const char *name) { return src.program(name).code.size(); };
+    // pio0 holds leader + follower, or the timeline on its own; pio1/pio2
+    // bridge + follower (or, for CHAIN_OCP, pio0 the fault-aware pair and pio1
+    // the fault counter)
+    CHECK(size("phase_pwm") + size("phase_pwm_follower") <= pio_sim::kInstructionMemory);
+    CHECK(size("phase_pwm_bridge") + size("phase_pwm_follower") <= pio_sim::kInstructionMemory);
+    CHECK(size("phase_timeline") <= pio_sim::kInstructionMemory);
+    CHECK(size("phase_pwm_ocp") + size("phase_pwm_ocp_follower") <= pio_sim::kInstructionMemory);
+    CHECK(size("phase_fault_count") <= pio_sim::kInstructionMemory);
+}
+
+// layout = nullptr for even spacing
+void check_chain(int n, const float *layout, float freq, float duty_pair1, float duty_pair2) {
+    uint32_t counts;
+    uint16_t div_int;
+    uint8_t div_frac;
+    if (!compute_best_timing(kSysHz, freq, 2, PHASE_PWM_LEADER_FIXED_CYCLES, &counts, &div_int, &div_frac)) {
+        CHECKF(false, "no timing for %.0f Hz", freq);
+        return;
+    }
+    const uint32_t div_q8 = (uint32_t)div_int << 8 | div_frac;
+    const uint32_t period_cycles = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+
+    // phase_layout_defaults() and phase_duty_for()
+    float angle[PWM_TIMING_MAX_PHASES], duty[PWM_TIMING_MAX_PHASES];
+    for (int i = 0; i < n; ++i) {
+        angle[i] = layout ? layout[i] : 360.0f * i / n;
+        duty[i] = pwm_phase_pair(n, i) == 0 ? duty_pair1 : duty_pair2;
+    }
+    uint32_t words[PWM_TIMING_MAX_PHASES];
+    if (!chain_build_words(&CHAIN_TIMING, n, counts, period_cycles, angle, duty, 0, words, false)) {
+        CHECKF(false, "N=%d %.0f Hz: no chain words", n, freq);
+        return;
+    }
+    const Expected e = model(words, n, counts);
+
+    // The model against the request
+    const double actual_freq = kSysHz / sys_clocks(e.period, div_q8);
+    CHECKF(std::fabs(actual_freq - freq) / freq < 1e-3, "N=%d: %.0f Hz realised as %.3f Hz", n, freq, actual_freq);
+    for (int i = 0; i < n; ++i) {
+        const double want_high = (double)duty[i] * e.period;
+        CHECKF(std::fabs(e.high[i] - want_high) <= 1.0, "N=%d %.0f Hz phase %d: high %u cycles for %.1f", n, freq,
+               i, e.high[i], want_high);
+        const uint32_t want_rise = phase_rise_cycles(angle, i, e.period);
+        CHECKF(e.rise[i] >= want_rise && e.rise[i] <= want_rise + 1, "N=%d %.0f Hz phase %d: rise %u for %u", n,
+               freq, i, e.rise[i], want_rise);
+    }
+
+    // The simulated PIO against the model
+    rig::ChainRig chain(n, div_q8);
+    CHECK(chain.queue(words));
+    chain.enable();
+    chain.run(100);
+    chain.set_trigger(true);
+    const double period_sys = sys_clocks(e.period, div_q8);
+    chain.run((uint64_t)(period_sys * (kWarmPeriods + kMeasuredPeriods + 1)) + 100);
+
+    const std::vector<rig::Pulse> lead = rig::pulses(chain.m, rig::phase_pin(0));
+    if (!CHECK(lead.size() >= (size_t)(kWarmPeriods + kMeasuredPeriods + 1))) return;
+    bool ok = true;
+    for (int k = kWarmPeriods; k < kWarmPeriods + kMeasuredPeriods && ok; ++k) {
+        const double period = (double)(lead[k + 1].rise - lead[k].rise);
+        ok &= CHECKF(std::fabs(period - period_sys) < 1.0, "N=%d %.0f Hz: period %.0f clocks, model %.2f", n, freq,
+                     period, period_sys);
+        for (int i = 0; i < n && ok; ++i) {
+            const uint64_t rise = rig::first_rise_after(chain.m, rig::phase_pin(i), lead[k].rise);
+            const std::vector<rig::Pulse> p = rig::pulses(chain.m, rig::phase_pin(i));
+            const rig::Pulse *pulse = nullptr;
+            for (const rig::Pulse& q : p) {
+                if (q.rise == rise) pulse = &q;
+            }
+            if (!(ok &= CHECKF(pulse != nullptr, "N=%d %.0f Hz phase %d: no pulse", n, freq, i))) break;
+            const double offset = (double)(rise - lead[k].rise);
+            ok &= CHECKF(std::fabs(offset - sys_clocks(e.rise[i], div_q8)) < 1.0,
+                         "N=%d %.0f Hz phase %d: rises %.0f clocks after phase 0, model %.2f", n, freq, i, offset,
+                         sys_clocks(e.rise[i], div_q8));
+            const double high = (double)(pulse->fall - pulse->rise);
+            ok &= CHECKF(std::fabs(high - sys_clocks(e.high[i], div_q8)) < 1.0,
+                         "N=%d %.0f Hz phase %d: HIGH for %.0f clocks, model %.2f", n, freq, i, high,
+                         sys_clocks(e.high[i], div_q8));
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    check_program_sizes();
+
+    const float freqs[] = {1000.0f, 7300.0f, 20000.0f, 50000.0f, 123456.0f, 250000.0f, 500000.0f};
+    const float duties[][2] = {{0.10f, 0.10f}, {0.25f, 0.40f}, {0.45f, 0.30f}};
+    for (int n = 4; n <= PWM_TIMING_MAX_PHASES; n += 2) {
+        const int before = test::failures;
+        for (float f : freqs) {
+            for (const auto& d : duties) {
+                check_chain(n, nullptr, f, d[0], d[1]);
+            }
+        }
+        std::printf("[INFO] %2d phases: %s\n", n, test::failures == before ? "ok" : "FAILED");
+    }
+
+    // An uneven four-phase layout (PHASES 0 120 240 300)
+    const float uneven[] = {0.0f, 120.0f, 240.0f, 300.0f};
+    const int before = test::failures;
+    for (float f : freqs) {
+        for (const auto& d : duties) {
+            check_chain(4, uneven, f, d[0], d[1]);
+        }
+    }
+    std::printf("[INFO] 0/120/240/300: %s\n", test::failures == before ? "ok" : "FAILED");
+    return test::exit_code("test_phase_pwm");
+}
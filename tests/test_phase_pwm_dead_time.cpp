@@ -0,0 +1,148 @@
+// test_phase_pwm_dead_time.cpp
+// Dead time between complementary phases (DEADTIME): words built with a dead
+// time by chain_build_words() / timeline_layout_words() and run on the
+// simulator must never have a phase HIGH together with its 180-degree partner,
+// and every partner rise must come at least the dead time after the phase
+// fell, from the first period of a run through a trigger drop and a re-trigger.
+// Where the dead time is what caps the duty, the gap must be the dead time to
+// within one high step.
+
+#include "chain_rig.h"
+#include "test_util.h"
+
+extern "C" {
+#include "phase_pwm.pio.h"
+#include "pwm_timing.h"
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kDiv1 = 256;         // Divider 1.0: gaps in PIO cycles are gaps in clk_sys
+constexpr uint32_t kSysHz = 150000000;
+constexpr int kRunPeriods = 4;
+
+const uint32_t kDeadTimes[] = {1, 2, 7, 20, 64};
+const float kDuties[] = {0.2f, 0.45f, 0.5f, 0.7f, 0.95f};
+
+// Smallest gap from phase a falling to phase b rising, over every rise of b
+// that follows a pulse on a; -1 if b ever rises while a is HIGH.
+long long min_gap(const pio_sim::Machine& m, int pin_a, int pin_b) {
+    const std::vector<rig::Pulse> a = rig::pulses(m, pin_a);
+    long long gap = -2;     // No rise of b after a pulse on a yet
+    for (const rig::Pulse& b : rig::pulses(m, pin_b)) {
+        const rig::Pulse *before = nullptr;
+        for (const rig::Pulse& p : a) {
+            if (p.rise <= b.rise) before = &p;
+        }
+        if (before == nullptr) continue;
+        if (before->fall > b.rise) return -1;
+        const long long g = (long long)(b.rise - before->fall);
+        gap = gap < 0 ? g : std::min(gap, g);
+    }
+    return gap;
+}
+
+// Two runs with a trigger drop between them
+template <typename Rig>
+void run_twice(Rig& r, uint32_t period) {
+    r.set_trigger(true);
+    r.run(kRunPeriods * period);
+    r.set_trigger(false);
+    r.run(period / 3);
+    r.set_trigger(true);
+    r.run(kRunPeriods * period);
+}
+
+void check_chain(int n, float freq, float duty, uint32_t dead_time) {
+    uint32_t counts;
+    uint64_t err;
+    CHECK(counts_for_divider(timing_target_q16(kSysHz, freq), kDiv1, 2, PHASE_PWM_LEADER_FIXED_CYCLES, &counts,
+                             &err));
+    const uint32_t period = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+    float angle[PWM_TIMING_MAX_PHASES], d[PWM_TIMING_MAX_PHASES];
+    for (int i = 0; i < n; ++i) {
+        angle[i] = 360.0f * i / n;
+        d[i] = duty;
+    }
+    uint32_t words[PWM_TIMING_MAX_PHASES];
+    if (!chain_build_words(&CHAIN_TIMING, n, counts, period, angle, d, dead_time, words, false)) {
+        CHECKF(false, "N=%d %.0f Hz duty %.2f: no words for dead time %u", n, freq, duty, dead_time);
+        return;
+    }
+    uint32_t uncapped[PWM_TIMING_MAX_PHASES];
+    CHECK(chain_build_words(&CHAIN_TIMING, n, counts, period, angle, d, 0, uncapped, false));
+
+    rig::ChainRig chain(n, kDiv1);
+    CHECK(chain.queue(words));
+    chain.enable();
+    chain.run(20);
+    run_twice(chain, period);
+
+    for (int i = 0; i < n; ++i) {
+        const int partner = pwm_phase_partner(n, i);
+        const long long gap = min_gap(chain.m, rig::phase_pin(i), rig::phase_pin(partner));
+        if (!CHECKF(gap >= (long long)dead_time, "N=%d %.0f Hz duty %.2f dt %u: phase %d -> %d gap %lld", n, freq,
+                    duty, dead_time, i, partner, gap)) {
+            continue;
+        }
+        // Capped by the dead time (shorter than without it): the gap is as
+        // short as the high step allows
+        auto high_of = [](const uint32_t w[], int k) { return k == 0 ? (w[0] & 0xFFFF) : (w[k] >> 16); };
+        if (high_of(words, i) < high_of(uncapped, i)) {
+            CHECKF(gap < (long long)(dead_time + CHAIN_TIMING.high_step),
+                   "N=%d %.0f Hz duty %.2f dt %u: phase %d capped but gap %lld", n, freq, duty, dead_time, i, gap);
+        }
+    }
+}
+
+void check_timeline(uint32_t period, float duty, uint32_t dead_time) {
+    const float angle[4] = {0.0f, 90.0f, 180.0f, 270.0f};
+    const float d[4] = {duty, duty, duty, duty};
+    uint32_t words[TIMELINE_WORDS], high[4], requested[4];
+    if (!timeline_layout_words(period, angle, d, dead_time, words, high, requested)) {
+        CHECKF(false, "timeline period %u duty %.2f: no table for dead time %u", period, duty, dead_time);
+        return;
+    }
+
+    rig::TimelineRig timeline(kDiv1, words, TIMELINE_WORDS);
+    timeline.run(2 * period);
+    run_twice(timeline, period);
+
+    for (int i = 0; i < 4; ++i) {
+        const int partner = (i + 2) % 4;
+        const long long gap = min_gap(timeline.m, rig::phase_pin(i), rig::phase_pin(partner));
+        CHECKF(gap >= (long long)dead_time, "timeline period %u duty %.2f dt %u: phase %d -> %d gap %lld", period,
+               duty, dead_time, i, partner, gap);
+    }
+}
+
+}  // namespace
+
+int main() {
+    for (int n = 4; n <= PWM_TIMING_MAX_PHASES; n += 2) {
+        const int before = test::failures;
+        for (float freq : {100000.0f, 400000.0f}) {
+            for (float duty : kDuties) {
+                for (uint32_t dt : kDeadTimes) {
+                    check_chain(n, freq, duty, dt);
+                }
+            }
+        }
+        std::printf("[INFO] chain %2d phases: %s\n", n, test::failures == before ? "ok" : "FAILED");
+    }
+
+    const int before = test::failures;
+    for (uint32_t period : {200u, 1000u, 1502u}) {
+        for (float duty : kDuties) {
+            for (uint32_t dt : kDeadTimes) {
+                check_timeline(period, duty, dt);
+            }
+        }
+    }
+    std::printf("[INFO] timeline: %s\n", test::failures == before ? "ok" : "FAILED");
+    return test::exit_code("test_phase_pwm_dead_time");
+}
@@ -0,0 +1,211 @@
+// test_phase_pwm_ocp.cpp
+// CHAIN_OCP engine: the PHASE_PWM_OCP_* cycle counts in phase_pwm.pio, checked
+// on the simulator one by one (period, high time, follower link and slack,
+// restart, fault and trigger-drop latency), plus the per-phase fault counters.
+
+#include "chain_rig.h"
+#include "test_util.h"
+
+extern "C" {
+#include "phase_pwm.pio.h"
+#include "pwm_timing.h"
+}
+
+#include <cstdio>
+
+namespace {
+
+constexpr int kPhases = 4;
+constexpr uint32_t kDiv1 = 256;     // Divider 1.0: one PIO cycle per clk_sys
+constexpr uint32_t kSysHz = 150000000;
+
+struct Layout {
+    uint32_t counts;
+    uint32_t period;
+    uint32_t words[kPhases];
+};
+
+// Evenly spaced phases at one duty, divider 1
+Layout layout(float freq, float duty) {
+    Layout l{};
+    uint64_t err;
+    CHECK(counts_for_divider(timing_target_q16(kSysHz, freq), kDiv1, 2, PHASE_PWM_OCP_LEADER_FIXED_CYCLES, &l.counts,
+                             &err));
+    l.period = 2 * l.counts + PHASE_PWM_OCP_LEADER_FIXED_CYCLES;
+    const float angle[kPhases] = {0.0f, 90.0f, 180.0f, 270.0f};
+    const float d[kPhases] = {duty, duty, duty, duty};
+    CHECK(chain_build_words(&CHAIN_OCP_TIMING, kPhases, l.counts, l.period, angle, d, 0, l.words, false));
+    return l;
+}
+
+void run_until_high(rig::ChainRig& chain, int pin) {
+    for (int guard = 0; guard < 1000000 && !chain.m.pin(pin); ++guard) chain.m.step();
+}
+
+// Rise offsets after phase 0 by the OCP model
+void model_rises(const uint32_t words[], uint32_t rise[kPhases]) {
+    rise[0] = 0;
+    for (int i = 1; i < kPhases; ++i) {
+        rise[i] = rise[i - 1] + 2 * (words[i] & 0xFFFF) + PHASE_PWM_OCP_FOLLOWER_LINK_CYCLES;
+    }
+}
+
+void check_cycle_model() {
+    const Layout l = layout(100000.0f, 0.2f);
+    rig::ChainRig chain(kPhases, kDiv1, true);
+    chain.queue(l.words);
+    chain.enable();
+    chain.run(50);
+    const uint64_t t_trigger = chain.m.clock();
+    chain.set_trigger(true);
+    chain.run(5 * l.period);
+
+    // Restart: synchroniser, then the wait and three more instructions
+    const uint64_t first = rig::first_rise_after(chain.m, rig::phase_pin(0), t_trigger);
+    CHECKF(first - t_trigger == pio_sim::kInputSyncClocks + PHASE_PWM_OCP_RESTART_CYCLES,
+           "first rise %llu clocks after the trigger", (unsigned long long)(first - t_trigger));
+
+    uint32_t rise[kPhases];
+    model_rises(l.words, rise);
+    const std::vector<rig::Pulse> lead = rig::pulses(chain.m, rig::phase_pin(0));
+    if (!CHECK(lead.size() >= 4)) return;
+    for (size_t k = 1; k + 1 < lead.size(); ++k) {
+        CHECKF(lead[k + 1].rise - lead[k].rise == l.period, "period %llu, model %u",
+               (unsigned long long)(lead[k + 1].rise - lead[k].rise), l.period);
+    }
+    for (int i = 0; i < kPhases; ++i) {
+        const uint32_t high = i == 0 ? (l.words[0] & 0xFFFF) : (l.words[i] >> 16);
+        for (const rig::Pulse& p : rig::pulses(chain.m, rig::phase_pin(i))) {
+            CHECKF(p.fall - p.rise == PHASE_PWM_OCP_HIGH_STEP_CYCLES * high + PHASE_PWM_OCP_PULSE_FIXED_CYCLES,
+                   "phase %d HIGH for %llu", i, (unsigned long long)(p.fall - p.rise));
+        }
+        const uint64_t r = rig::first_rise_after(chain.m, rig::phase_pin(i), lead[1].rise);
+        CHECKF(r - lead[1].rise == rise[i], "phase %d rises %llu after phase 0, model %u", i,
+               (unsigned long long)(r - lead[1].rise), rise[i]);
+    }
+}
+
+// Follower slack: with the period shortened until 2 * delay + 4 * high + slack
+// equals it exactly, phase 1 still rises on schedule; one more high step and
+// it is late for phase 0's flag.
+void check_follower_slack() {
+    const Layout l = layout(100000.0f, 0.95f);
+    const uint32_t delay = l.words[1] & 0xFFFF;
+    const uint32_t high = l.words[1] >> 16;     // Already capped by the slack
+    const uint32_t period = 2 * delay + PHASE_PWM_OCP_HIGH_STEP_CYCLES * high + PHASE_PWM_OCP_FOLLOWER_SLACK_CYCLES;
+    CHECKF(period <= l.period && l.period - period < PHASE_PWM_OCP_HIGH_STEP_CYCLES,
+           "builder left %u cycles of slack", l.period - period);
+    const uint32_t counts = (period - PHASE_PWM_OCP_LEADER_FIXED_CYCLES) / 2;
+    const uint32_t leader_high = l.words[0] & 0xFFFF;
+
+    for (uint32_t extra = 0; extra <= 1; ++extra) {
+        const uint32_t words[kPhases] = {((counts - 2 * leader_high) << 16) | leader_high,
+                                         l.words[1] + (extra << 16), l.words[2], l.words[3]};
+        uint32_t rise[kPhases];
+        model_rises(words, rise);
+
+        rig::ChainRig chain(kPhases, kDiv1, true);
+        chain.queue(words);
+        chain.enable();
+        chain.set_trigger(true);
+        chain.run(8 * period);
+
+        const std::vector<rig::Pulse> lead = rig::pulses(chain.m, rig::phase_pin(0));
+        CHECK(lead.size() >= 7 && lead[2].rise - lead[1].rise == period);
+        bool on_schedule = true;
+        for (size_t k = 1; k + 1 < lead.size(); ++k) {
+            on_schedule &= rig::first_rise_after(chain.m, rig::phase_pin(1), lead[k].rise) - lead[k].rise == rise[1];
+        }
+        if (extra == 0) {
+            CHECKF(on_schedule, "phase 1 late at the slack limit");
+        } else {
+            CHECKF(!on_schedule, "phase 1 kept up one high step past the slack limit");
+        }
+    }
+}
+
+// A fault cuts the pulse within 2 cycles of the sample (samples 4 apart, plus
+// the synchroniser), leaves the period and the other phases alone, and is
+// counted on the phase that was HIGH.
+void check_fault() {
+    const Layout l = layout(100000.0f, 0.2f);
+    rig::ChainRig chain(kPhases, kDiv1, true);
+    chain.queue(l.words);
+    chain.enable();
+    chain.run(10);
+    chain.set_trigger(true);
+    run_until_high(chain, rig::phase_pin(0));
+    chain.run(l.period);
+
+    constexpr int kCuts = 12;
+    for (int k = 0; k < kCuts; ++k) {
+        run_until_high(chain, rig::phase_pin(0));
+        chain.run(20 + k);                      // Walk the fault across the sample phase
+        const uint64_t t_fault = chain.m.clock();
+        chain.set_fault(true);
+        chain.run(12);
+        chain.set_fault(false);
+        const uint64_t fall = chain.m.falls(rig::phase_pin(0)).back();
+        CHECKF(fall >= t_fault && fall - t_fault <= pio_sim::kInputSyncClocks + 6,
+               "cut %d: LOW %lld clocks after the fault", k, (long long)(fall - t_fault));
+        chain.run(l.period / 2);
+    }
+    chain.run(2 * l.period);
+
+    uint32_t rise[kPhases];
+    model_rises(l.words, rise);
+    const std::vector<rig::Pulse> lead = rig::pulses(chain.m, rig::phase_pin(0));
+    for (size_t k = 1; k + 1 < lead.size(); ++k) {
+        CHECK(lead[k + 1].rise - lead[k].rise == l.period);
+        for (int i = 1; i < kPhases; ++i) {
+            CHECK(rig::first_rise_after(chain.m, rig::phase_pin(i), lead[k].rise) - lead[k].rise == rise[i]);
+        }
+    }
+    for (int i = 0; i < kPhases; ++i) {
+        const uint32_t count = chain.fault_count(i);
+        CHECKF(count == (i == 0 ? kCuts : 0), "phase %d counted %u cuts", i, count);
+    }
+}
+
+// Trigger drop, at every point of a period: a HIGH output goes LOW within 4
+// cycles of the drop being seen, a rising edge already under way (due within
+// 4 cycles) still goes out but as a runt of at most 4, and every output is LOW
+// and stays LOW within 7.
+void check_trigger_drop() {
+    const Layout l = layout(100000.0f, 0.4f);
+    for (uint32_t at = 0; at < l.period; ++at) {
+        rig::ChainRig chain(kPhases, kDiv1, true);
+        chain.queue(l.words);
+        chain.enable();
+        chain.set_trigger(true);
+        chain.run(2 * l.period + at);
+        const uint64_t t_seen = chain.m.clock() + pio_sim::kInputSyncClocks;
+        chain.set_trigger(false);
+        chain.run(l.period);
+        for (int i = 0; i < kPhases; ++i) {
+            const int pin = rig::phase_pin(i);
+            const std::vector<rig::Pulse> p = rig::pulses(chain.m, pin);
+            CHECKF(!chain.m.pin(pin) && !p.empty(), "phase %d: drop at %u", i, at);
+            if (p.empty() || p.back().fall < t_seen) continue;
+            const rig::Pulse& last = p.back();
+            if (last.rise < t_seen) {
+                CHECKF(last.fall - t_seen <= 4, "phase %d: LOW %llu cycles after drop at %u", i,
+                       (unsigned long long)(last.fall - t_seen), at);
+            } else {
+                CHECKF(last.rise - t_seen <= 4 && last.fall - last.rise <= 4 && last.fall - t_seen <= 7,
+                       "phase %d: runt %llu-%llu after drop at %u", i, (unsigned long long)(last.rise - t_seen),
+                       (unsigned long long)(last.fall - t_seen), at);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    check_cycle_model();
+    check_follower_slack();
+    check_fault();
+    check_trigger_drop();
+    return test::exit_code("test_phase_pwm_ocp");
+}
@@ -0,0 +1,236 @@
+// test_phase_pwm_restart.cpp
+// Re-trigger path of the CHAIN and TIMELINE engines: a trigger edge restarts
+// the outputs PHASE_PWM_RESTART_CYCLES / PHASE_TIMELINE_RESTART_CYCLES after
+// the synchroniser, with the words left over from the last run (nothing is
+// queued again), the second run repeats the first exactly, and a trigger drop
+// at any point of a period parks every output within the bounds phase_pwm.pio
+// documents.
+
+#include "chain_rig.h"
+#include "test_util.h"
+
+extern "C" {
+#include "phase_pwm.pio.h"
+#include "pwm_timing.h"
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kDiv1 = 256;         // Divider 1.0: one PIO cycle per clk_sys
+constexpr uint32_t kSysHz = 150000000;
+constexpr int kRunPeriods = 3;
+
+// Chain trigger drop, in PIO cycles after the drop is seen (phase_pwm.pio)
+constexpr uint64_t kChainDropLow = 3;   // A HIGH output goes LOW
+constexpr uint64_t kChainRuntRise = 7;  // A rise already under way still goes out
+constexpr uint64_t kChainRuntHigh = 4;  // ... as a runt this long at most
+constexpr uint64_t kChainParked = 11;   // Every output LOW for good
+// Timeline: the hold loop samples every 2 cycles, but a segment that ends
+// just after the drop still writes its successor's pattern first
+constexpr uint64_t kTimelineDropLow = 5;
+constexpr uint64_t kTimelineRuntRise = 1;
+constexpr uint64_t kTimelineRuntHigh = 4;
+constexpr uint64_t kTimelineParked = 5;
+
+struct Chain {
+    int n;
+    uint32_t period;
+    std::vector<uint32_t> words;
+};
+
+Chain chain_layout(int n, float freq, float duty) {
+    Chain c{n, 0, std::vector<uint32_t>(n)};
+    uint32_t counts;
+    uint64_t err;
+    CHECK(counts_for_divider(timing_target_q16(kSysHz, freq), kDiv1, 2, PHASE_PWM_LEADER_FIXED_CYCLES, &counts,
+                             &err));
+    c.period = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+    float angle[PWM_TIMING_MAX_PHASES], d[PWM_TIMING_MAX_PHASES];
+    for (int i = 0; i < n; ++i) {
+        angle[i] = 360.0f * i / n;
+        d[i] = duty;
+    }
+    CHECK(chain_build_words(&CHAIN_TIMING, n, counts, c.period, angle, d, 0, c.words.data(), false));
+    return c;
+}
+
+// Every edge on the given pins in [from, from + span), relative to from
+std::vector<rig::Pulse> snapshot(const pio_sim::Machine& m, const std::vector<int>& pins, uint64_t from,
+                                 uint64_t span) {
+    std::vector<rig::Pulse> out;
+    for (int pin : pins) {
+        for (const rig::Pulse& p : rig::pulses(m, pin)) {
+            if (p.rise >= from && p.fall < from + span) out.push_back({p.rise - from, p.fall - from});
+        }
+        out.push_back({UINT64_MAX, UINT64_MAX});    // Pin separator
+    }
+    return out;
+}
+
+bool all_low(const pio_sim::Machine& m, const std::vector<int>& pins) {
+    return std::none_of(pins.begin(), pins.end(), [&](int pin) { return m.pin(pin); });
+}
+
+std::vector<int> chain_pins(int n) {
+    std::vector<int> pins;
+    for (int i = 0; i < n; ++i) pins.push_back(rig::phase_pin(i));
+    return pins;
+}
+
+// Two runs from one queue of words: same latency from the edge, same outputs
+void check_chain_retrigger(int n) {
+    const Chain c = chain_layout(n, 100000.0f, 0.3f);
+    const std::vector<int> pins = chain_pins(n);
+    rig::ChainRig chain(n, kDiv1);
+    CHECK(chain.queue(c.words.data()));
+    chain.enable();
+    chain.run(50);
+
+    std::vector<rig::Pulse> runs[2];
+    for (int run = 0; run < 2; ++run) {
+        const uint64_t t_trigger = chain.m.clock();
+        chain.set_trigger(true);
+        chain.run(kRunPeriods * c.period + 20);
+        const uint64_t first = rig::first_rise_after(chain.m, rig::phase_pin(0), t_trigger);
+        CHECKF(first - t_trigger == pio_sim::kInputSyncClocks + PHASE_PWM_RESTART_CYCLES,
+               "N=%d run %d: first rise %llu clocks after the trigger", n, run,
+               (unsigned long long)(first - t_trigger));
+        runs[run] = snapshot(chain.m, pins, first, (kRunPeriods - 1) * c.period);
+
+        chain.set_trigger(false);
+        chain.run(c.period);
+        CHECKF(all_low(chain.m, pins), "N=%d run %d: outputs not parked", n, run);
+        for (int i = 0; i < n; ++i) {
+            CHECK(chain.m.tx_level(i / rig::kPhasesPerBank, i % rig::kPhasesPerBank) == 0);
+        }
+    }
+    CHECKF(runs[0] == runs[1], "N=%d: the re-triggered run differs from the first", n);
+}
+
+// Worst trigger-drop latencies over many drops, in PIO cycles after the drop
+// is seen: a HIGH output going LOW, a rise already under way going out as a
+// runt, and the last edge of all
+struct DropWorst {
+    uint64_t low = 0, runt_rise = 0, runt_high = 0, parked = 0;
+
+    void add(const pio_sim::Machine& m, const std::vector<int>& pins, uint64_t t_seen) {
+        for (int pin : pins) {
+            const std::vector<rig::Pulse> p = rig::pulses(m, pin);
+            if (p.empty() || p.back().fall < t_seen) continue;
+            const rig::Pulse& last = p.back();
+            parked = std::max(parked, last.fall - t_seen);
+            if (last.rise < t_seen) {
+                low = std::max(low, last.fall - t_seen);
+            } else {
+                runt_rise = std::max(runt_rise, last.rise - t_seen);
+                runt_high = std::max(runt_high, last.fall - last.rise);
+            }
+        }
+    }
+
+    void check(const char *name, uint64_t max_low, uint64_t max_runt_rise, uint64_t max_runt_high,
+               uint64_t max_parked) const {
+        CHECKF(low <= max_low && runt_rise <= max_runt_rise && runt_high <= max_runt_high && parked <= max_parked,
+               "%s: drop -> LOW %llu, runt rise %llu high %llu, parked %llu", name, (unsigned long long)low,
+               (unsigned long long)runt_rise, (unsigned long long)runt_high, (unsigned long long)parked);
+        std::printf("[DATA] %s drop: LOW within %llu, runts rise within %llu for at most %llu, "
+                    "parked within %llu PIO cycles\n",
+                    name, (unsigned long long)low, (unsigned long long)runt_rise, (unsigned long long)runt_high,
+                    (unsigned long long)parked);
+    }
+};
+
+// Chain trigger drop at every point of a period
+void check_chain_drop(int n) {
+    const Chain c = chain_layout(n, 100000.0f, 0.4f);
+    const std::vector<int> pins = chain_pins(n);
+    DropWorst worst;
+    for (uint32_t at = 0; at < c.period; ++at) {
+        rig::ChainRig chain(n, kDiv1);
+        chain.queue(c.words.data());
+        chain.enable();
+        chain.set_trigger(true);
+        chain.run(2 * c.period + at);
+        const uint64_t t_seen = chain.m.clock() + pio_sim::kInputSyncClocks;
+        chain.set_trigger(false);
+        chain.run(c.period);
+        CHECKF(all_low(chain.m, pins), "N=%d: outputs not parked after a drop at %u", n, at);
+        worst.add(chain.m, pins, t_seen);
+    }
+    char name[16];
+    std::snprintf(name, sizeof name, "chain N=%d", n);
+    worst.check(name, kChainDropLow, kChainRuntRise, kChainRuntHigh, kChainParked);
+}
+
+struct Timeline {
+    uint32_t period;
+    uint32_t words[TIMELINE_WORDS];
+};
+
+Timeline timeline_layout(float duty) {
+    Timeline t{1000, {}};
+    const float angle[4] = {0.0f, 90.0f, 180.0f, 270.0f};
+    const float d[4] = {duty, duty, duty, duty};
+    uint32_t high[4], requested[4];
+    CHECK(timeline_layout_words(t.period, angle, d, 0, t.words, high, requested));
+    return t;
+}
+
+void check_timeline_retrigger() {
+    const Timeline t = timeline_layout(0.2f);
+    const std::vector<int> pins = chain_pins(4);
+    rig::TimelineRig timeline(kDiv1, t.words, TIMELINE_WORDS);
+    timeline.run(3 * t.period);     // Parked: seeks the top of a period and holds
+
+    std::vector<rig::Pulse> runs[2];
+    for (int run = 0; run < 2; ++run) {
+        const uint64_t t_trigger = timeline.m.clock();
+        timeline.set_trigger(true);
+        timeline.run(kRunPeriods * t.period + 20);
+        const uint64_t first = rig::first_rise_after(timeline.m, rig::phase_pin(0), t_trigger);
+        CHECKF(first - t_trigger == pio_sim::kInputSyncClocks + PHASE_TIMELINE_RESTART_CYCLES,
+               "timeline run %d: first rise %llu clocks after the trigger", run,
+               (unsigned long long)(first - t_trigger));
+        runs[run] = snapshot(timeline.m, pins, first, (kRunPeriods - 1) * t.period);
+
+        timeline.set_trigger(false);
+        timeline.run(2 * t.period);
+        CHECKF(all_low(timeline.m, pins), "timeline run %d: outputs not parked", run);
+    }
+    CHECKF(runs[0] == runs[1], "timeline: the re-triggered run differs from the first");
+}
+
+// Timeline trigger drop at every point of a period
+void check_timeline_drop() {
+    const Timeline t = timeline_layout(0.4f);
+    const std::vector<int> pins = chain_pins(4);
+    DropWorst worst;
+    for (uint32_t at = 0; at < t.period; ++at) {
+        rig::TimelineRig timeline(kDiv1, t.words, TIMELINE_WORDS);
+        timeline.run(50);
+        timeline.set_trigger(true);
+        timeline.run(2 * t.period + at);
+        const uint64_t t_seen = timeline.m.clock() + pio_sim::kInputSyncClocks;
+        timeline.set_trigger(false);
+        timeline.run(t.period);
+        CHECKF(all_low(timeline.m, pins), "timeline: outputs not parked after a drop at %u", at);
+        worst.add(timeline.m, pins, t_seen);
+    }
+    worst.check("timeline", kTimelineDropLow, kTimelineRuntRise, kTimelineRuntHigh, kTimelineParked);
+}
+
+}  // namespace
+
+int main() {
+    for (int n = 4; n <= PWM_TIMING_MAX_PHASES; n += 4) {
+        check_chain_retrigger(n);
+        check_chain_drop(n);
+    }
+    check_timeline_retrigger();
+    check_timeline_drop();
+    return test::exit_code("test_phase_pwm_restart");
+}
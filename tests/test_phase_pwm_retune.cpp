@@ -0,0 +1,168 @@
+// test_phase_pwm_retune.cpp
+// Live retune of the chain engine: words queued the way update_pwm_parameters()
+// does it (once the last commit has cleared, followers first, leader last)
+// must switch every phase in the same period, wherever in a period they land.
+// Every chain period, from the leader's rise to its next, has to be all old or
+// all new timing. A retune cut short by a trigger drop must be taken by every
+// phase on the next edge.
+
+#include "chain_rig.h"
+#include "test_util.h"
+
+extern "C" {
+#include "phase_pwm.pio.h"
+#include "pwm_timing.h"
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kDiv1 = 256;         // Divider 1.0: one PIO cycle per clk_sys
+constexpr uint32_t kSysHz = 150000000;
+constexpr uint64_t kPushGap = 4;        // clk_sys between the CPU's FIFO writes
+constexpr int kCommitBlock = 1;         // PHASE_PWM_COMMIT_IRQ lives on pio1
+
+// One set of words and what phase_pwm.pio says they do
+struct Layout {
+    uint32_t period = 0;
+    std::vector<uint32_t> words, rise, high;
+};
+
+Layout layout(int n, float freq, float duty) {
+    Layout l;
+    uint32_t counts;
+    uint64_t err;
+    CHECK(counts_for_divider(timing_target_q16(kSysHz, freq), kDiv1, 2, PHASE_PWM_LEADER_FIXED_CYCLES, &counts,
+                             &err));
+    l.period = 2 * counts + PHASE_PWM_LEADER_FIXED_CYCLES;
+    float angle[PWM_TIMING_MAX_PHASES], d[PWM_TIMING_MAX_PHASES];
+    for (int i = 0; i < n; ++i) {
+        angle[i] = 360.0f * i / n;
+        d[i] = duty;
+    }
+    l.words.resize(n);
+    CHECK(chain_build_words(&CHAIN_TIMING, n, counts, l.period, angle, d, 0, l.words.data(), false));
+    l.rise.assign(n, 0);
+    l.high.assign(n, 0);
+    l.high[0] = 2 * (l.words[0] & 0xFFFF) + PHASE_PWM_PULSE_FIXED_CYCLES;
+    for (int i = 1; i < n; ++i) {
+        l.rise[i] = l.rise[i - 1] + 2 * (l.words[i] & 0xFFFF) + PHASE_PWM_FOLLOWER_LINK_CYCLES;
+        l.high[i] = 2 * (l.words[i] >> 16) + PHASE_PWM_PULSE_FIXED_CYCLES;
+    }
+    return l;
+}
+
+// chain_commit_settle() and the pushes after it
+void retune(rig::ChainRig& chain, const Layout& l) {
+    while (chain.m.tx_level(0, 0) != 0 || chain.m.irq(kCommitBlock, PHASE_PWM_COMMIT_IRQ)) chain.run(1);
+    for (int i = chain.phases - 1; i >= 0; --i) {
+        CHECK(chain.m.put(i / rig::kPhasesPerBank, i % rig::kPhasesPerBank, l.words[i]));
+        chain.run(kPushGap);
+    }
+}
+
+bool has_pulse(const std::vector<rig::Pulse>& p, uint64_t rise, uint64_t high) {
+    for (const rig::Pulse& q : p) {
+        if (q.rise == rise) return q.fall - q.rise == high;
+    }
+    return false;
+}
+
+// Which layout the chain period starting at leader rise r ran: 0 or 1 if every
+// phase matches it, -1 if it is torn
+int period_layout(const std::vector<std::vector<rig::Pulse>>& pulses, uint64_t r, uint64_t next_r,
+                  const Layout* l[2]) {
+    for (int k = 0; k < 2; ++k) {
+        if (next_r - r != l[k]->period) continue;
+        bool all = true;
+        for (size_t i = 0; i < pulses.size() && all; ++i) {
+            all = has_pulse(pulses[i], r + l[k]->rise[i], l[k]->high[i]);
+        }
+        if (all) return k;
+    }
+    return -1;
+}
+
+// Layout of every whole chain period from `from` on
+std::vector<int> period_layouts(const rig::ChainRig& chain, uint64_t from, const Layout* l[2]) {
+    std::vector<std::vector<rig::Pulse>> pulses;
+    for (int i = 0; i < chain.phases; ++i) pulses.push_back(rig::pulses(chain.m, rig::phase_pin(i)));
+    std::vector<uint64_t> r;
+    for (const rig::Pulse& p : pulses[0]) {
+        if (p.rise >= from) r.push_back(p.rise);
+    }
+    std::vector<int> out;
+    const uint64_t longest = std::max(l[0]->period, l[1]->period);
+    for (size_t j = 0; j + 1 < r.size(); ++j) {
+        if (r[j] + 2 * longest > chain.m.clock()) break;    // Last phases not out yet
+        out.push_back(period_layout(pulses, r[j], r[j + 1], l));
+    }
+    return out;
+}
+
+// Retune to b and straight back to a, starting `at` clk_sys into a period:
+// a..a b..b a..a with nothing torn
+void check_live(int n, const Layout& a, const Layout& b, uint32_t at) {
+    rig::ChainRig chain(n, kDiv1);
+    CHECK(chain.queue(a.words.data()));
+    chain.enable();
+    chain.set_trigger(true);
+    chain.run(2 * a.period + at);
+    const uint64_t from = rig::first_rise_after(chain.m, rig::phase_pin(0), 0);
+    retune(chain, b);
+    retune(chain, a);
+    chain.run(4 * std::max(a.period, b.period));
+
+    const Layout* l[2] = {&a, &b};
+    const std::vector<int> seen = period_layouts(chain, from, l);
+    int switches = 0, torn = 0, new_periods = 0;
+    for (size_t j = 0; j < seen.size(); ++j) {
+        if (seen[j] < 0) ++torn;
+        if (seen[j] == 1) ++new_periods;
+        if (j > 0 && seen[j] >= 0 && seen[j - 1] >= 0 && seen[j] != seen[j - 1]) ++switches;
+    }
+    CHECKF(torn == 0 && switches == 2 && new_periods >= 1 && seen.front() == 0 && seen.back() == 0,
+           "N=%d retune at %u: %d torn periods, %d switches, %d periods on the new words", n, at, torn, switches,
+           new_periods);
+}
+
+// Trigger drop `at` clk_sys after the leader commits: after the re-trigger
+// every period is on the new words
+void check_drop_in_commit(int n, const Layout& a, const Layout& b, uint32_t at) {
+    rig::ChainRig chain(n, kDiv1);
+    CHECK(chain.queue(a.words.data()));
+    chain.enable();
+    chain.set_trigger(true);
+    chain.run(2 * a.period);
+    retune(chain, b);
+    while (chain.m.tx_level(0, 0) != 0) chain.run(1);
+    chain.run(at);
+    chain.set_trigger(false);
+    chain.run(b.period);
+    const uint64_t from = chain.m.clock();
+    chain.set_trigger(true);
+    chain.run(4 * b.period);
+
+    const Layout* l[2] = {&a, &b};
+    const std::vector<int> seen = period_layouts(chain, from, l);
+    bool all_new = !seen.empty();
+    for (int k : seen) all_new &= k == 1;
+    CHECKF(all_new, "N=%d drop %u clocks into the commit period: re-triggered run not all on the new words", n, at);
+}
+
+}  // namespace
+
+int main() {
+    for (int n = 4; n <= PWM_TIMING_MAX_PHASES; n += 2) {
+        const int before = test::failures;
+        const Layout a = layout(n, 100000.0f, 0.3f);
+        const Layout b = layout(n, 90000.0f, 0.4f);
+        for (uint32_t at = 0; at < a.period; at += 5) check_live(n, a, b, at);
+        for (uint32_t at = 0; at < b.period; at += 7) check_drop_in_commit(n, a, b, at);
+        std::printf("[INFO] chain %2d phases: %s\n", n, test::failures == before ? "ok" : "FAILED");
+    }
+    return test::exit_code("test_phase_pwm_retune");
+}
@@ -0,0 +1,255 @@
+// test_timing_solver.cpp
+// compute_best_timing() against independent searches, swept densely over
+// 1 Hz - 1 MHz for the period models the firmware solves. Over its band of
+// periods (the longest usable one down to 1 - 1/2^TIMING_BAND_SHIFT of it) and
+// dividers (the TIMING_DIV_SPAN smallest that reach it) it must find exactly
+// what a search over every count finds; how much frequency accuracy the band
+// gives up against every count is printed. Also checks the duty quantisation
+// of the chain words, compares with the old brute-force search as
+// PIO_TIMING_CHECK does on target, and fails if a call takes longer than a
+// fixed host time budget anywhere in the range.
+
+#include "test_util.h"
+
+extern "C" {
+#include "phase_pwm.pio.h"
+#include "pwm_timing.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+constexpr uint32_t kSysHz = 150000000;
+// Mean host time per call. The solver needs a fraction of this; the
+// scan over every count in the band it replaced took 4.7 us below 10 kHz.
+constexpr double kBudgetUs = 1.5;
+
+struct Solution {
+    bool ok = false;
+    uint32_t counts = 0;
+    uint32_t div_q8 = 0;
+    uint64_t err = UINT64_MAX;
+};
+
+uint64_t period_cycles(uint32_t cycles_per_count, uint32_t fixed, uint32_t counts) {
+    return (uint64_t)cycles_per_count * counts + fixed;
+}
+
+uint64_t error_q16(uint64_t target_q16, uint64_t div_q8, uint32_t cycles_per_count, uint32_t fixed,
+                   uint32_t counts) {
+    const uint64_t product = (div_q8 << 8) * period_cycles(cycles_per_count, fixed, counts);
+    return product > target_q16 ? product - target_q16 : target_q16 - product;
+}
+
+// Longer period wins a tie, as in the solver
+void consider(Solution& best, uint64_t target_q16, uint64_t div_q8, uint32_t cycles_per_count, uint32_t fixed,
+              uint32_t counts) {
+    if (div_q8 < PIO_CLKDIV_MIN_Q8 || div_q8 > PIO_CLKDIV_MAX_Q8) return;
+    const uint64_t err = error_q16(target_q16, div_q8, cycles_per_count, fixed, counts);
+    if (err < best.err || (err == best.err && counts > best.counts)) {
+        best = {true, counts, (uint32_t)div_q8, err};
+    }
+}
+
+// The band from its definition: the longest period is the first one longer
+// than the cycles at divider 1.0, as every longer one runs slower still
+bool band(uint64_t target_q16, uint32_t cycles_per_count, uint32_t fixed, uint32_t *lo, uint32_t *hi) {
+    uint32_t top = 0;
+    for (uint32_t counts = PIO_MIN_COUNTS; counts <= PIO_MAX_COUNTS; ++counts) {
+        top = counts;
+        if (period_cycles(cycles_per_count, fixed, counts) << 16 > target_q16) break;
+    }
+    // Too fast even for the shortest period
+    if (period_cycles(cycles_per_count, fixed, PIO_MIN_COUNTS - 1) << 16 > target_q16) return false;
+    *hi = top;
+    *lo = std::max<uint32_t>(PIO_MIN_COUNTS, top - (top >> TIMING_BAND_SHIFT));
+    return true;
+}
+
+// Every count in the band, each with its best divider in the divider window
+Solution by_count(uint64_t target_q16, uint32_t cycles_per_count, uint32_t fixed) {
+    Solution best;
+    uint32_t lo, hi;
+    if (!band(target_q16, cycles_per_count, fixed, &lo, &hi)) return best;
+    const uint64_t div_lo = std::max<uint64_t>(target_q16 / (period_cycles(cycles_per_count, fixed, hi) << 8),
+                                               PIO_CLKDIV_MIN_Q8);
+    const uint64_t div_hi = div_lo + TIMING_DIV_SPAN - 1;
+    for (uint32_t counts = lo; counts <= hi; ++counts) {
+        const uint64_t period_q16 = period_cycles(cycles_per_count, fixed, counts) << 8;
+        const uint64_t floor_div = std::clamp(target_q16 / period_q16, div_lo, div_hi);
+        consider(best, target_q16, floor_div, cycles_per_count, fixed, counts);
+        consider(best, target_q16, std::min(floor_div + 1, div_hi), cycles_per_count, fixed, counts);
+    }
+    return best;
+}
+
+// Most accurate pair with no limit on the period
+Solution any_period(uint64_t target_q16, uint32_t cycles_per_count, uint32_t fixed) {
+    Solution best;
+    for (uint32_t counts = PIO_MAX_COUNTS; counts >= PIO_MIN_COUNTS; --counts) {
+        const uint64_t period_q16 = period_cycles(cycles_per_count, fixed, counts) << 8;
+        const uint64_t floor_div = target_q16 / period_q16;
+        consider(best, target_q16, floor_div, cycles_per_count, fixed, counts);
+        consider(best, target_q16, floor_div + 1, cycles_per_count, fixed, counts);
+    }
+    return best;
+}
+
+Solution solve(float freq, uint32_t cycles_per_count, uint32_t fixed) {
+    Solution s;
+    uint16_t div_int;
+    uint8_t div_frac;
+    s.ok = compute_best_timing(kSysHz, freq, cycles_per_count, fixed, &s.counts, &div_int, &div_frac);
+    if (s.ok) {
+        s.div_q8 = (uint32_t)div_int << 8 | div_frac;
+        s.err = error_q16(timing_target_q16(kSysHz, freq), s.div_q8, cycles_per_count, fixed, s.counts);
+    }
+    return s;
+}
+
+void check_against_search(const char *name, uint32_t cycles_per_count, uint32_t fixed, double step) {
+    double worst_ppm = 0.0, worst_at = 0.0, worst_gap = 0.0, worst_gap_at = 0.0;
+    int points = 0;
+    for (double f = 1.0; f <= 1.0e6; f *= step) {
+        const float freq = (float)f;
+        const uint64_t target_q16 = timing_target_q16(kSysHz, freq);
+        const Solution ref = by_count(target_q16, cycles_per_count, fixed);
+        const Solution got = solve(freq, cycles_per_count, fixed);
+        ++points;
+        if (!CHECKF(got.ok == ref.ok, "%s %.3f Hz: solver %s, search %s", name, f, got.ok ? "ok" : "none",
+                    ref.ok ? "ok" : "none") || !got.ok) {
+            continue;
+        }
+        CHECKF(got.counts == ref.counts && got.div_q8 == ref.div_q8,
+               "%s %.3f Hz: counts %u div 0x%x, search counts %u div 0x%x", name, f, got.counts, got.div_q8,
+               ref.counts, ref.div_q8);
+
+        const double ppm = 1e6 * (double)got.err / (double)target_q16;
+        // Where the count is pinned at its maximum, the bound pwm_timing.c gives
+        if (got.counts > PIO_MAX_COUNTS - (PIO_MAX_COUNTS >> TIMING_BAND_SHIFT) + 1) {
+            CHECKF(ppm <= 1e6 / (2.0 * (PIO_MAX_COUNTS - (PIO_MAX_COUNTS >> TIMING_BAND_SHIFT))),
+                   "%s %.3f Hz: %.3f ppm with the count near its maximum", name, f, ppm);
+        }
+        if (ppm > worst_ppm) {
+            worst_ppm = ppm;
+            worst_at = f;
+        }
+        const Solution any = any_period(target_q16, cycles_per_count, fixed);
+        const double gap = 1e6 * (double)(got.err - any.err) / (double)target_q16;
+        if (gap > worst_gap) {
+            worst_gap = gap;
+            worst_gap_at = f;
+        }
+    }
+    std::printf("[DATA] %s: %d points, worst %.3f ppm at %.1f Hz; any period would gain at most %.3f ppm "
+                "(at %.1f Hz)\n", name, points, worst_ppm, worst_at, worst_gap, worst_gap_at);
+}
+
+// Realised frequency of the old search after pio_sm_set_clkdiv() truncates its
+// divider to 16.8, as PIO_TIMING_CHECK scores it
+double legacy_err_ppm(float freq) {
+    uint32_t cycles;
+    float div;
+    compute_best_timing_bruteforce(kSysHz, freq, &cycles, &div);
+    if (cycles == 0) return -1.0;
+    const uint32_t div_int = (uint32_t)div;
+    const uint8_t div_frac = (uint8_t)((div - (float)div_int) * 256.0f);
+    const double div_q = div_int + div_frac / 256.0;
+    return 1e6 * std::fabs(kSysHz / (div_q * cycles) - freq) / freq;
+}
+
+void check_against_legacy() {
+    static const float steps[3] = {1.0f, 2.0f, 5.0f};
+    std::printf("[DATA] target_hz,err_ppm,legacy_err_ppm\n");
+    for (float decade = 1.0f; decade <= 1.0e6f; decade *= 10.0f) {
+        for (float s : steps) {
+            const float target = decade * s;
+            if (target > 1.0e6f) break;
+            const Solution got = solve(target, 1, 0);
+            const double ppm = got.ok ? 1e6 * std::fabs(kSysHz / (got.div_q8 / 256.0 * got.counts) - target) / target
+                                      : -1.0;
+            const double legacy = legacy_err_ppm(target);
+            std::printf("%.0f,%.3f,%.3f\n", target, ppm, legacy);
+            CHECKF(got.ok, "%.0f Hz: no timing", target);
+        }
+    }
+}
+
+// A chain high time lands within half a high step of duty * period
+void check_duty_quantisation(const chain_timing_t *t, const char *name) {
+    const float freqs[] = {1000.0f, 20000.0f, 100000.0f, 500000.0f, 1000000.0f};
+    for (float f : freqs) {
+        const Solution s = solve(f, 2, t->leader_fixed);
+        if (!CHECK(s.ok)) continue;
+        const uint32_t period = 2 * s.counts + t->leader_fixed;
+        for (float duty = 0.0f; duty <= 1.0f; duty += 0.0137f) {
+            const uint32_t max_count = s.counts / (t->high_step / 2);
+            const uint32_t high = duty_to_high_count(t, duty, period, max_count);
+            const double pulse = (double)t->high_step * high + t->pulse_fixed;
+            const double want = (double)duty * period;
+            if (want <= t->pulse_fixed) {
+                CHECK(high == 0);
+            } else if (high < max_count) {
+                CHECKF(std::fabs(pulse - want) <= t->high_step / 2.0, "%s %.0f Hz duty %.4f: %g cycles for %.2f",
+                       name, f, duty, pulse, want);
+            }
+        }
+    }
+}
+
+template <typename F>
+double mean_us(int calls, F&& fn) {
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i) fn(i);
+    const auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t1 - t0).count() / calls;
+}
+
+// Host times vary, so the budget is loose; the on-target figures come from
+// PIO_TIMING_CHECK. Each range is timed three times and the fastest counts.
+void benchmark() {
+    volatile uint32_t sink = 0;
+    auto solver = [&](float lo, float hi) {
+        double best = 1e9;
+        for (int run = 0; run < 3; ++run) {
+            best = std::min(best, mean_us(2000, [&](int i) {
+                uint32_t counts;
+                uint16_t di;
+                uint8_t df;
+                compute_best_timing(kSysHz, lo * std::pow(hi / lo, i / 2000.0f), 2, PHASE_PWM_LEADER_FIXED_CYCLES,
+                                    &counts, &di, &df);
+                sink = sink + counts;
+            }));
+        }
+        CHECKF(best <= kBudgetUs, "%.0f-%.0f Hz: %.2f us per call, budget %.2f", lo, hi, best, kBudgetUs);
+        return best;
+    };
+    const double low = solver(1.0f, 1000.0f);
+    const double mid = solver(1000.0f, 9000.0f);
+    const double high = solver(10000.0f, 1.0e6f);
+    const double legacy = mean_us(50, [&](int i) {
+        uint32_t cycles;
+        float div;
+        compute_best_timing_bruteforce(kSysHz, 1000.0f + 1000.0f * i, &cycles, &div);
+        sink = sink + cycles;
+    });
+    std::printf("[DATA] host us/call: solver 1 Hz-1 kHz %.2f, 1-9 kHz %.2f, 10 kHz-1 MHz %.2f, old search %.1f\n",
+                low, mid, high, legacy);
+}
+
+}  // namespace
+
+int main() {
+    check_against_search("chain", 2, PHASE_PWM_LEADER_FIXED_CYCLES, 1.003);
+    check_against_search("chain_ocp", 2, PHASE_PWM_OCP_LEADER_FIXED_CYCLES, 1.01);
+    check_against_search("cycles", 1, 0, 1.01);
+    check_against_legacy();
+    check_duty_quantisation(&CHAIN_TIMING, "chain");
+    check_duty_quantisation(&CHAIN_OCP_TIMING, "chain_ocp");
+    benchmark();
+    return test::exit_code("test_timing_solver");
+}
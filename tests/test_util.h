@@ -0,0 +1,49 @@
+// test_util.h
+// Minimal check macros for the host tests: every failed CHECK is printed and
+// counted, and test::exit_code() turns the count into the process exit code for CTest.
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace test {
+
+inline int failures = 0;
+inline int checks = 0;
+
+inline bool report(bool ok, const char *file, int line, const char *what) {
+    ++checks;
+    if (!ok) {
+        ++failures;
+        std::printf("[ERROR] %s:%d: CHECK(%s) failed\n", file, line, what);
+    }
+    return ok;
+}
+
+inline bool reportf(bool ok, const char *file, int line, const char *what, const char *fmt, ...) {
+    if (!report(ok, file, line, what)) {
+        std::va_list args;
+        va_start(args, fmt);
+        std::printf("        ");
+        std::vprintf(fmt, args);
+        std::printf("\n");
+        va_end(args);
+    }
+    return ok;
+}
+
+inline int exit_code(const char *name) {
+    std::printf("[INFO] %s: %d checks, %d failed\n", name, checks, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+}  // namespace test
+
+// Both evaluate to the condition, so a test can stop at the first failure
+#define CHECK(cond) test::report((cond), __FILE__, __LINE__, #cond)
+// With context printed on failure
+#define CHECKF(cond, ...) test::reportf((cond), __FILE__, __LINE__, #cond, __VA_ARGS__)
+
+#endif
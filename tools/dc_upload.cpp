@@ -0,0 +1,262 @@
+// dc_upload.cpp
+// Host-side uploader for discharge sequences (DC_UPLOAD binary frames).
+//
+// Build:  built as dc_upload by the host build (cmake without the Pico SDK), or
+//         g++ -std=c++17 -O2 -IHelpers -o dc_upload tools/dc_upload.cpp -x c Helpers/discharge_upload.c
+// Usage:  dc_upload <port> <step_duration> <file.csv>            binary upload
+//         dc_upload --compare <port> <step_duration> <file.csv>  CSV path vs binary, end to end
+//         dc_upload --bench <file.csv>                           host parser benchmark
+//
+// <file.csv> holds one step per line: "CH1_duty[,CH2_duty]" with duties 0..1.
+// Frames are built, encoded and (for --bench) decoded by Helpers/discharge_upload.c,
+// the same code finish_upload() in Helpers/GPIO_control_V2.c runs.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+extern "C" {
+#include "discharge_upload.h"
+}
+
+namespace {
+
+constexpr size_t kMaxSteps = DISCHARGE_MAX_STEPS;
+
+struct Sequence {
+    std::vector<float> ch1;
+    std::vector<float> ch2;
+    int channels = 1;
+};
+
+bool load_csv(const std::string& path, Sequence& seq) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "cannot open " << path << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        float d1, d2;
+        int n = std::sscanf(line.c_str(), "%f,%f", &d1, &d2);
+        if (n < 1) continue;
+        seq.ch1.push_back(d1);
+        seq.ch2.push_back(n >= 2 ? d2 : 0.0f);
+        if (n >= 2) seq.channels = 2;
+    }
+    if (seq.ch1.empty() || seq.ch1.size() > kMaxSteps) {
+        std::cerr << "need 1.." << kMaxSteps << " steps, got " << seq.ch1.size() << "\n";
+        return false;
+    }
+    return true;
+}
+
+uint16_t duty_q16(float d) {
+    if (d < 0.0f) d = 0.0f;
+    if (d > 1.0f) d = 1.0f;
+    return static_cast<uint16_t>(d * 65535.0f + 0.5f);
+}
+
+// COBS-encoded frame plus the 0x00 frame delimiter
+std::vector<uint8_t> encode_frame(const Sequence& seq) {
+    std::vector<uint16_t> duty;
+    for (size_t i = 0; i < seq.ch1.size(); ++i) {
+        duty.push_back(duty_q16(seq.ch1[i]));
+        if (seq.channels == 2) duty.push_back(duty_q16(seq.ch2[i]));
+    }
+    uint8_t frame[UPLOAD_MAX_FRAME];
+    const uint32_t len = upload_build_frame(duty.data(), static_cast<uint32_t>(seq.ch1.size()),
+                                            static_cast<uint32_t>(seq.channels), frame, sizeof(frame));
+    std::vector<uint8_t> out(UPLOAD_MAX_ENCODED);
+    out.resize(upload_cobs_encode(frame, len, out.data(), static_cast<uint32_t>(out.size())));
+    out.push_back(0);
+    return out;
+}
+
+std::string csv_text(const Sequence& seq) {
+    std::ostringstream os;
+    char line[32];
+    for (size_t i = 0; i < seq.ch1.size(); ++i) {
+        if (seq.channels == 2) {
+            std::snprintf(line, sizeof(line), "%.4f,%.4f\n", seq.ch1[i], seq.ch2[i]);
+        } else {
+            std::snprintf(line, sizeof(line), "%.4f\n", seq.ch1[i]);
+        }
+        os << line;
+    }
+    return os.str();
+}
+
+// --- Serial port ---
+class Port {
+public:
+    explicit Port(const std::string& path) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+        if (fd_ < 0) return;
+        termios tio{};
+        tcgetattr(fd_, &tio);
+        cfmakeraw(&tio);
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 1;
+        tcsetattr(fd_, TCSANOW, &tio);
+        tcflush(fd_, TCIOFLUSH);
+    }
+    ~Port() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    bool ok() const { return fd_ >= 0; }
+
+    bool write_all(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (len > 0) {
+            ssize_t n = ::write(fd_, p, len);
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+    bool write_line(const std::string& line) { return write_all((line + "\n").data(), line.size() + 1); }
+
+    // Reads lines until one contains any of the given markers; returns that line
+    bool wait_for(const std::vector<std::string>& markers, std::string& matched, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (std::chrono::steady_clock::now() < deadline) {
+            char c;
+            if (::read(fd_, &c, 1) != 1) continue;
+            if (c != '\n') {
+                if (c != '\r') pending_ += c;
+                continue;
+            }
+            std::string line;
+            line.swap(pending_);
+            for (const auto& m : markers) {
+                if (line.find(m) != std::string::npos) {
+                    matched = line;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    int fd_ = -1;
+    std::string pending_;
+};
+
+double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+bool upload_binary(Port& port, const std::string& duration, const Sequence& seq, double& ms) {
+    const auto encoded = encode_frame(seq);
+    std::string reply;
+    auto t0 = std::chrono::steady_clock::now();
+    port.write_line("DC_UPLOAD " + duration);
+    if (!port.wait_for({"UPLOAD_READY", "[ERROR]"}, reply, 2000) || reply.find("[ERROR]") != std::string::npos) {
+        std::cerr << "no UPLOAD_READY: " << reply << "\n";
+        return false;
+    }
+    port.write_all(encoded.data(), encoded.size());
+    bool done = port.wait_for({"Upload OK", "[ERROR]"}, reply, 5000);
+    ms = ms_since(t0);
+    std::cout << reply << "\n";
+    return done && reply.find("Upload OK") != std::string::npos;
+}
+
+bool upload_csv(Port& port, const std::string& duration, const Sequence& seq, double& ms) {
+    std::string reply;
+    auto t0 = std::chrono::steady_clock::now();
+    port.write_line("DC_CSV " + duration);
+    if (!port.wait_for({"CSV mode started", "[ERROR]"}, reply, 2000)) return false;
+    const std::string text = csv_text(seq);
+    port.write_all(text.data(), text.size());
+    port.write_line("DC_CSV_END");
+    bool done = port.wait_for({"CSV input finished"}, reply, 30000);
+    ms = ms_since(t0);
+    std::cout << reply << "\n";
+    return done;
+}
+
+int bench(const Sequence& seq) {
+    const std::string text = csv_text(seq);
+    const auto encoded = encode_frame(seq);
+    const int iterations = 20000;
+    uint8_t frame[UPLOAD_MAX_FRAME];
+    volatile uint32_t sink = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        const char* p = text.c_str();
+        while (*p) {
+            float d1, d2;
+            sink = sink + std::sscanf(p, "%f,%f", &d1, &d2);
+            p = std::strchr(p, '\n');
+            if (!p) break;
+            ++p;
+        }
+    }
+    const double csv_us = ms_since(t0) * 1000.0 / iterations;
+
+    t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        UploadFrame parsed;
+        sink = sink + upload_parse_frame(encoded.data(), static_cast<uint32_t>(encoded.size() - 1),
+                                         frame, sizeof(frame), &parsed);
+    }
+    const double bin_us = ms_since(t0) * 1000.0 / iterations;
+
+    std::printf("%zu steps x %d channels\n", seq.ch1.size(), seq.channels);
+    std::printf("CSV:    %6zu bytes, parse %8.2f us\n", text.size(), csv_us);
+    std::printf("Binary: %6zu bytes, decode+check %8.2f us\n", encoded.size(), bin_us);
+    std::printf("Wire size %.1fx smaller, parse %.1fx faster\n",
+                static_cast<double>(text.size()) / encoded.size(), csv_us / bin_us);
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 3 && std::strcmp(argv[1], "--bench") == 0) {
+        Sequence seq;
+        return load_csv(argv[2], seq) ? bench(seq) : 1;
+    }
+
+    const bool compare = argc == 5 && std::strcmp(argv[1], "--compare") == 0;
+    if (argc != 4 && !compare) {
+        std::cerr << "usage: dc_upload [--compare] <port> <step_duration> <file.csv>\n"
+                     "       dc_upload --bench <file.csv>\n";
+        return 1;
+    }
+    const int a = compare ? 2 : 1;
+    Sequence seq;
+    if (!load_csv(argv[a + 2], seq)) return 1;
+    Port port(argv[a]);
+    if (!port.ok()) {
+        std::cerr << "cannot open " << argv[a] << "\n";
+        return 1;
+    }
+
+    double bin_ms = 0.0;
+    if (compare) {
+        double csv_ms = 0.0;
+        if (!upload_csv(port, argv[a + 1], seq, csv_ms)) return 1;
+        if (!upload_binary(port, argv[a + 1], seq, bin_ms)) return 1;
+        std::printf("CSV %.1f ms, binary %.1f ms (%.1fx)\n", csv_ms, bin_ms, csv_ms / bin_ms);
+        return 0;
+    }
+    if (!upload_binary(port, argv[a + 1], seq, bin_ms)) return 1;
+    std::printf("Uploaded %zu steps in %.1f ms\n", seq.ch1.size(), bin_ms);
+    return 0;
+}